@@ -1,3 +1,5 @@
+import math
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import media_player
@@ -8,9 +10,65 @@ DEPENDENCIES = ["network"]
 CONF_TARGETS = "targets"
 CONF_MEDIA_PLAYER = "media_player"
 CONF_SPEAKER = "speaker"
+CONF_GROUP = "group"
+CONF_CHANNELS = "channels"
+CONF_BITS_PER_SAMPLE = "bits_per_sample"
 CONF_PORT_BASE = "port_base"
 CONF_MEDIA_URL_TEMPLATE = "media_url_template"
 CONF_OUTPUT_SAMPLE_RATE = "output_sample_rate"
+CONF_RX_BUFFER_SIZE = "rx_buffer_size"
+CONF_AUDIO_TASK_CORE = "audio_task_core"
+CONF_AUDIO_TASK_PRIORITY = "audio_task_priority"
+CONF_AUDIO_QUEUE_SIZE = "audio_queue_size"
+CONF_STATS_INTERVAL = "stats_interval"
+CONF_AUDIO_BUFFERS_IN_PSRAM = "audio_buffers_in_psram"
+CONF_SOFTWARE_VOLUME = "software_volume"
+CONF_VOLUME_PUBLISH_INTERVAL = "volume_publish_interval"
+CONF_DECODER_IDLE_TIMEOUT = "decoder_idle_timeout"
+CONF_RSA_PRIVATE_KEY = "rsa_private_key"
+CONF_HTTP_PORT = "http_port"
+CONF_HTTP_BUFFER_SIZE = "http_buffer_size"
+CONF_HTTP_MAX_CLIENTS = "http_max_clients"
+
+AIRPLAY_SAMPLE_RATE = 44100
+# Keep in sync with ResamplerDesign in resampler.h.
+RESAMPLER_BASE_TAPS = 24
+RESAMPLER_MIN_PHASES = 64
+MAX_RESAMPLER_PHASES = 512
+MAX_RESAMPLER_TABLE_TAPS = 20480
+
+
+def resampler_table_size(rate):
+    """Returns (reduced phases, phases, taps) of the resampler filter for AIRPLAY_SAMPLE_RATE -> rate."""
+    reduced = rate // math.gcd(AIRPLAY_SAMPLE_RATE, rate)
+    scale = -(-RESAMPLER_MIN_PHASES // reduced) if reduced < RESAMPLER_MIN_PHASES else 1
+    if AIRPLAY_SAMPLE_RATE > rate:
+        taps = -(-RESAMPLER_BASE_TAPS * AIRPLAY_SAMPLE_RATE // rate)
+    else:
+        taps = RESAMPLER_BASE_TAPS
+    return reduced, reduced * scale, (taps + 1) & ~1
+
+
+def validate_output_sample_rate(value):
+    value = cv.int_range(min=8000, max=96000)(value)
+    reduced, phases, taps = resampler_table_size(value)
+    if reduced > MAX_RESAMPLER_PHASES or phases * taps > MAX_RESAMPLER_TABLE_TAPS:
+        # The table is built by the compiler, which gives up on larger ones instead of failing validation.
+        raise cv.Invalid(
+            f"{value} Hz is not a simple enough ratio to {AIRPLAY_SAMPLE_RATE} Hz for the resampler "
+            f"({phases} filter phases of {taps} taps; at most {MAX_RESAMPLER_PHASES} phases and "
+            f"{MAX_RESAMPLER_TABLE_TAPS} coefficients); use a common rate such as "
+            "8000, 16000, 22050, 32000, 44100 or 48000"
+        )
+    return value
+
+
+def validate_rsa_private_key(value):
+    value = cv.string_strict(value).strip()
+    if not value.startswith("-----BEGIN") or "PRIVATE KEY-----" not in value:
+        raise cv.Invalid("rsa_private_key must be a PEM encoded RSA private key")
+    return value
+
 
 airplay_bridge_ns = cg.esphome_ns.namespace("airplay_bridge")
 AirPlayBridge = airplay_bridge_ns.class_("AirPlayBridge", cg.Component)
@@ -20,6 +78,9 @@ TARGET_SCHEMA = cv.Schema(
         cv.Required(CONF_MEDIA_PLAYER): cv.use_id(media_player.MediaPlayer),
         cv.Optional(CONF_SPEAKER): cv.use_id(cg.Component),
         cv.Optional(CONF_NAME): cv.string_strict,
+        cv.Optional(CONF_GROUP): cv.string_strict,
+        cv.Optional(CONF_CHANNELS, default=2): cv.one_of(1, 2, int=True),
+        cv.Optional(CONF_BITS_PER_SAMPLE, default=16): cv.one_of(16, 24, 32, int=True),
     }
 )
 
@@ -30,7 +91,20 @@ CONFIG_SCHEMA = (
             cv.Required(CONF_TARGETS): cv.All(cv.ensure_list(TARGET_SCHEMA), cv.Length(min=1)),
             cv.Optional(CONF_PORT_BASE, default=7000): cv.port,
             cv.Optional(CONF_MEDIA_URL_TEMPLATE, default=""): cv.string_strict,
-            cv.Optional(CONF_OUTPUT_SAMPLE_RATE, default=16000): cv.positive_int,
+            cv.Optional(CONF_OUTPUT_SAMPLE_RATE, default=16000): validate_output_sample_rate,
+            cv.Optional(CONF_RX_BUFFER_SIZE, default=8192): cv.int_range(min=2048, max=65540),
+            cv.Optional(CONF_AUDIO_TASK_CORE): cv.int_range(min=0, max=1),
+            cv.Optional(CONF_AUDIO_TASK_PRIORITY, default=5): cv.int_range(min=1, max=24),
+            cv.Optional(CONF_AUDIO_QUEUE_SIZE, default=16384): cv.int_range(min=2048, max=262144),
+            cv.Optional(CONF_STATS_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_AUDIO_BUFFERS_IN_PSRAM, default=False): cv.boolean,
+            cv.Optional(CONF_SOFTWARE_VOLUME, default=False): cv.boolean,
+            cv.Optional(CONF_VOLUME_PUBLISH_INTERVAL, default="500ms"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_DECODER_IDLE_TIMEOUT, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RSA_PRIVATE_KEY): cv.All(cv.only_with_esp_idf, validate_rsa_private_key),
+            cv.Optional(CONF_HTTP_PORT): cv.All(cv.only_with_esp_idf, cv.port),
+            cv.Optional(CONF_HTTP_BUFFER_SIZE, default=65536): cv.int_range(min=8192, max=1048576),
+            cv.Optional(CONF_HTTP_MAX_CLIENTS, default=4): cv.int_range(min=1, max=16),
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
@@ -43,13 +117,33 @@ async def to_code(config):
 
     cg.add(var.set_port_base(config[CONF_PORT_BASE]))
     cg.add(var.set_media_url_template(config[CONF_MEDIA_URL_TEMPLATE]))
-    cg.add(var.set_output_sample_rate(config[CONF_OUTPUT_SAMPLE_RATE]))
+    # The resampler and its filter tables are specialised on this at compile time.
+    cg.add_define("AIRPLAY_OUTPUT_SAMPLE_RATE", config[CONF_OUTPUT_SAMPLE_RATE])
+    cg.add(var.set_rx_buffer_size(config[CONF_RX_BUFFER_SIZE]))
+    if CONF_AUDIO_TASK_CORE in config:
+        cg.add(var.set_audio_task_core(config[CONF_AUDIO_TASK_CORE]))
+    cg.add(var.set_audio_task_priority(config[CONF_AUDIO_TASK_PRIORITY]))
+    cg.add(var.set_audio_queue_size(config[CONF_AUDIO_QUEUE_SIZE]))
+    cg.add(var.set_stats_interval(config[CONF_STATS_INTERVAL]))
+    cg.add(var.set_audio_buffers_in_psram(config[CONF_AUDIO_BUFFERS_IN_PSRAM]))
+    cg.add(var.set_software_volume(config[CONF_SOFTWARE_VOLUME]))
+    cg.add(var.set_volume_publish_interval(config[CONF_VOLUME_PUBLISH_INTERVAL]))
+    cg.add(var.set_decoder_idle_timeout(config[CONF_DECODER_IDLE_TIMEOUT]))
+    if CONF_RSA_PRIVATE_KEY in config:
+        cg.add(var.set_rsa_private_key(config[CONF_RSA_PRIVATE_KEY]))
+    if CONF_HTTP_PORT in config:
+        cg.add(var.set_http_port(config[CONF_HTTP_PORT]))
+    cg.add(var.set_http_buffer_size(config[CONF_HTTP_BUFFER_SIZE]))
+    cg.add(var.set_http_max_clients(config[CONF_HTTP_MAX_CLIENTS]))
 
     for target in config[CONF_TARGETS]:
         player = await cg.get_variable(target[CONF_MEDIA_PLAYER])
         target_name = target.get(CONF_NAME, "")
+        group = target.get(CONF_GROUP, "")
+        channels = target[CONF_CHANNELS]
+        bits = target[CONF_BITS_PER_SAMPLE]
         if CONF_SPEAKER in target:
             speaker = await cg.get_variable(target[CONF_SPEAKER])
-            cg.add(var.add_target(player, target_name, speaker))
+            cg.add(var.add_target(player, target_name, speaker, group, channels, bits))
         else:
-            cg.add(var.add_target(player, target_name, cg.RawExpression("nullptr")))
+            cg.add(var.add_target(player, target_name, cg.RawExpression("nullptr"), group, channels, bits))
@@ -2,6 +2,7 @@
 
 #include "esphome/components/speaker/speaker.h"
 #include "esphome/core/application.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esphome/core/util.h"
 
@@ -11,19 +12,26 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <sstream>
+#include <cstring>
 
 #ifdef USE_ESP32
 #include <esp_mac.h>
 #endif
 
 #ifdef USE_ESP_IDF
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include <esp_timer.h>
+#ifdef CONFIG_HEAP_USE_HOOKS
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#endif
 #if __has_include(<esp_audio_dec.h>)
 #define AIRPLAY_USE_ESP_AUDIO_CODEC 1
 #include <esp_audio_dec.h>
 #include <esp_audio_types.h>
+#if __has_include(<esp_aac_dec.h>)
+#define AIRPLAY_USE_AAC 1
+#include <esp_aac_dec.h>
+#endif
 #endif
 #endif
 
@@ -32,12 +40,164 @@ namespace airplay_bridge {
 
 static const char *const TAG = "airplay_bridge";
 
+// Smallest chunk worth issuing a read for before compacting the receive buffer.
+static const size_t RX_MIN_READ = 512;
+// Replies and resend requests the socket has not taken yet. A client that lets this much pile up has
+// stopped reading and is dropped.
+static const size_t TX_QUEUE_SIZE = 4096;
+// Connections a target keeps besides the one it serves, for senders checking availability or about to take
+// over. Their buffers only have to hold RTSP requests, up to an ANNOUNCE with its SDP.
+static const size_t MAX_PENDING_CONNECTIONS = 3;
+static const size_t PENDING_RX_SIZE = 2048;
+static const size_t PENDING_TX_SIZE = 1024;
+static const uint32_t PENDING_IDLE_TIMEOUT_MS = 30000;
+
+// Receiver latency advertised in RECORD (frames at 44.1 kHz). The jitter buffer is sized from it.
+static const uint32_t AUDIO_LATENCY_FRAMES = 2205;
+static const uint32_t AIRPLAY_SAMPLE_RATE = 44100;
+static const uint32_t AIRPLAY_FRAMES_PER_PACKET = 352;
+
+// RAOP control channel packet types (second RTP header byte without the marker bit).
+static const uint8_t RTP_TYPE_TIMING_REQUEST = 0x52;
+static const uint8_t RTP_TYPE_TIMING_RESPONSE = 0x53;
+static const uint8_t RTP_TYPE_SYNC = 0x54;
+static const uint8_t RTP_TYPE_RESEND_REQUEST = 0x55;
+static const uint8_t RTP_TYPE_RESEND_RESPONSE = 0x56;
+static const size_t RTP_RESEND_HEADER_SIZE = 4;
+static const size_t UDP_MAX_PACKET = 1536;
+static const size_t TIMING_PACKET_SIZE = 32;
+static const size_t SYNC_PACKET_SIZE = 20;
+// Sender latencies past this are taken as a corrupt sync packet. iTunes uses 2 s.
+static const int32_t MAX_SENDER_LATENCY_FRAMES = 10 * AIRPLAY_SAMPLE_RATE;
+// Timing exchanges: a quick burst at session start to converge, then a slow keep-up rate.
+static const uint8_t TIMING_BURST_COUNT = 4;
+static const uint32_t TIMING_BURST_INTERVAL_MS = 250;
+static const uint32_t TIMING_INTERVAL_MS = 3000;
+
+// Codecs offered in the RAOP `cn` TXT record (0 = PCM, 1 = ALAC, 2 = AAC). PCM needs no decoder; the others
+// are only offered when esp_audio_codec is built in.
+#if defined(AIRPLAY_USE_AAC)
+static const char *const RAOP_CODECS = "0,1,2";
+#elif defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
+static const char *const RAOP_CODECS = "0,1";
+#elif defined(USE_ESP_IDF)
+static const char *const RAOP_CODECS = "0";
+#else
+// Nothing is decoded locally without the audio task, so the choice does not matter here.
+static const char *const RAOP_CODECS = "0,1";
+#endif
+
+#ifdef USE_ESP_IDF
+// All decode and output buffers are preallocated on the heap, so the stack only has to hold the codec's
+// own working frames.
+static const uint32_t AUDIO_TASK_STACK_SIZE = 8192;
+static const uint32_t AUDIO_TASK_IDLE_MS = 100;
+// Wake-up period while streaming; due packets are released up to one period early.
+static const uint32_t AUDIO_TASK_TICK_MS = 5;
+// Largest RTP packet the jitter buffer stores: header plus an uncompressed 352-frame stereo ALAC frame.
+static const size_t JITTER_MAX_PACKET = 1536;
+// Ring space that RTP packets may not use, reserved for stream start/stop records.
+static const size_t AUDIO_CONTROL_HEADROOM = 256;
+static const size_t AUDIO_EVENT_QUEUE_SIZE = 512;
+// A retransmission is only worth requesting if it can plausibly arrive before the packet is due.
+static const int64_t RESEND_MIN_LEAD_US = 10000;
+// An AAC access unit is always 1024 frames.
+static const size_t AAC_FRAMES_PER_PACKET = 1024;
+// Largest packet of any codec this build decodes, which the audio buffers are sized for at setup. ALAC
+// senders use 352 frames like PCM; an ALAC stream announcing longer packets is played silent.
+#ifdef AIRPLAY_USE_AAC
+static const size_t MAX_FRAMES_PER_PACKET = AAC_FRAMES_PER_PACKET;
+#else
+static const size_t MAX_FRAMES_PER_PACKET = AIRPLAY_FRAMES_PER_PACKET;
+#endif
+// Frames faded in after concealment to avoid a click when real audio resumes.
+static const size_t CONCEAL_FADE_IN_FRAMES = 64;
+// Decoded audio is handed to the resampler and speaker in blocks of at least this many frames.
+static const size_t PCM_BLOCK_FRAMES = 1024;
+// Software volume moves at most this much (Q15) per output frame: full scale in about 10 ms at 16 kHz.
+static const int32_t VOLUME_RAMP_STEP = 205;
+// How often the buffer-level drift controller's output is applied to the playout timeline.
+static const int64_t RATE_TRIM_INTERVAL_US = 1000000;
+// Output the speaker accepts none of for this long is dropped, so a stopped speaker cannot wedge the stream.
+static const int64_t OUTPUT_STALL_TIMEOUT_US = 1000000;
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+// ESP-IDF calls the hook below on every heap allocation. Those made by the audio task are counted, so that
+// the stats can show that streaming never allocates.
+static TaskHandle_t counted_task = nullptr;
+static std::atomic<uint32_t> counted_allocations{0};
+
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+  (void) ptr;
+  (void) size;
+  (void) caps;
+  if (counted_task != nullptr && xTaskGetCurrentTaskHandle() == counted_task) {
+    counted_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+#endif
+
+// Heap allocations the audio task has made so far; always 0 without CONFIG_HEAP_USE_HOOKS to count them.
+static uint32_t audio_task_allocations() {
+#ifdef CONFIG_HEAP_USE_HOOKS
+  return counted_allocations.load(std::memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+// Sends as much of `tx` as the socket takes without blocking. Returns false if the connection failed.
+static bool flush_queued(int fd, RxBuffer &tx) {
+  while (!tx.empty()) {
+    const ssize_t sent = send(fd, tx.data(), tx.size(), 0);
+    if (sent > 0) {
+      tx.consume(static_cast<size_t>(sent));
+      continue;
+    }
+    // Not writable yet; the rest goes out on a later loop.
+    return sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  return true;
+}
+
+// Sends what the socket takes now and queues the rest behind anything already queued, so bytes never
+// overtake each other and the socket never has to block. Returns false if the connection failed or the
+// queue is full.
+static bool send_queued(int fd, RxBuffer &tx, const char *data, size_t len) {
+  if (!flush_queued(fd, tx)) {
+    return false;
+  }
+  if (tx.empty()) {
+    const ssize_t sent = send(fd, data, len, 0);
+    if (sent > 0) {
+      data += sent;
+      len -= static_cast<size_t>(sent);
+    } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+  }
+  if (len == 0) {
+    return true;
+  }
+  if (tx.reserve(len) < len) {
+    return false;
+  }
+  memcpy(tx.write_ptr(), data, len);
+  tx.commit(len);
+  return true;
+}
+#endif
+
 void AirPlayBridge::add_target(media_player::MediaPlayer *player, const std::string &name,
-                               esphome::Component *speaker_component) {
+                               esphome::Component *speaker_component, const std::string &group, uint8_t channels,
+                               uint8_t bits_per_sample) {
   TargetSpec spec;
   spec.player = player;
   spec.speaker = speaker_component ? reinterpret_cast<esphome::speaker::Speaker *>(speaker_component) : nullptr;
   spec.name = name;
+  spec.group = group;
+  spec.channels = channels;
+  spec.bits_per_sample = bits_per_sample;
   this->target_specs_.push_back(spec);
 }
 
@@ -53,19 +213,68 @@ void AirPlayBridge::setup() {
 }
 
 void AirPlayBridge::loop() {
+#ifdef USE_ESP_IDF
+  // One select() over every socket; the handlers below only read from the ones it reports.
+  this->sockets_.poll(0);
+#endif
   for (auto &target : this->runtimes_) {
     this->handle_target_(target);
   }
+#ifdef USE_ESP_IDF
+  this->http_server_.loop();
+#endif
 }
 
 void AirPlayBridge::dump_config() {
   ESP_LOGCONFIG(TAG, "AirPlay Bridge:");
   ESP_LOGCONFIG(TAG, "  Port base: %u", this->port_base_);
-  ESP_LOGCONFIG(TAG, "  Media URL template: %s", this->media_url_template_.empty() ? "(none)" : this->media_url_template_.c_str());
+  ESP_LOGCONFIG(TAG, "  RX buffer size: %u bytes", static_cast<unsigned>(this->rx_buffer_size_));
+#ifdef USE_ESP_IDF
+  if (this->audio_task_core_ < 0) {
+    ESP_LOGCONFIG(TAG, "  Audio task: any core, priority %u", this->audio_task_priority_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Audio task: core %d, priority %u", this->audio_task_core_, this->audio_task_priority_);
+  }
+  ESP_LOGCONFIG(TAG, "  Audio queue size: %u bytes", static_cast<unsigned>(this->audio_queue_size_));
+  ESP_LOGCONFIG(TAG, "  Audio buffers in PSRAM: %s", YESNO(this->audio_buffers_in_psram_));
+  ESP_LOGCONFIG(TAG, "  Software volume: %s", YESNO(this->software_volume_));
+#endif
+#ifdef USE_ESP_IDF
+  ESP_LOGCONFIG(TAG, "  Decoder idle timeout: %u ms", static_cast<unsigned>(this->decoder_idle_timeout_));
+  ESP_LOGCONFIG(TAG, "  Encrypted streams: %s", YESNO(this->raop_key_ != nullptr));
+  if (this->http_server_.started()) {
+    ESP_LOGCONFIG(TAG, "  HTTP stream: port %u, %u bytes per target, up to %u listeners", this->http_port_,
+                  static_cast<unsigned>(this->http_buffer_size_), this->http_max_clients_);
+  }
+#endif
+  ESP_LOGCONFIG(TAG, "  Volume publish interval: %u ms", static_cast<unsigned>(this->volume_publish_interval_));
+#ifdef USE_ESP_IDF
+  if (OutputResampler::PASS_THROUGH) {
+    ESP_LOGCONFIG(TAG, "  Output: %u Hz, no resampling", static_cast<unsigned>(AIRPLAY_OUTPUT_SAMPLE_RATE));
+  } else {
+    ESP_LOGCONFIG(TAG, "  Output: %u Hz, resampler tables %u bytes (flash), state %u bytes per target",
+                  static_cast<unsigned>(AIRPLAY_OUTPUT_SAMPLE_RATE),
+                  static_cast<unsigned>(OutputResampler::TABLE_BYTES), static_cast<unsigned>(sizeof(OutputResampler)));
+  }
+#endif
+  ESP_LOGCONFIG(TAG, "  Media URL template: %s",
+                this->media_url_template_.empty() ? "(none)" : this->media_url_template_.c_str());
   ESP_LOGCONFIG(TAG, "  Targets: %u", static_cast<unsigned>(this->target_specs_.size()));
   for (const auto &target : this->target_specs_) {
-    ESP_LOGCONFIG(TAG, "    - %s", target.name.c_str());
+    if (target.group.empty()) {
+      ESP_LOGCONFIG(TAG, "    - %s", target.name.c_str());
+    } else {
+      ESP_LOGCONFIG(TAG, "    - %s (group '%s')", target.name.c_str(), target.group.c_str());
+    }
+  }
+#ifdef USE_ESP_IDF
+  for (const auto &target : this->runtimes_) {
+    if (target.audio) {
+      ESP_LOGCONFIG(TAG, "  Output for '%s': %s", target.spec.name.c_str(),
+                    describe_output_format_(*target.audio).c_str());
+    }
   }
+#endif
 }
 
 void AirPlayBridge::setup_runtime_() {
@@ -74,6 +283,20 @@ void AirPlayBridge::setup_runtime_() {
     return;
   }
 
+#ifdef USE_ESP_IDF
+  if (!this->rsa_private_key_.empty()) {
+    auto key = std::make_unique<RaopKey>();
+    if (key->load(this->rsa_private_key_)) {
+      this->raop_key_ = std::move(key);
+    } else {
+      ESP_LOGE(TAG, "rsa_private_key is not a usable RSA private key; encrypted streams are disabled");
+    }
+    // The parsed key is all that is needed from here on.
+    this->rsa_private_key_.clear();
+    this->rsa_private_key_.shrink_to_fit();
+  }
+#endif
+
   std::string fallback_device_name = App.get_name();
   for (size_t idx = 0; idx < this->target_specs_.size(); idx++) {
     auto &spec = this->target_specs_[idx];
@@ -109,7 +332,7 @@ void AirPlayBridge::setup_runtime_() {
       runtime.server_fd = -1;
       continue;
     }
-    if (listen(runtime.server_fd, 1) < 0) {
+    if (listen(runtime.server_fd, MAX_PENDING_CONNECTIONS + 1) < 0) {
       ESP_LOGE(TAG, "listen() failed for target '%s' on port %u", spec.name.c_str(), spec.port);
       close(runtime.server_fd);
       runtime.server_fd = -1;
@@ -119,10 +342,96 @@ void AirPlayBridge::setup_runtime_() {
     if (flags >= 0) {
       fcntl(runtime.server_fd, F_SETFL, flags | O_NONBLOCK);
     }
+    this->sockets_.add(runtime.server_fd);
+    runtime.tx.allocate(TX_QUEUE_SIZE);
+#endif
+    runtime.rx.allocate(this->rx_buffer_size_);
+    runtime.rtsp.set_max_message_size(this->rx_buffer_size_);
+#ifdef USE_ESP_IDF
+    // Targets without a speaker only need decoding when their media player pulls the HTTP stream.
+    if (spec.speaker || this->http_port_ != 0) {
+      runtime.audio = std::make_unique<AudioPipeline>();
+      runtime.audio->queue.allocate(this->audio_queue_size_);
+      runtime.audio->events.allocate(AUDIO_EVENT_QUEUE_SIZE);
+      // Room for the advertised latency plus a few packets of reordering slack.
+      const size_t latency_packets = (AUDIO_LATENCY_FRAMES + AIRPLAY_FRAMES_PER_PACKET - 1) / AIRPLAY_FRAMES_PER_PACKET;
+      runtime.audio->jitter.allocate(latency_packets + 4, JITTER_MAX_PACKET);
+      runtime.audio->jitter.set_latency(AUDIO_LATENCY_FRAMES, AIRPLAY_SAMPLE_RATE);
+      this->choose_output_format_(*runtime.audio, spec);
+      if (this->raop_key_) {
+        runtime.audio->decrypt_buffer = std::make_unique<uint8_t[]>(JITTER_MAX_PACKET);
+      }
+      if (!this->allocate_audio_buffers_(*runtime.audio) ||
+          (!spec.speaker && !runtime.audio->stream.allocate(this->http_buffer_size_, this->audio_buffers_in_psram_))) {
+        ESP_LOGE(TAG, "Failed to allocate audio buffers for target '%s'; local playback disabled", spec.name.c_str());
+        runtime.audio.reset();
+      } else {
+        ESP_LOGI(TAG, "Output for target '%s': %s", spec.name.c_str(),
+                 describe_output_format_(*runtime.audio).c_str());
+      }
+    }
 #endif
     this->runtimes_.push_back(std::move(runtime));
   }
 
+#ifdef USE_ESP_IDF
+  // Group members play the leader's resampled blocks, so they have to run at the same rate as it.
+  for (auto &target : this->runtimes_) {
+    if (target.spec.group.empty()) {
+      continue;
+    }
+    if (!target.audio) {
+      ESP_LOGW(TAG, "Target '%s' has no local audio; group '%s' ignored", target.spec.name.c_str(),
+               target.spec.group.c_str());
+      target.spec.group.clear();
+      continue;
+    }
+    for (const auto &other : this->runtimes_) {
+      if (&other == &target) {
+        break;
+      }
+      if (other.spec.group == target.spec.group && other.audio->native_rate != target.audio->native_rate) {
+        ESP_LOGW(TAG, "Target '%s' outputs at a different rate from group '%s'; it will decode on its own",
+                 target.spec.name.c_str(), target.spec.group.c_str());
+        target.spec.group.clear();
+        break;
+      }
+    }
+  }
+
+  if (this->http_port_ != 0) {
+    if (this->http_server_.start(this->http_port_, this->http_max_clients_, &this->sockets_)) {
+      for (const auto &target : this->runtimes_) {
+        if (target.audio && !target.spec.speaker) {
+          this->http_server_.add_stream(target.spec.name, &target.audio->stream);
+        }
+      }
+    } else {
+      ESP_LOGE(TAG, "Could not listen on HTTP port %u; the stream URL will not work", this->http_port_);
+    }
+  }
+
+  // Decoding and speaker output run in their own task so that neither a slow component in the main loop
+  // nor a long decode can starve the other. The runtimes_ vector is not resized after this point.
+  const bool has_audio = std::any_of(this->runtimes_.begin(), this->runtimes_.end(),
+                                     [](const TargetRuntime &target) { return target.audio != nullptr; });
+  if (has_audio) {
+    const BaseType_t core = this->audio_task_core_ < 0 ? tskNO_AFFINITY : this->audio_task_core_;
+    if (xTaskCreatePinnedToCore(AirPlayBridge::audio_task_, "airplay_audio", AUDIO_TASK_STACK_SIZE, this,
+                                this->audio_task_priority_, &this->audio_task_handle_, core) != pdPASS) {
+      ESP_LOGE(TAG, "Failed to create audio task");
+      this->audio_task_handle_ = nullptr;
+    }
+#ifdef CONFIG_HEAP_USE_HOOKS
+    counted_task = this->audio_task_handle_;
+#endif
+  }
+#endif
+
+  if (this->stats_interval_ > 0) {
+    this->set_interval("stats", this->stats_interval_, [this]() { this->log_stats_(); });
+  }
+
   this->mdns_ready_ = this->setup_mdns_();
   if (!this->mdns_ready_) {
     ESP_LOGW(TAG, "mDNS service setup failed, discovery may not work.");
@@ -150,9 +459,11 @@ bool AirPlayBridge::setup_mdns_() {
     this->device_id_colon_ = "00:00:00:00:00:00";
     this->device_id_raop_ = "000000000000";
   } else {
+    memcpy(this->device_mac_, mac, sizeof(this->device_mac_));
     char colon_buf[18];
     char raop_buf[13];
-    snprintf(colon_buf, sizeof(colon_buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    snprintf(colon_buf, sizeof(colon_buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4],
+             mac[5]);
     snprintf(raop_buf, sizeof(raop_buf), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     this->device_id_colon_ = colon_buf;
     this->device_id_raop_ = raop_buf;
@@ -175,13 +486,19 @@ bool AirPlayBridge::setup_mdns_() {
 
 void AirPlayBridge::advertise_target_(const TargetRuntime &target) {
 #ifdef USE_ESP32
+  // Encryption types (0 = none, 1 = RSA); RSA is only offered when there is a key to answer with.
+#ifdef USE_ESP_IDF
+  const char *const RAOP_ENCRYPTION = this->raop_key_ ? "0,1" : "0";
+#else
+  const char *const RAOP_ENCRYPTION = "0";
+#endif
   std::string raop_instance = this->device_id_raop_ + "@" + target.spec.name;
   mdns_txt_item_t raop_txt[] = {
       {(char *) "txtvers", (char *) "1"},
       {(char *) "ch", (char *) "2"},
-      {(char *) "cn", (char *) "0,1"},
+      {(char *) "cn", (char *) RAOP_CODECS},
       {(char *) "da", (char *) "true"},
-      {(char *) "et", (char *) "0"},
+      {(char *) "et", (char *) RAOP_ENCRYPTION},
       {(char *) "md", (char *) "0,1,2"},
       {(char *) "pw", (char *) "false"},
       {(char *) "sr", (char *) "44100"},
@@ -193,7 +510,8 @@ void AirPlayBridge::advertise_target_(const TargetRuntime &target) {
       {(char *) "am", (char *) "ESPHome"},
       {(char *) "sf", (char *) "0x4"},
   };
-  mdns_service_add(raop_instance.c_str(), "_raop", "_tcp", target.spec.port, raop_txt, sizeof(raop_txt) / sizeof(raop_txt[0]));
+  mdns_service_add(raop_instance.c_str(), "_raop", "_tcp", target.spec.port, raop_txt,
+                   sizeof(raop_txt) / sizeof(raop_txt[0]));
 
   /* RAOP-only: _airplay with minimal features caused discovery issues. */
 #endif
@@ -211,7 +529,8 @@ void AirPlayBridge::handle_target_(TargetRuntime &target) {
     if (target.client) {
       target.client.stop();
     }
-    target.buffer.clear();
+    target.rx.clear();
+    target.rtsp.reset();
     target.streaming = false;
 
     WiFiClient candidate = target.server->available();
@@ -226,14 +545,21 @@ void AirPlayBridge::handle_target_(TargetRuntime &target) {
     return;
   }
 
-  while (target.client.available()) {
-    char c = static_cast<char>(target.client.read());
-    target.buffer.push_back(c);
-  }
-
-  RtspRequest request;
-  while (this->extract_next_request_(target, request)) {
-    this->handle_request_(target, request);
+  // Same scheme as the ESP-IDF path: read whole chunks straight into the receive buffer and drain complete
+  // frames after every read, instead of a call (and an lwIP lock) per byte.
+  while (target.client.connected() && target.client.available() > 0) {
+    if (target.rx.reserve(RX_MIN_READ) == 0) {
+      ESP_LOGW(TAG, "Receive buffer full for target '%s' (%u bytes), dropping client", target.spec.name.c_str(),
+               static_cast<unsigned>(target.rx.capacity()));
+      this->close_client_(target);
+      return;
+    }
+    const int read_len = target.client.read(target.rx.write_ptr(), target.rx.writable());
+    if (read_len <= 0) {
+      break;
+    }
+    target.rx.commit(static_cast<size_t>(read_len));
+    this->process_rx_(target);
   }
 #endif
 
@@ -242,336 +568,354 @@ void AirPlayBridge::handle_target_(TargetRuntime &target) {
     return;
   }
 
-  if (target.client_fd < 0) {
-    sockaddr_in client_addr{};
-    socklen_t addr_len = sizeof(client_addr);
-    int accepted = accept(target.server_fd, reinterpret_cast<sockaddr *>(&client_addr), &addr_len);
-    if (accepted >= 0) {
-      int on = 1;
-      setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
-      int flags = fcntl(accepted, F_GETFL, 0);
-      if (flags >= 0) {
-        fcntl(accepted, F_SETFL, flags | O_NONBLOCK);
-      }
-      target.client_fd = accepted;
-      target.buffer.clear();
-      target.streaming = false;
-      ESP_LOGI(TAG, "Client connected to target '%s' on port %u", target.spec.name.c_str(), target.spec.port);
+  if (this->sockets_.ready(target.server_fd)) {
+    this->accept_clients_(target);
+  }
+  if (!target.pending.empty()) {
+    this->handle_pending_(target);
+  }
+  // The UDP sockets outlive sessions and stay registered with the core, so they are read (and stale
+  // packets drained) even between sessions. A datagram left unread would keep the core's select() waking
+  // every loop.
+  if (target.audio_fd >= 0) {
+    this->read_udp_(target);
+  }
+  if (target.udp) {
+    const uint32_t interval =
+        target.timing_requests_sent < TIMING_BURST_COUNT ? TIMING_BURST_INTERVAL_MS : TIMING_INTERVAL_MS;
+    if (target.peer_timing_port != 0 && millis() - target.last_timing_request_ms >= interval) {
+      this->send_timing_request_(target);
     }
   }
+  if (target.audio) {
+    this->service_audio_events_(target);
+  }
 
-  if (target.client_fd < 0) {
+  if (target.client_fd < 0 || !this->flush_tx_(target)) {
     return;
   }
 
-  char rx[1024];
-  while (true) {
-    const ssize_t read_len = recv(target.client_fd, rx, sizeof(rx), 0);
+  if (target.rx_blocked) {
+    this->process_rx_(target);
+  }
+  // Read straight into the receive buffer and drain complete frames after every read, so the buffer
+  // only ever holds the unparsed tail of the stream. While the audio queue is full the socket is left
+  // alone, and TCP flow control slows the sender down.
+  while (target.client_fd >= 0 && !target.rx_blocked && this->sockets_.ready(target.client_fd)) {
+    if (target.rx.reserve(RX_MIN_READ) == 0) {
+      ESP_LOGW(TAG, "Receive buffer full for target '%s' (%u bytes), dropping client", target.spec.name.c_str(),
+               static_cast<unsigned>(target.rx.capacity()));
+      this->close_client_(target);
+      return;
+    }
+    const ssize_t read_len = recv(target.client_fd, target.rx.write_ptr(), target.rx.writable(), 0);
     if (read_len > 0) {
-      target.buffer.append(rx, static_cast<size_t>(read_len));
+      target.rx.commit(static_cast<size_t>(read_len));
+      this->process_rx_(target);
       continue;
     }
     if (read_len == 0) {
-      close(target.client_fd);
-      target.client_fd = -1;
-      target.buffer.clear();
-      target.streaming = false;
+      this->close_client_(target);
       return;
     }
     if (errno == EAGAIN || errno == EWOULDBLOCK) {
       break;
     }
     ESP_LOGW(TAG, "Socket read failed for target '%s' (errno=%d)", target.spec.name.c_str(), errno);
-    close(target.client_fd);
-    target.client_fd = -1;
-    target.buffer.clear();
-    target.streaming = false;
+    this->close_client_(target);
     return;
   }
 
-  RtspRequest request;
-  while (this->extract_next_request_(target, request)) {
-    this->handle_request_(target, request);
-  }
 #endif
 }
 
-bool AirPlayBridge::extract_next_request_(TargetRuntime &target, RtspRequest &request) {
-  // Interleaved RTP over TCP packets start with '$' and have a 2-byte length.
-  while (target.buffer.size() >= 4 && target.buffer[0] == '$') {
-    const uint8_t channel = static_cast<uint8_t>(target.buffer[1]);
-    const uint16_t payload_len = (static_cast<uint8_t>(target.buffer[2]) << 8) | static_cast<uint8_t>(target.buffer[3]);
-    const size_t frame_len = static_cast<size_t>(4 + payload_len);
-    if (target.buffer.size() < frame_len) {
-      return false;
-    }
+void AirPlayBridge::close_client_(TargetRuntime &target) {
+#ifdef USE_ARDUINO
+  target.client.stop();
+#endif
 #ifdef USE_ESP_IDF
-    if (channel == 0 && target.spec.speaker && payload_len > 0) {
-      this->process_rtp_audio_(target, reinterpret_cast<const uint8_t *>(target.buffer.data() + 4), payload_len);
+  if (target.client_fd >= 0) {
+    // One last try for anything still queued, such as the reply to a TEARDOWN.
+    if (!target.tx.empty()) {
+      send(target.client_fd, target.tx.data(), target.tx.size(), 0);
     }
-#endif
-    target.buffer.erase(0, frame_len);
-  }
-
-  const size_t header_end = target.buffer.find("\r\n\r\n");
-  if (header_end == std::string::npos) {
-    return false;
-  }
-
-  std::string header_blob = target.buffer.substr(0, header_end);
-  std::istringstream stream(header_blob);
-  std::string line;
-
-  if (!std::getline(stream, line)) {
-    target.buffer.erase(0, header_end + 4);
-    return false;
-  }
-  line = trim_(line);
-  {
-    std::istringstream first_line(line);
-    first_line >> request.method >> request.uri;
-  }
-  if (request.method.empty()) {
-    target.buffer.erase(0, header_end + 4);
-    return false;
+    this->sockets_.remove(target.client_fd);
+    close(target.client_fd);
+    target.client_fd = -1;
   }
+  target.tx.clear();
+  target.udp = false;
+  target.rx_blocked = false;
+#endif
+  ESP_LOGD(TAG, "Client disconnected from target '%s' (rx compaction moved %llu bytes in total)",
+           target.spec.name.c_str(), static_cast<unsigned long long>(target.rx.bytes_moved()));
+  target.rx.clear();
+  target.rtsp.reset();
+  target.streaming = false;
+}
 
-  request.headers.clear();
-  while (std::getline(stream, line)) {
-    line = trim_(line);
-    if (line.empty()) {
-      continue;
-    }
-    const size_t colon = line.find(':');
-    if (colon == std::string::npos) {
+void AirPlayBridge::process_rx_(TargetRuntime &target) {
+  while (!target.rx.empty()) {
+    // Interleaved RTP over TCP packets start with '$' and have a 2-byte length.
+    if (target.rx.data()[0] == '$') {
+      if (target.rx.size() < 4) {
+        return;
+      }
+      const uint8_t *frame = target.rx.data();
+      const uint8_t channel = frame[1];
+      const uint16_t payload_len = (static_cast<uint16_t>(frame[2]) << 8) | frame[3];
+      const size_t frame_len = static_cast<size_t>(4 + payload_len);
+      if (target.rx.size() < frame_len) {
+        return;
+      }
+#ifdef USE_ESP_IDF
+      const uint8_t *packet = nullptr;
+      size_t packet_len = 0;
+      if (channel == 0 && target.audio && payload_len > 0) {
+        packet = frame + 4;
+        packet_len = payload_len;
+      } else if (channel == 1 && target.audio && payload_len > RTP_RESEND_HEADER_SIZE &&
+                 (frame[5] & 0x7F) == RTP_TYPE_RESEND_RESPONSE) {
+        // Retransmitted audio packet: a 4-byte control header followed by the original RTP packet.
+        packet = frame + 4 + RTP_RESEND_HEADER_SIZE;
+        packet_len = payload_len - RTP_RESEND_HEADER_SIZE;
+      }
+      if (packet != nullptr) {
+        if (!target.audio->queue.fits(packet_len, AUDIO_CONTROL_HEADROOM)) {
+          // Unlike UDP, TCP can push back on the sender: keep the frame and retry on the next loop.
+          if (!target.rx_blocked) {
+            target.rx_stalls++;
+          }
+          target.rx_blocked = true;
+          return;
+        }
+        target.rx_blocked = false;
+        this->queue_audio_record_(target, AUDIO_RECORD_RTP, packet, packet_len);
+      }
+#else
+      (void) channel;
+#endif
+      target.rx.consume(frame_len);
       continue;
     }
-    std::string key = to_lower_(trim_(line.substr(0, colon)));
-    std::string value = trim_(line.substr(colon + 1));
-    request.headers[key] = value;
-  }
-
-  size_t content_len = 0;
-  auto content_it = request.headers.find("content-length");
-  if (content_it != request.headers.end()) {
-    content_len = static_cast<size_t>(atoi(content_it->second.c_str()));
-  }
 
-  const size_t total_len = header_end + 4 + content_len;
-  if (target.buffer.size() < total_len) {
-    return false;
+    RtspRequest request;
+    size_t consumed = 0;
+    const RtspParseResult result = target.rtsp.parse(target.rx.data(), target.rx.size(), request, consumed);
+    if (result == RtspParseResult::INCOMPLETE) {
+      return;
+    }
+    if (result == RtspParseResult::TOO_LARGE) {
+      ESP_LOGW(TAG, "RTSP request for target '%s' does not fit the %u byte receive buffer, dropping client",
+               target.spec.name.c_str(), static_cast<unsigned>(target.rx.capacity()));
+      this->close_client_(target);
+      return;
+    }
+    if (result == RtspParseResult::OK) {
+      // The request views point into the receive buffer, so it is consumed only after handling. If the
+      // handler closed the client the buffer is already cleared and consume() is a no-op.
+      this->handle_request_(target, request);
+    }
+    target.rx.consume(consumed);
   }
-
-  request.body = target.buffer.substr(header_end + 4, content_len);
-  target.buffer.erase(0, total_len);
-  return true;
 }
 
 void AirPlayBridge::handle_request_(TargetRuntime &target, const RtspRequest &request) {
-  ESP_LOGD(TAG, "RTSP %s %s (target: %s)", request.method.c_str(), request.uri.c_str(), target.spec.name.c_str());
-  for (const auto &h : request.headers) {
-    ESP_LOGD(TAG, "  %s: %s", h.first.c_str(), h.second.c_str());
-  }
+  ESP_LOGD(TAG, "RTSP %.*s %.*s (target: %s, CSeq: %.*s)", static_cast<int>(request.method.size()),
+           request.method.data(), static_cast<int>(request.uri.size()), request.uri.data(), target.spec.name.c_str(),
+           static_cast<int>(request.cseq.size()), request.cseq.data());
 
-  const auto cseq_it = request.headers.find("cseq");
-  const std::string cseq = cseq_it != request.headers.end() ? cseq_it->second : "1";
-
-  std::map<std::string, std::string> headers{
-      {"Server", "ESPHome AirPlay Bridge"},
-      {"Audio-Jack-Status", "connected; type=analog"},
-  };
+  const std::string_view cseq = request.cseq.empty() ? std::string_view("1") : request.cseq;
+  RtspResponse &response = this->response_;
 
   if (request.method == "OPTIONS") {
-    auto ac_it = request.headers.find("apple-challenge");
-    if (ac_it != request.headers.end()) {
+    std::string apple_response;
+#ifdef USE_ESP_IDF
+    if (!request.apple_challenge.empty() && this->raop_key_) {
+      apple_response = this->respond_to_challenge_(target.client_fd, request.apple_challenge);
+    }
+#endif
+    if (!request.apple_challenge.empty() && apple_response.empty()) {
       ESP_LOGW(TAG, "OPTIONS with Apple-Challenge (et=0 should avoid this); client may require auth");
     }
-    std::string opt_resp = "RTSP/1.0 200 OK\r\n";
-    opt_resp += "CSeq: " + cseq + "\r\n";
-    opt_resp += "Public: ANNOUNCE, SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER, POST, GET\r\n";
-    opt_resp += "Server: AirTunes/366.0\r\n";
-    opt_resp += "Audio-Jack-Status: connected; type=analog\r\n\r\n";
-    this->send_raw_(target, opt_resp);
-    ESP_LOGD(TAG, "OPTIONS 200 OK sent (CSeq=%s)", cseq.c_str());
+    this->begin_options_response_(cseq, apple_response);
+    this->send_response_(target);
+    ESP_LOGD(TAG, "OPTIONS 200 OK sent (CSeq=%.*s)", static_cast<int>(cseq.size()), cseq.data());
     return;
   }
 
-  if (request.method == "POST" && (request.uri == "/fp-setup" || request.uri.find("/fp-setup") == 0)) {
-    headers["Content-Type"] = "application/octet-stream";
-    this->send_response_(target, 200, cseq, headers, "");
+  if (request.method == "POST" && request.uri.find("/fp-setup") == 0) {
+    this->begin_response_(200, cseq);
+    response.header("Content-Type", "application/octet-stream");
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "ANNOUNCE") {
-    target.announce_sdp = request.body;
-    this->send_simple_ok_(target, cseq, headers);
+    // A running stream was set up from the previous SDP and key. End it here so that the RECORD which
+    // follows starts a new one with the codec and key announced now.
+    this->stop_stream_(target, true);
+    // The SDP is the only part of a request that outlives the receive buffer.
+    target.announce_sdp.assign(request.body.data(), request.body.size());
+    target.dacp_id.assign(request.dacp_id.data(), request.dacp_id.size());
+    target.active_remote.assign(request.active_remote.data(), request.active_remote.size());
+#ifdef USE_ESP_IDF
+    if (!this->setup_encryption_(target)) {
+      this->begin_response_(400, cseq);
+      this->send_response_(target);
+      return;
+    }
+#endif
+    this->begin_response_(200, cseq);
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "SETUP") {
     if (target.session_id.empty()) {
-      target.session_id = str_snprintf("%08X", random_uint32());
+      target.session_id = str_sprintf("%08X", random_uint32());
+    }
+    this->begin_response_(200, cseq);
+    response.header("Session", target.session_id);
+#ifdef USE_ESP_IDF
+    // Most senders prefer UDP, which avoids head-of-line blocking behind a stalled TCP segment.
+    if (target.audio && !icontains(request.transport, "TCP") && this->setup_udp_transport_(target, request.transport)) {
+      char transport[96];
+      snprintf(transport, sizeof(transport),
+               "RTP/AVP/UDP;unicast;mode=record;server_port=%u;control_port=%u;timing_port=%u", target.audio_port,
+               target.control_port, target.timing_port);
+      response.header("Transport", transport);
+      this->send_response_(target);
+      return;
     }
-    headers["Session"] = target.session_id;
-    headers["Transport"] = "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record";
-    this->send_simple_ok_(target, cseq, headers);
+    target.udp = false;
+#endif
+    response.header("Transport", "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record");
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "RECORD") {
-    headers["Session"] = target.session_id;
-    headers["RTP-Info"] = "seq=0;rtptime=0";
-    headers["Audio-Latency"] = "2205";
-    this->start_stream_(target);
-    this->send_simple_ok_(target, cseq, headers);
+    // After a FLUSH the stream is still running, and its RECORD only resumes it.
+    if (!target.streaming) {
+      this->start_stream_(target);
+    }
+    this->begin_response_(200, cseq);
+    response.header("Session", target.session_id);
+    response.header("RTP-Info", "seq=0;rtptime=0");
+    response.header("Audio-Latency", AUDIO_LATENCY_FRAMES);
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "FLUSH") {
-    headers["Session"] = target.session_id;
-    this->stop_stream_(target);
-    this->send_simple_ok_(target, cseq, headers);
+    this->flush_stream_(target, request.rtp_info);
+    this->begin_response_(200, cseq);
+    response.header("Session", target.session_id);
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "SET_PARAMETER") {
-    headers["Session"] = target.session_id;
-    auto ct_it = request.headers.find("content-type");
-    const std::string content_type = ct_it != request.headers.end() ? to_lower_(ct_it->second) : "";
-    if (content_type.find("text/parameters") != std::string::npos) {
-      std::istringstream body_stream(request.body);
-      std::string parameter;
-      while (std::getline(body_stream, parameter)) {
-        parameter = trim_(parameter);
-        if (parameter.rfind("volume:", 0) == 0) {
-          const float airplay_db = static_cast<float>(atof(parameter.substr(7).c_str()));
+    if (icontains(request.content_type, "text/parameters")) {
+      std::string_view body = request.body;
+      while (!body.empty()) {
+        const std::string_view parameter = trim_view(next_line(body));
+        if (parameter.substr(0, 7) == "volume:") {
+          char number[16];
+          const std::string_view value = trim_view(parameter.substr(7));
+          const size_t len = std::min(value.size(), sizeof(number) - 1);
+          memcpy(number, value.data(), len);
+          number[len] = '\0';
+          const float airplay_db = strtof(number, nullptr);
           const float volume = db_to_volume_(airplay_db);
           this->apply_volume_(target, volume);
         }
       }
     }
-    this->send_simple_ok_(target, cseq, headers);
+    this->begin_response_(200, cseq);
+    response.header("Session", target.session_id);
+    this->send_response_(target);
     return;
   }
 
   if (request.method == "GET_PARAMETER") {
-    headers["Content-Type"] = "text/parameters";
-    headers["Session"] = target.session_id;
     const float db = target.last_volume <= 0.0001f ? -144.0f : 20.0f * log10f(target.last_volume);
-    const std::string body = str_snprintf("volume: %.2f\r\n", db);
-    this->send_response_(target, 200, cseq, headers, body);
+    char body[32];
+    const int body_len = snprintf(body, sizeof(body), "volume: %.2f\r\n", db);
+    this->begin_response_(200, cseq);
+    response.header("Content-Type", "text/parameters");
+    response.header("Session", target.session_id);
+    this->send_response_(target, std::string_view(body, static_cast<size_t>(body_len)));
     return;
   }
 
   if (request.method == "TEARDOWN") {
-    headers["Session"] = target.session_id;
     this->stop_stream_(target);
-    this->send_simple_ok_(target, cseq, headers);
-#ifdef USE_ARDUINO
-    target.client.stop();
-#endif
-#ifdef USE_ESP_IDF
-    if (target.client_fd >= 0) {
-      close(target.client_fd);
-      target.client_fd = -1;
-    }
-#endif
+    this->begin_response_(200, cseq);
+    response.header("Session", target.session_id);
+    this->send_response_(target);
+    this->close_client_(target);
     return;
   }
 
-  this->send_response_(target, 501, cseq, headers);
+  this->begin_response_(501, cseq);
+  this->send_response_(target);
 }
 
-void AirPlayBridge::send_response_(TargetRuntime &target, int status_code, const std::string &cseq,
-                                   const std::map<std::string, std::string> &headers, const std::string &body) {
-  std::string response = "RTSP/1.0 " + std::to_string(status_code) + " " + status_message_(status_code) + "\r\n";
-  response += "CSeq: " + cseq + "\r\n";
-  for (const auto &kv : headers) {
-    response += kv.first + ": " + kv.second + "\r\n";
-  }
-  if (!body.empty()) {
-    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
-  }
-  response += "\r\n";
-  response += body;
+void AirPlayBridge::begin_response_(int status_code, std::string_view cseq) {
+  this->response_.begin(status_code, cseq);
+  this->response_.header("Server", "ESPHome AirPlay Bridge");
+  this->response_.header("Audio-Jack-Status", "connected; type=analog");
+}
 
-#ifdef USE_ARDUINO
-  target.client.print(response.c_str());
-#endif
-#ifdef USE_ESP_IDF
-  if (target.client_fd >= 0) {
-    int flags = fcntl(target.client_fd, F_GETFL, 0);
-    if (flags >= 0) {
-      fcntl(target.client_fd, F_SETFL, flags & ~O_NONBLOCK);
-    }
-    size_t sent = 0;
-    while (sent < response.size()) {
-      const ssize_t n = send(target.client_fd, response.data() + sent, response.size() - sent, 0);
-      if (n > 0) {
-        sent += static_cast<size_t>(n);
-      } else {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-          ESP_LOGW(TAG, "Send failed (errno=%d)", errno);
-        }
-        break;
-      }
-    }
-    if (flags >= 0) {
-      fcntl(target.client_fd, F_SETFL, flags);
-    }
+void AirPlayBridge::begin_options_response_(std::string_view cseq, const std::string &apple_response) {
+  this->response_.begin(200, cseq);
+  if (!apple_response.empty()) {
+    this->response_.header("Apple-Response", apple_response);
   }
-#endif
+  this->response_.header(
+      "Public", "ANNOUNCE, SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER, POST, GET");
+  this->response_.header("Server", "AirTunes/366.0");
+  this->response_.header("Audio-Jack-Status", "connected; type=analog");
+}
+
+void AirPlayBridge::send_response_(TargetRuntime &target, std::string_view body) {
+  this->response_.finish(body);
+  this->send_raw_(target, this->response_.data(), this->response_.size());
 }
 
-void AirPlayBridge::send_raw_(TargetRuntime &target, const std::string &data) {
+void AirPlayBridge::send_raw_(TargetRuntime &target, const char *data, size_t len) {
 #ifdef USE_ARDUINO
-  target.client.print(data.c_str());
+  target.client.write(reinterpret_cast<const uint8_t *>(data), len);
 #endif
 #ifdef USE_ESP_IDF
-  if (target.client_fd >= 0) {
-    int flags = fcntl(target.client_fd, F_GETFL, 0);
-    if (flags >= 0) {
-      fcntl(target.client_fd, F_SETFL, flags & ~O_NONBLOCK);
-    }
-    size_t sent = 0;
-    while (sent < data.size()) {
-      const ssize_t n = send(target.client_fd, data.data() + sent, data.size() - sent, 0);
-      if (n > 0) {
-        sent += static_cast<size_t>(n);
-      } else {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-          ESP_LOGW(TAG, "Send failed (errno=%d)", errno);
-        }
-        break;
-      }
-    }
-    if (flags >= 0) {
-      fcntl(target.client_fd, F_SETFL, flags);
-    }
+  if (target.client_fd < 0) {
+    return;
+  }
+  if (!send_queued(target.client_fd, target.tx, data, len)) {
+    ESP_LOGW(TAG, "Send failed or queue full for target '%s' (%u bytes queued), dropping client",
+             target.spec.name.c_str(), static_cast<unsigned>(target.tx.size()));
+    this->close_client_(target);
   }
 #endif
 }
 
-void AirPlayBridge::send_simple_ok_(TargetRuntime &target, const std::string &cseq,
-                                    const std::map<std::string, std::string> &headers) {
-  this->send_response_(target, 200, cseq, headers);
-}
-
 void AirPlayBridge::start_stream_(TargetRuntime &target) {
   target.streaming = true;
 
 #ifdef USE_ESP_IDF
-  if (target.spec.speaker) {
-    target.pcm_buffer.clear();
-    target.resample_phase = 0;
-    if (target.alac_decoder) {
-#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
-      esp_audio_dec_reset(static_cast<esp_audio_dec_handle_t>(target.alac_decoder));
-#endif
+  if (target.audio) {
+    const int leader = this->find_group_leader_(target);
+    if (leader >= 0) {
+      target.follow_leader = leader;
+      const uint8_t index = static_cast<uint8_t>(leader);
+      this->queue_audio_record_(target, AUDIO_RECORD_FOLLOW, &index, 1);
+      ESP_LOGI(TAG, "Target '%s' plays the audio decoded for '%s'", target.spec.name.c_str(),
+               this->runtimes_[leader].spec.name.c_str());
     } else {
-      this->parse_alac_config_from_sdp_(target);
+      this->queue_start_record_(target);
     }
-    target.spec.speaker->start();
   }
 #endif
 
@@ -586,42 +930,197 @@ void AirPlayBridge::start_stream_(TargetRuntime &target) {
   }
 }
 
-void AirPlayBridge::stop_stream_(TargetRuntime &target) {
+void AirPlayBridge::stop_stream_(TargetRuntime &target, bool handover) {
   if (!target.streaming) {
     return;
   }
   target.streaming = false;
 
 #ifdef USE_ESP_IDF
-  if (target.spec.speaker) {
-    this->resample_and_play_(target);
-    target.spec.speaker->finish();
+  if (target.audio) {
+    this->queue_audio_record_(target, handover ? AUDIO_RECORD_HANDOVER : AUDIO_RECORD_STOP, nullptr, 0);
+    target.follow_leader = -1;
+    // Members playing this target's audio go back to decoding their own stream. START takes a following
+    // pipeline over without stopping its speaker.
+    const int index = static_cast<int>(&target - this->runtimes_.data());
+    for (auto &member : this->runtimes_) {
+      if (member.follow_leader == index) {
+        member.follow_leader = -1;
+        this->queue_start_record_(member);
+      }
+    }
   }
 #endif
 
-  if (!target.spec.speaker) {
+  // On a handover the next RECORD starts the media player again, on the same stream URL.
+  if (!target.spec.speaker && !handover) {
     auto call = target.spec.player->make_call();
     call.set_command(media_player::MEDIA_PLAYER_COMMAND_STOP);
     call.perform();
   }
 }
 
+void AirPlayBridge::flush_stream_(TargetRuntime &target, std::string_view rtp_info) {
+#ifdef USE_ESP_IDF
+  if (target.audio) {
+    if (!target.streaming) {
+      return;
+    }
+    uint32_t rtptime;
+    if (parse_uint(find_parameter(rtp_info, "rtptime"), rtptime)) {
+      uint8_t record[sizeof(rtptime)];
+      memcpy(record, &rtptime, sizeof(rtptime));
+      this->queue_audio_record_(target, AUDIO_RECORD_FLUSH, record, sizeof(record));
+    } else {
+      this->queue_audio_record_(target, AUDIO_RECORD_FLUSH, nullptr, 0);
+    }
+    return;
+  }
+#endif
+  // Without local decoding there is nothing to flush here; the media player is stopped as before.
+  this->stop_stream_(target);
+}
+
+bool AirPlayBridge::software_gain_(const TargetRuntime &target) const {
+#ifdef USE_ESP_IDF
+  return this->software_volume_ && target.audio && target.spec.speaker;
+#else
+  return false;
+#endif
+}
+
 void AirPlayBridge::apply_volume_(TargetRuntime &target, float volume) {
   target.last_volume = clamp(volume, 0.0f, 1.0f);
-  if (target.spec.speaker) {
+#ifdef USE_ESP_IDF
+  if (this->software_gain_(target)) {
+    // Picked up by the audio task on its next block and ramped in there.
+    target.audio->target_gain.store(static_cast<int32_t>(target.last_volume * 32767.0f + 0.5f));
+  }
+#endif
+  if (target.spec.speaker && !this->software_gain_(target)) {
     target.spec.speaker->set_volume(target.last_volume);
   }
-  auto call = target.spec.player->make_call();
-  call.set_volume(target.last_volume);
-  call.perform();
-}
 
-std::string AirPlayBridge::render_media_url_(const TargetRuntime &target) const {
-  if (this->media_url_template_.empty()) {
-    return "";
+  // Senders send a burst of volume changes while the slider is dragged. Publish the first one straight
+  // away, then at most one per interval, always ending on the latest value.
+  if (target.volume_publish_pending) {
+    return;
+  }
+  const uint32_t elapsed = millis() - target.last_volume_publish_ms;
+  if (elapsed >= this->volume_publish_interval_) {
+    this->publish_volume_(target);
+    return;
+  }
+  target.volume_publish_pending = true;
+  // runtimes_ is never resized after setup, so the reference stays valid.
+  this->set_timeout("volume:" + target.spec.name, this->volume_publish_interval_ - elapsed, [this, &target]() {
+    target.volume_publish_pending = false;
+    this->publish_volume_(target);
+  });
+}
+
+void AirPlayBridge::publish_volume_(TargetRuntime &target) {
+  target.last_volume_publish_ms = millis();
+  if (this->software_gain_(target)) {
+    // The gain is already in the samples. A volume call would have the media player pass it on to the same
+    // speaker and attenuate a second time, so only the state it reports is updated.
+    target.spec.player->volume = target.last_volume;
+    target.spec.player->publish_state();
+    return;
+  }
+  auto call = target.spec.player->make_call();
+  call.set_volume(target.last_volume);
+  call.perform();
+}
+
+void AirPlayBridge::log_stats_() {
+#ifdef USE_ESP_IDF
+  ESP_LOGD(TAG, "Sockets: %u watched, %u of %u loops had one ready", static_cast<unsigned>(this->sockets_.size()),
+           static_cast<unsigned>(this->sockets_.ready_polls()), static_cast<unsigned>(this->sockets_.polls()));
+#endif
+  for (const auto &target : this->runtimes_) {
+    ESP_LOGD(TAG, "Target '%s': rx compaction %llu bytes", target.spec.name.c_str(),
+             static_cast<unsigned long long>(target.rx.bytes_moved()));
+#ifdef USE_ESP_IDF
+    ESP_LOGD(TAG, "  Connections: %u pending, %u takeovers", static_cast<unsigned>(target.pending.size()),
+             static_cast<unsigned>(target.takeovers));
+    if (target.audio) {
+      const AudioQueue &queue = target.audio->queue;
+      ESP_LOGD(TAG, "  Audio queue: depth %u, high water %u (%u byte ring), dropped %u",
+               static_cast<unsigned>(queue.depth()), static_cast<unsigned>(queue.high_water()),
+               static_cast<unsigned>(queue.capacity()), static_cast<unsigned>(target.audio->dropped_packets));
+      // Counters are owned by the audio task and only read here for logging.
+      const JitterBuffer::Stats &jitter = target.audio->jitter.stats();
+      ESP_LOGD(TAG,
+               "  Jitter buffer: %u received, %u reordered, %u duplicate, %u late, %u lost, %u resyncs, %u flushed",
+               static_cast<unsigned>(jitter.received), static_cast<unsigned>(jitter.reordered),
+               static_cast<unsigned>(jitter.duplicates), static_cast<unsigned>(jitter.late),
+               static_cast<unsigned>(jitter.lost), static_cast<unsigned>(jitter.resyncs),
+               static_cast<unsigned>(jitter.flushed));
+      ESP_LOGD(TAG, "  Loss recovery: %u gaps, %u resends requested, %u satisfied, %u packets concealed",
+               static_cast<unsigned>(jitter.gaps), static_cast<unsigned>(jitter.resend_requested),
+               static_cast<unsigned>(jitter.resend_satisfied), static_cast<unsigned>(target.audio->concealed_packets));
+      const char *trim_source = target.audio->jitter.timeline_pinned() ? "sender clock" : "buffer level";
+      if (target.follow_leader >= 0) {
+        trim_source = "backlog behind the group leader";
+      }
+      ESP_LOGD(TAG, "  Rate trim: %.1f ppm (%s)", target.audio->rate_trim_ppm, trim_source);
+      ESP_LOGD(TAG, "  Audio buffers: %u bytes for packets of up to %u frames",
+               static_cast<unsigned>(target.audio->buffer_bytes), static_cast<unsigned>(target.audio->frame_capacity));
+#ifdef CONFIG_HEAP_USE_HOOKS
+      ESP_LOGD(TAG, "  Heap allocations by the audio task while streaming: %u",
+               static_cast<unsigned>(target.audio->steady_allocations));
+#else
+      ESP_LOGD(TAG, "  Heap allocations by the audio task while streaming: not counted (needs CONFIG_HEAP_USE_HOOKS)");
+#endif
+      ESP_LOGD(TAG, "  Decoder: %s, %u opened, %u reused", target.audio->decoder != nullptr ? "open" : "closed",
+               static_cast<unsigned>(target.audio->decoder_opens), static_cast<unsigned>(target.audio->decoder_reuses));
+      ESP_LOGD(TAG, "  Speaker output: %u underruns, %u overruns, %u bytes dropped, receive stalled %u times",
+               static_cast<unsigned>(target.audio->underruns), static_cast<unsigned>(target.audio->overruns),
+               static_cast<unsigned>(target.audio->dropped_bytes), static_cast<unsigned>(target.rx_stalls));
+      if (!target.spec.speaker) {
+        uint32_t listeners;
+        uint64_t sent;
+        uint64_t skipped;
+        this->http_server_.stream_stats(target.spec.name, listeners, sent, skipped);
+        ESP_LOGD(TAG, "  HTTP stream: %u listeners, %llu bytes sent, %llu bytes skipped by slow listeners",
+                 static_cast<unsigned>(listeners), static_cast<unsigned long long>(sent),
+                 static_cast<unsigned long long>(skipped));
+      }
+      if (!target.spec.group.empty()) {
+        const TargetRuntime &source = target.follow_leader >= 0 ? this->runtimes_[target.follow_leader] : target;
+        ESP_LOGD(TAG, "  Group '%s': audio decoded for '%s', %u packets of its own not decoded, %u bytes dropped "
+                 "behind the leader",
+                 target.spec.group.c_str(), source.spec.name.c_str(), static_cast<unsigned>(target.shared_packets),
+                 static_cast<unsigned>(target.audio->follower_dropped_bytes));
+      }
+      const uint32_t decrypted = target.audio->decrypted_packets;
+      if (decrypted > 0) {
+        ESP_LOGD(TAG, "  Decryption: %u packets, %u us average, %u us max", static_cast<unsigned>(decrypted),
+                 static_cast<unsigned>(target.audio->decrypt_us_total / decrypted),
+                 static_cast<unsigned>(target.audio->decrypt_us_max));
+      }
+    }
+    if (target.udp && target.clock.synchronized()) {
+      ESP_LOGD(TAG, "  Sender clock: offset %lld us, drift %.1f ppm, delay %lld us",
+               static_cast<long long>(target.clock.offset_us()), target.clock.drift_ppm(),
+               static_cast<long long>(target.clock.delay_us()));
+    }
+#endif
   }
+}
 
+std::string AirPlayBridge::render_media_url_(const TargetRuntime &target) const {
   std::string out = this->media_url_template_;
+#ifdef USE_ESP_IDF
+  if (out.empty() && this->http_server_.started()) {
+    out = "http://{ip}:" + std::to_string(this->http_port_) + "/airplay/{target}/{session}";
+  }
+#endif
+  if (out.empty()) {
+    return "";
+  }
+
   std::string ip;
   auto ip_addresses = network::get_ip_addresses();
   for (const auto &candidate : ip_addresses) {
@@ -647,24 +1146,17 @@ std::string AirPlayBridge::render_media_url_(const TargetRuntime &target) const
 
   replace_all(out, "{ip}", ip);
   replace_all(out, "{port}", std::to_string(target.spec.port));
-  replace_all(out, "{target}", target.spec.name);
-  replace_all(out, "{session}", target.session_id);
-  return out;
-}
-
-std::string AirPlayBridge::trim_(const std::string &value) {
-  const char *whitespace = " \r\n\t";
-  const size_t start = value.find_first_not_of(whitespace);
-  if (start == std::string::npos) {
-    return "";
+  // Target names are free text, so they are escaped to keep the URL valid.
+  std::string escaped_name;
+  for (char c : target.spec.name) {
+    if (isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.' || c == '~') {
+      escaped_name.push_back(c);
+    } else {
+      escaped_name += str_snprintf("%%%02X", 3, static_cast<unsigned char>(c));
+    }
   }
-  const size_t end = value.find_last_not_of(whitespace);
-  return value.substr(start, end - start + 1);
-}
-
-std::string AirPlayBridge::to_lower_(const std::string &value) {
-  std::string out = value;
-  std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  replace_all(out, "{target}", escaped_name);
+  replace_all(out, "{session}", target.session_id);
   return out;
 }
 
@@ -675,152 +1167,1325 @@ float AirPlayBridge::db_to_volume_(float db) {
   return clamp(powf(10.0f, db / 20.0f), 0.0f, 1.0f);
 }
 
-std::string AirPlayBridge::status_message_(int status_code) {
-  switch (status_code) {
-    case 200:
-      return "OK";
-    case 400:
-      return "Bad Request";
-    case 454:
-      return "Session Not Found";
-    case 500:
-      return "Internal Server Error";
-    case 501:
-      return "Not Implemented";
-    default:
-      return "OK";
+#ifdef USE_ESP_IDF
+bool AirPlayBridge::queue_audio_record_(TargetRuntime &target, AudioRecordType type, const uint8_t *data,
+                                        size_t len) {
+  AudioPipeline &audio = *target.audio;
+  if (type == AUDIO_RECORD_RTP && target.follow_leader >= 0) {
+    // The group leader's copy of the stream is decoded instead.
+    target.shared_packets++;
+    return true;
+  }
+  // Audio leaves headroom in the ring so that start/stop records are never refused behind a backlog.
+  const size_t keep_free = type == AUDIO_RECORD_RTP ? AUDIO_CONTROL_HEADROOM : 0;
+  if (!audio.queue.push(type, data, len, keep_free)) {
+    if (type == AUDIO_RECORD_RTP) {
+      audio.dropped_packets++;
+    } else {
+      ESP_LOGW(TAG, "Audio queue full, control record %u lost for target '%s'", type, target.spec.name.c_str());
+    }
+    return false;
   }
+  if (this->audio_task_handle_ != nullptr) {
+    xTaskNotifyGive(this->audio_task_handle_);
+  }
+  return true;
 }
 
-#ifdef USE_ESP_IDF
-void AirPlayBridge::process_rtp_audio_(TargetRuntime &target, const uint8_t *data, size_t len) {
-#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
-  if (!target.alac_decoder || len < 16) {
-    return;
-  }
-  const size_t rtp_header_len = 12;
-  const size_t au_header_len = 4;
-  if (len < rtp_header_len + au_header_len) {
-    return;
+void AirPlayBridge::queue_start_record_(TargetRuntime &target) {
+  // START record: codec, encryption flag, the key and IV when encrypted, then the codec config.
+  std::string record(1, static_cast<char>(codec_from_sdp_(target.announce_sdp)));
+  record.push_back(static_cast<char>(target.encrypted ? 1 : 0));
+  if (target.encrypted) {
+    record.append(reinterpret_cast<const char *>(target.aes_key), sizeof(target.aes_key));
+    record.append(reinterpret_cast<const char *>(target.aes_iv), sizeof(target.aes_iv));
+  }
+  if (record[0] == CODEC_ALAC) {
+    std::string config;
+    parse_alac_config_from_sdp_(target.announce_sdp, config);
+    record += config;
+  }
+  this->queue_audio_record_(target, AUDIO_RECORD_START, reinterpret_cast<const uint8_t *>(record.data()),
+                            record.size());
+}
+
+int AirPlayBridge::find_group_leader_(const TargetRuntime &target) const {
+  if (target.spec.group.empty() || target.dacp_id.empty()) {
+    return -1;
   }
-  const uint8_t *payload = data + rtp_header_len;
-  const uint16_t au_count = (static_cast<uint16_t>(payload[0]) << 8) | payload[1];
-  const uint16_t au_size = (static_cast<uint16_t>(payload[2]) << 8) | payload[3];
-  const uint8_t *alac_frame = payload + au_header_len;
-  const size_t alac_len = len - rtp_header_len - au_header_len;
-  if (alac_len == 0) {
-    return;
+  const uint8_t codec = codec_from_sdp_(target.announce_sdp);
+  for (size_t i = 0; i < this->runtimes_.size(); i++) {
+    const TargetRuntime &other = this->runtimes_[i];
+    // Only a member that decodes for itself can lead; members never follow another follower.
+    if (&other == &target || other.spec.group != target.spec.group || !other.streaming || !other.audio ||
+        other.follow_leader >= 0) {
+      continue;
+    }
+    // A multi-room session announces the same DACP-ID and Active-Remote to every room. The sender's address
+    // alone is not enough: one host can run several unrelated senders, each playing something else.
+    if (other.dacp_id == target.dacp_id && other.active_remote == target.active_remote &&
+        codec_from_sdp_(other.announce_sdp) == codec) {
+      return static_cast<int>(i);
+    }
   }
+  return -1;
+}
 
-  esp_audio_dec_in_raw_t raw_in = {.buffer = const_cast<uint8_t *>(alac_frame),
-                                  .len = static_cast<uint32_t>(alac_len),
-                                  .consumed = 0,
-                                  .frame_recover = ESP_AUDIO_DEC_RECOVERY_NONE};
-  uint8_t pcm_out[8192];
-  esp_audio_dec_out_frame_t frame_out = {.buffer = pcm_out, .len = sizeof(pcm_out), .needed_size = 0, .decoded_size = 0};
-
-  esp_audio_err_t err = esp_audio_dec_process(static_cast<esp_audio_dec_handle_t>(target.alac_decoder), &raw_in, &frame_out);
-  if (err == ESP_AUDIO_ERR_OK && frame_out.decoded_size > 0) {
-    target.pcm_buffer.insert(target.pcm_buffer.end(), pcm_out, pcm_out + frame_out.decoded_size);
-    if (target.pcm_buffer.size() >= 4096) {
-      this->resample_and_play_(target);
+uint8_t AirPlayBridge::codec_from_sdp_(const std::string &sdp) {
+  // The rtpmap line names the format: "AppleLossless", "L16/44100/2" or "mpeg4-generic/44100/2".
+  std::string_view text = sdp;
+  std::string_view encoding;
+  bool eld = false;
+  while (!text.empty()) {
+    const std::string_view line = next_line(text);
+    if (line.substr(0, 9) == "a=rtpmap:") {
+      const size_t space = line.find(' ');
+      if (space != std::string_view::npos) {
+        encoding = trim_view(line.substr(space + 1));
+      }
+    } else if (line.substr(0, 7) == "a=fmtp:" && icontains(line, "mode=AAC-eld")) {
+      eld = true;
     }
   }
-#else
-  (void) target;
-  (void) data;
-  (void) len;
-#endif
+  if (encoding.empty() || iequals(encoding.substr(0, 13), "AppleLossless")) {
+    // ALAC is what RAOP assumes when the SDP does not say.
+    return CODEC_ALAC;
+  }
+  // Only the AirPlay format itself is taken as PCM; anything else would need converting first.
+  if (iequals(encoding, "L16/44100/2")) {
+    return CODEC_PCM;
+  }
+  // esp_audio_codec decodes AAC-LC, but not the low-delay AAC-ELD profile.
+  if (iequals(encoding.substr(0, 13), "mpeg4-generic") && !eld) {
+    return CODEC_AAC;
+  }
+  return CODEC_NONE;
 }
 
-bool AirPlayBridge::parse_alac_config_from_sdp_(TargetRuntime &target) {
-#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
-  if (target.announce_sdp.empty()) {
+bool AirPlayBridge::parse_alac_config_from_sdp_(const std::string &sdp, std::string &config) {
+  config.clear();
+  if (sdp.empty()) {
     return false;
   }
-  size_t pos = target.announce_sdp.find("a=fmtp:96");
+  size_t pos = sdp.find("a=fmtp:96");
   if (pos == std::string::npos) {
     return false;
   }
-  pos = target.announce_sdp.find("config=", pos);
-  if (pos == std::string::npos) {
-    return false;
+  const size_t line_end = sdp.find_first_of("\r\n", pos);
+  const size_t config_pos = sdp.find("config=", pos);
+  if (config_pos == std::string::npos || config_pos > line_end) {
+    // The usual RAOP form lists the ALACSpecificConfig fields in order: frameLength, compatibleVersion,
+    // bitDepth, pb, mb, kb, numChannels, maxRun, maxFrameBytes, avgBitRate, sampleRate.
+    static const uint8_t FIELD_SIZES[11] = {4, 1, 1, 1, 1, 1, 1, 2, 4, 4, 4};
+    const char *cursor = sdp.c_str() + pos + 9;
+    for (uint8_t size : FIELD_SIZES) {
+      char *end = nullptr;
+      const unsigned long value = strtoul(cursor, &end, 10);
+      if (end == cursor) {
+        config.clear();
+        return false;
+      }
+      cursor = end;
+      for (int shift = (size - 1) * 8; shift >= 0; shift -= 8) {
+        config.push_back(static_cast<char>((value >> shift) & 0xFF));
+      }
+    }
+    return true;
   }
-  pos += 7;
-  size_t end = target.announce_sdp.find_first_of(" \r\n", pos);
-  std::string config_hex = end == std::string::npos ? target.announce_sdp.substr(pos) : target.announce_sdp.substr(pos, end - pos);
+  pos = config_pos + 7;
+  size_t end = sdp.find_first_of(" \r\n", pos);
+  std::string config_hex = end == std::string::npos ? sdp.substr(pos) : sdp.substr(pos, end - pos);
   if (config_hex.size() < 24) {
     return false;
   }
-  target.alac_config.clear();
   for (size_t i = 0; i + 2 <= config_hex.size(); i += 2) {
     unsigned int byte;
     if (sscanf(config_hex.substr(i, 2).c_str(), "%02x", &byte) == 1) {
-      target.alac_config.push_back(static_cast<uint8_t>(byte));
+      config.push_back(static_cast<char>(byte));
+    }
+  }
+  return config.size() >= 24;
+}
+
+std::string_view AirPlayBridge::sdp_attribute_(const std::string &sdp, std::string_view name) {
+  std::string_view text = sdp;
+  while (!text.empty()) {
+    const std::string_view line = next_line(text);
+    if (line.size() > name.size() + 3 && line.substr(0, 2) == "a=" && line.substr(2, name.size()) == name &&
+        line[name.size() + 2] == ':') {
+      return trim_view(line.substr(name.size() + 3));
     }
   }
-  if (target.alac_config.size() < 24) {
+  return {};
+}
+
+bool AirPlayBridge::setup_encryption_(TargetRuntime &target) {
+  target.encrypted = false;
+  const std::string_view wrapped_key = sdp_attribute_(target.announce_sdp, "rsaaeskey");
+  if (wrapped_key.empty()) {
+    return true;
+  }
+  if (!this->raop_key_) {
+    ESP_LOGW(TAG, "Target '%s' was offered an encrypted stream but no rsa_private_key is configured",
+             target.spec.name.c_str());
     return false;
   }
+  std::string iv;
+  if (!decode_base64(sdp_attribute_(target.announce_sdp, "aesiv"), iv) || iv.size() != sizeof(target.aes_iv) ||
+      !this->raop_key_->unwrap_aes_key(wrapped_key, target.aes_key)) {
+    ESP_LOGW(TAG, "Could not unwrap the session key for target '%s'", target.spec.name.c_str());
+    return false;
+  }
+  memcpy(target.aes_iv, iv.data(), sizeof(target.aes_iv));
+  target.encrypted = true;
+  ESP_LOGD(TAG, "Stream for target '%s' is AES encrypted", target.spec.name.c_str());
+  return true;
+}
 
-  esp_audio_dec_cfg_t cfg = {.type = ESP_AUDIO_TYPE_ALAC,
-                            .cfg = target.alac_config.data(),
-                            .cfg_sz = static_cast<uint32_t>(target.alac_config.size())};
-  esp_audio_dec_handle_t dec = nullptr;
-  if (esp_audio_dec_open(&cfg, &dec) != ESP_AUDIO_ERR_OK) {
-    ESP_LOGW(TAG, "Failed to open ALAC decoder");
+std::string AirPlayBridge::respond_to_challenge_(int fd, std::string_view challenge) {
+  // The response covers the address the sender connected to, so it is taken from the socket itself.
+  sockaddr_in local{};
+  socklen_t local_len = sizeof(local);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&local), &local_len) != 0 ||
+      local.sin_family != AF_INET) {
+    return "";
+  }
+  uint8_t ip[4];
+  memcpy(ip, &local.sin_addr.s_addr, sizeof(ip));
+  return this->raop_key_->respond_to_challenge(challenge, ip, this->device_mac_);
+}
+
+bool AirPlayBridge::setup_udp_transport_(TargetRuntime &target, std::string_view transport) {
+  uint32_t control_port = 0;
+  uint32_t timing_port = 0;
+  parse_uint(find_parameter(transport, "control_port"), control_port);
+  parse_uint(find_parameter(transport, "timing_port"), timing_port);
+
+  // The sockets stay open for the lifetime of the target; only the first UDP session creates them.
+  if (target.audio_fd < 0) {
+    target.audio_fd = open_udp_socket_(target.audio_port);
+    target.control_fd = open_udp_socket_(target.control_port);
+    target.timing_fd = open_udp_socket_(target.timing_port);
+    if (target.audio_fd < 0 || target.control_fd < 0 || target.timing_fd < 0) {
+      ESP_LOGW(TAG, "UDP transport unavailable for target '%s', falling back to TCP", target.spec.name.c_str());
+      for (int *fd : {&target.audio_fd, &target.control_fd, &target.timing_fd}) {
+        if (*fd >= 0) {
+          close(*fd);
+          *fd = -1;
+        }
+      }
+      return false;
+    }
+    for (int fd : {target.audio_fd, target.control_fd, target.timing_fd}) {
+      this->sockets_.add(fd);
+    }
+  }
+
+  // Discard anything left over from a previous session.
+  uint8_t scratch[64];
+  for (int fd : {target.audio_fd, target.control_fd, target.timing_fd}) {
+    while (recv(fd, scratch, sizeof(scratch), 0) > 0) {
+    }
+  }
+
+  target.peer_control_port = static_cast<uint16_t>(control_port);
+  target.peer_timing_port = static_cast<uint16_t>(timing_port);
+  target.clock.reset();
+  target.timing_requests_sent = 0;
+  target.udp = true;
+  ESP_LOGD(TAG, "UDP transport for target '%s': audio %u, control %u, timing %u", target.spec.name.c_str(),
+           target.audio_port, target.control_port, target.timing_port);
+  return true;
+}
+
+bool AirPlayBridge::flush_tx_(TargetRuntime &target) {
+  if (flush_queued(target.client_fd, target.tx)) {
+    return true;
+  }
+  ESP_LOGW(TAG, "Send failed for target '%s' (errno=%d)", target.spec.name.c_str(), errno);
+  this->close_client_(target);
+  return false;
+}
+
+void AirPlayBridge::accept_clients_(TargetRuntime &target) {
+  while (true) {
+    sockaddr_in client_addr{};
+    socklen_t addr_len = sizeof(client_addr);
+    const int accepted = accept(target.server_fd, reinterpret_cast<sockaddr *>(&client_addr), &addr_len);
+    if (accepted < 0) {
+      return;
+    }
+    int on = 1;
+    setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int flags = fcntl(accepted, F_GETFL, 0);
+    if (flags >= 0) {
+      fcntl(accepted, F_SETFL, flags | O_NONBLOCK);
+    }
+    this->sockets_.add(accepted);
+    if (target.client_fd < 0) {
+      target.client_fd = accepted;
+      target.peer_addr = client_addr;
+      target.tx.clear();
+      target.rx.clear();
+      target.rx_blocked = false;
+      target.rtsp.reset();
+      target.streaming = false;
+      ESP_LOGI(TAG, "Client connected to target '%s' on port %u", target.spec.name.c_str(), target.spec.port);
+      continue;
+    }
+    if (target.pending.size() >= MAX_PENDING_CONNECTIONS) {
+      // The newest connection is the one a sender is waiting on, so the oldest makes room for it.
+      this->sockets_.remove(target.pending.front().fd);
+      close(target.pending.front().fd);
+      target.pending.erase(target.pending.begin());
+    }
+    PendingConnection conn;
+    conn.fd = accepted;
+    conn.peer_addr = client_addr;
+    conn.last_activity_ms = millis();
+    conn.rx.allocate(PENDING_RX_SIZE);
+    conn.rtsp.set_max_message_size(PENDING_RX_SIZE);
+    conn.tx.allocate(PENDING_TX_SIZE);
+    target.pending.push_back(std::move(conn));
+    ESP_LOGD(TAG, "Another connection to target '%s' (%u pending)", target.spec.name.c_str(),
+             static_cast<unsigned>(target.pending.size()));
+  }
+}
+
+void AirPlayBridge::handle_pending_(TargetRuntime &target) {
+  for (size_t i = 0; i < target.pending.size();) {
+    PendingConnection &conn = target.pending[i];
+    bool keep = flush_queued(conn.fd, conn.tx);
+    while (keep && this->sockets_.ready(conn.fd)) {
+      // A request that does not fit is not one this connection needs to send before taking over.
+      if (conn.rx.reserve(RX_MIN_READ) == 0) {
+        keep = false;
+        break;
+      }
+      const ssize_t len = recv(conn.fd, conn.rx.write_ptr(), conn.rx.writable(), 0);
+      if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (len <= 0) {
+        keep = false;
+        break;
+      }
+      conn.rx.commit(static_cast<size_t>(len));
+      conn.last_activity_ms = millis();
+    }
+    while (keep && !conn.rx.empty()) {
+      RtspRequest request;
+      size_t consumed = 0;
+      const RtspParseResult result = conn.rtsp.parse(conn.rx.data(), conn.rx.size(), request, consumed);
+      if (result == RtspParseResult::INCOMPLETE) {
+        break;
+      }
+      if (result == RtspParseResult::TOO_LARGE) {
+        keep = false;
+        break;
+      }
+      if (result == RtspParseResult::OK && request.method == "ANNOUNCE") {
+        // Only an ANNOUNCE describes a stream of its own. It stays in the buffer and is handled as the
+        // target's own request once the connection is promoted.
+        this->take_over_(target, i);
+        return;
+      }
+      if (result == RtspParseResult::OK) {
+        keep = this->answer_pending_(target, conn, request);
+      }
+      conn.rx.consume(consumed);
+    }
+    if (keep && millis() - conn.last_activity_ms < PENDING_IDLE_TIMEOUT_MS) {
+      i++;
+      continue;
+    }
+    this->sockets_.remove(conn.fd);
+    close(conn.fd);
+    target.pending.erase(target.pending.begin() + i);
+  }
+}
+
+bool AirPlayBridge::answer_pending_(TargetRuntime &target, PendingConnection &conn, const RtspRequest &request) {
+  ESP_LOGD(TAG, "RTSP %.*s on a pending connection (target: %s)", static_cast<int>(request.method.size()),
+           request.method.data(), target.spec.name.c_str());
+  const std::string_view cseq = request.cseq.empty() ? std::string_view("1") : request.cseq;
+  bool keep = true;
+  if (request.method == "OPTIONS") {
+    std::string apple_response;
+    if (!request.apple_challenge.empty() && this->raop_key_) {
+      apple_response = this->respond_to_challenge_(conn.fd, request.apple_challenge);
+    }
+    this->begin_options_response_(cseq, apple_response);
+  } else if (request.method == "POST" && request.uri.find("/fp-setup") == 0) {
+    this->begin_response_(200, cseq);
+    this->response_.header("Content-Type", "application/octet-stream");
+  } else if (request.method == "TEARDOWN") {
+    this->begin_response_(200, cseq);
+    keep = false;
+  } else if (request.method == "SETUP" || request.method == "RECORD") {
+    // Without an ANNOUNCE first there is no SDP, key or codec of this sender's to set a stream up with.
+    this->begin_response_(455, cseq);
+  } else if (request.method == "FLUSH" || request.method == "PAUSE" || request.method == "SET_PARAMETER" ||
+             request.method == "GET_PARAMETER") {
+    // These act on a session, and this connection has none yet.
+    this->begin_response_(454, cseq);
+  } else {
+    this->begin_response_(501, cseq);
+  }
+  this->response_.finish();
+  return send_queued(conn.fd, conn.tx, this->response_.data(), this->response_.size()) && keep;
+}
+
+void AirPlayBridge::take_over_(TargetRuntime &target, size_t index) {
+  PendingConnection conn = std::move(target.pending[index]);
+  target.pending.erase(target.pending.begin() + index);
+  if (target.client_fd >= 0) {
+    ESP_LOGI(TAG, "Another sender takes over target '%s'", target.spec.name.c_str());
+    this->stop_stream_(target, true);
+    this->close_client_(target);
+    target.takeovers++;
+  }
+  target.client_fd = conn.fd;
+  target.peer_addr = conn.peer_addr;
+  target.session_id.clear();
+  // Nothing of the previous sender's stream may carry over; the ANNOUNCE being promoted sets it all anew.
+  target.announce_sdp.clear();
+  target.dacp_id.clear();
+  target.active_remote.clear();
+  target.encrypted = false;
+  memset(target.aes_key, 0, sizeof(target.aes_key));
+  memset(target.aes_iv, 0, sizeof(target.aes_iv));
+  target.rtsp.reset();
+  target.rx_blocked = false;
+  // Both buffers of the target are at least as large as a pending connection's.
+  target.rx.clear();
+  memcpy(target.rx.write_ptr(), conn.rx.data(), conn.rx.size());
+  target.rx.commit(conn.rx.size());
+  target.tx.clear();
+  memcpy(target.tx.write_ptr(), conn.tx.data(), conn.tx.size());
+  target.tx.commit(conn.tx.size());
+  this->process_rx_(target);
+}
+
+int AirPlayBridge::open_udp_socket_(uint16_t &port) {
+  const int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in bind_addr{};
+  bind_addr.sin_family = AF_INET;
+  bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  bind_addr.sin_port = 0;
+  socklen_t addr_len = sizeof(bind_addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&bind_addr), sizeof(bind_addr)) < 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&bind_addr), &addr_len) < 0) {
+    close(fd);
+    return -1;
+  }
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags >= 0) {
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+  port = ntohs(bind_addr.sin_port);
+  return fd;
+}
+
+void AirPlayBridge::read_udp_(TargetRuntime &target) {
+  uint8_t packet[UDP_MAX_PACKET];
+  // Between sessions packets are only drained, so a late sender cannot leave the sockets readable.
+  // Only the current sender's packets count; one that was just taken over may not have noticed yet.
+  const in_addr_t sender = target.peer_addr.sin_addr.s_addr;
+  while (this->sockets_.ready(target.audio_fd)) {
+    sockaddr_in from{};
+    socklen_t from_len = sizeof(from);
+    const ssize_t len =
+        recvfrom(target.audio_fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+    if (len <= 0) {
+      break;
+    }
+    if (target.udp && target.audio && len > 12 && from.sin_addr.s_addr == sender) {
+      this->queue_audio_record_(target, AUDIO_RECORD_RTP, packet, static_cast<size_t>(len));
+    }
+  }
+  while (this->sockets_.ready(target.control_fd)) {
+    sockaddr_in from{};
+    socklen_t from_len = sizeof(from);
+    const ssize_t len =
+        recvfrom(target.control_fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+    if (len <= 0) {
+      break;
+    }
+    if (len < 2 || !target.udp || !target.audio || from.sin_addr.s_addr != sender) {
+      continue;
+    }
+    const uint8_t type = packet[1] & 0x7F;
+    if (type == RTP_TYPE_RESEND_RESPONSE && static_cast<size_t>(len) > RTP_RESEND_HEADER_SIZE + 12) {
+      this->queue_audio_record_(target, AUDIO_RECORD_RTP, packet + RTP_RESEND_HEADER_SIZE,
+                                static_cast<size_t>(len) - RTP_RESEND_HEADER_SIZE);
+    } else if (type == RTP_TYPE_SYNC) {
+      this->handle_sync_packet_(target, packet, static_cast<size_t>(len));
+    }
+  }
+  while (this->sockets_.ready(target.timing_fd)) {
+    sockaddr_in from{};
+    socklen_t from_len = sizeof(from);
+    const ssize_t len =
+        recvfrom(target.timing_fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+    if (len <= 0) {
+      break;
+    }
+    if (target.udp) {
+      this->handle_timing_packet_(target, packet, static_cast<size_t>(len), from);
+    }
+  }
+}
+
+static void write_ntp(uint8_t *out, uint64_t ntp) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = static_cast<uint8_t>(ntp >> (56 - 8 * i));
+  }
+}
+
+static uint32_t read_u32(const uint8_t *in) {
+  return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | in[3];
+}
+
+static uint64_t read_ntp(const uint8_t *in) {
+  uint64_t ntp = 0;
+  for (int i = 0; i < 8; i++) {
+    ntp = (ntp << 8) | in[i];
+  }
+  return ntp;
+}
+
+void AirPlayBridge::send_timing_request_(TargetRuntime &target) {
+  target.last_timing_request_ms = millis();
+  if (target.timing_requests_sent < TIMING_BURST_COUNT) {
+    target.timing_requests_sent++;
+  }
+  // Header, 4 padding bytes, then reference, receive and send times. The sender echoes our send time
+  // back as the origin, so the local clock does not need to be real NTP time.
+  uint8_t packet[TIMING_PACKET_SIZE] = {0x80, 0x80 | RTP_TYPE_TIMING_REQUEST, 0x00, 0x07};
+  write_ntp(packet + 24, ClockSync::us_to_ntp(esp_timer_get_time()));
+  sockaddr_in dest = target.peer_addr;
+  dest.sin_port = htons(target.peer_timing_port);
+  sendto(target.timing_fd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&dest), sizeof(dest));
+}
+
+void AirPlayBridge::handle_timing_packet_(TargetRuntime &target, const uint8_t *packet, size_t len,
+                                          const sockaddr_in &from) {
+  if (len < TIMING_PACKET_SIZE) {
+    return;
+  }
+  const int64_t now_us = esp_timer_get_time();
+  const uint8_t type = packet[1] & 0x7F;
+  if (type == RTP_TYPE_TIMING_RESPONSE) {
+    const int64_t local_send_us = ClockSync::ntp_to_us(read_ntp(packet + 8));
+    const int64_t remote_recv_us = ClockSync::ntp_to_us(read_ntp(packet + 16));
+    const int64_t remote_send_us = ClockSync::ntp_to_us(read_ntp(packet + 24));
+    target.clock.add_exchange(local_send_us, remote_recv_us, remote_send_us, now_us);
+  } else if (type == RTP_TYPE_TIMING_REQUEST) {
+    // Some senders measure us too; answer with our (monotonic) clock.
+    uint8_t reply[TIMING_PACKET_SIZE] = {0x80, 0x80 | RTP_TYPE_TIMING_RESPONSE, 0x00, 0x07};
+    memcpy(reply + 8, packet + 24, 8);
+    const uint64_t now_ntp = ClockSync::us_to_ntp(now_us);
+    write_ntp(reply + 16, now_ntp);
+    write_ntp(reply + 24, now_ntp);
+    sendto(target.timing_fd, reply, sizeof(reply), 0, reinterpret_cast<const sockaddr *>(&from), sizeof(from));
+  }
+}
+
+void AirPlayBridge::handle_sync_packet_(TargetRuntime &target, const uint8_t *packet, size_t len) {
+  if (len < SYNC_PACKET_SIZE || !target.clock.synchronized()) {
+    return;
+  }
+  // The frame with RTP timestamp packet[4..8) is meant to play at the sender's NTP time packet[8..16), while
+  // packet[16..20) is the timestamp the sender is transmitting right now. The difference is the sender's
+  // latency, which the jitter buffer needs to know whether its packets fit.
+  const uint32_t timestamp = read_u32(packet + 4);
+  const uint32_t sending = read_u32(packet + 16);
+  const int32_t latency = static_cast<int32_t>(sending - timestamp);
+  const uint32_t latency_frames =
+      latency > 0 && latency <= MAX_SENDER_LATENCY_FRAMES ? static_cast<uint32_t>(latency) : 0;
+  const int64_t remote_us = ClockSync::ntp_to_us(read_ntp(packet + 8));
+  const int64_t local_us = target.clock.remote_to_local(remote_us);
+  const float drift_ppm = target.clock.drift_ppm();
+  uint8_t record[20];
+  memcpy(record, &timestamp, sizeof(timestamp));
+  memcpy(record + 4, &local_us, sizeof(local_us));
+  memcpy(record + 12, &drift_ppm, sizeof(drift_ppm));
+  memcpy(record + 16, &latency_frames, sizeof(latency_frames));
+  this->queue_audio_record_(target, AUDIO_RECORD_TIMELINE, record, sizeof(record));
+}
+
+void AirPlayBridge::service_audio_events_(TargetRuntime &target) {
+  AudioQueue &events = target.audio->events;
+  uint8_t type;
+  const uint8_t *data;
+  size_t len;
+  while (events.front(type, data, len)) {
+    if (type == AUDIO_EVENT_RESEND && len == 4) {
+      const uint16_t first = (static_cast<uint16_t>(data[0]) << 8) | data[1];
+      const uint16_t count = (static_cast<uint16_t>(data[2]) << 8) | data[3];
+      this->send_resend_request_(target, first, count);
+    }
+    events.pop();
+  }
+}
+
+void AirPlayBridge::send_resend_request_(TargetRuntime &target, uint16_t first, uint16_t count) {
+  if (target.client_fd < 0) {
+    return;
+  }
+  target.control_seq++;
+  ESP_LOGV(TAG, "Requesting resend of %u packet(s) from %u for target '%s'", count, first, target.spec.name.c_str());
+  // Interleaved on channel 1: '$', channel, length, then the 8-byte RAOP resend request. Over UDP only the
+  // request itself goes to the sender's control port.
+  const uint8_t packet[12] = {
+      '$',
+      1,
+      0,
+      8,
+      0x80,
+      0x80 | RTP_TYPE_RESEND_REQUEST,
+      static_cast<uint8_t>(target.control_seq >> 8),
+      static_cast<uint8_t>(target.control_seq & 0xFF),
+      static_cast<uint8_t>(first >> 8),
+      static_cast<uint8_t>(first & 0xFF),
+      static_cast<uint8_t>(count >> 8),
+      static_cast<uint8_t>(count & 0xFF),
+  };
+  if (target.udp) {
+    sockaddr_in dest = target.peer_addr;
+    dest.sin_port = htons(target.peer_control_port);
+    sendto(target.control_fd, packet + 4, sizeof(packet) - 4, 0, reinterpret_cast<sockaddr *>(&dest), sizeof(dest));
+    return;
+  }
+  this->send_raw_(target, reinterpret_cast<const char *>(packet), sizeof(packet));
+}
+
+void AirPlayBridge::audio_task_(void *arg) {
+  auto *bridge = static_cast<AirPlayBridge *>(arg);
+  uint32_t wait_ms = AUDIO_TASK_IDLE_MS;
+  while (true) {
+    // The producer notifies after every record. While streaming the task also wakes periodically to
+    // release packets as they come due.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+    wait_ms = bridge->service_audio_();
+  }
+}
+
+uint32_t AirPlayBridge::service_audio_() {
+  uint32_t wait_ms = AUDIO_TASK_IDLE_MS;
+  for (auto &target : this->runtimes_) {
+    if (!target.audio) {
+      continue;
+    }
+    this->drain_audio_queue_(target);
+    if (target.audio->draining) {
+      this->play_out_(target);
+      wait_ms = AUDIO_TASK_TICK_MS;
+    } else if (target.audio->active) {
+      const uint32_t allocations = audio_task_allocations();
+      const int64_t now_us = esp_timer_get_time();
+      this->update_rate_trim_(target, now_us);
+      this->play_due_audio_(target, now_us + AUDIO_TASK_TICK_MS * 1000);
+      target.audio->steady_allocations += audio_task_allocations() - allocations;
+      wait_ms = AUDIO_TASK_TICK_MS;
+    } else {
+      this->release_idle_decoder_(target, esp_timer_get_time());
+    }
+  }
+  return wait_ms;
+}
+
+void AirPlayBridge::drain_audio_queue_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  uint8_t type;
+  const uint8_t *data;
+  size_t len;
+  while (!audio.draining && audio.queue.front(type, data, len)) {
+    switch (type) {
+      case AUDIO_RECORD_RTP:
+        if (audio.active) {
+          if (audio.pending_bytes > 0 && audio.jitter.depth() + 1 >= audio.jitter.slot_count()) {
+            // The speaker is behind and the jitter buffer is full; leave the rest queued until it drains.
+            return;
+          }
+          const uint32_t allocations = audio_task_allocations();
+          const int64_t now_us = esp_timer_get_time();
+          audio.jitter.insert(data, len, now_us);
+          this->request_resends_(target, now_us);
+          audio.steady_allocations += audio_task_allocations() - allocations;
+        }
+        break;
+      case AUDIO_RECORD_START:
+        this->begin_audio_(target, data, len);
+        break;
+      case AUDIO_RECORD_STOP:
+        this->end_audio_(target);
+        break;
+      case AUDIO_RECORD_HANDOVER:
+        this->cut_audio_(target);
+        break;
+      case AUDIO_RECORD_FLUSH:
+        this->flush_audio_(target, data, len);
+        break;
+      case AUDIO_RECORD_FOLLOW:
+        if (len == 1) {
+          this->follow_leader_(target, data[0]);
+        }
+        break;
+      case AUDIO_RECORD_TIMELINE:
+        if (len == 20) {
+          uint32_t timestamp;
+          int64_t local_us;
+          float drift_ppm;
+          uint32_t latency_frames;
+          memcpy(&timestamp, data, sizeof(timestamp));
+          memcpy(&local_us, data + 4, sizeof(local_us));
+          memcpy(&drift_ppm, data + 12, sizeof(drift_ppm));
+          memcpy(&latency_frames, data + 16, sizeof(latency_frames));
+          audio.jitter.set_timeline(timestamp, local_us, latency_frames);
+          if (audio.following < 0) {
+            // The pinned timeline runs at the sender's rate, so the output has to absorb its drift. A group
+            // member gets the leader's output, already corrected, and keeps its own trim.
+            audio.rate_trim_ppm = drift_ppm;
+            audio.drift.reset();
+          }
+        }
+        break;
+      default:
+        break;
+    }
+    audio.queue.pop();
+  }
+}
+
+void AirPlayBridge::play_due_audio_(TargetRuntime &target, int64_t now_us) {
+  AudioPipeline &audio = *target.audio;
+  const uint8_t *data;
+  size_t len;
+  uint16_t seq;
+  while (this->flush_output_(target)) {
+    const JitterBuffer::PopResult result = audio.jitter.pop(now_us, data, len, seq);
+    if (result == JitterBuffer::PopResult::EMPTY) {
+      return;
+    }
+    if (result == JitterBuffer::PopResult::PACKET) {
+      this->decode_rtp_audio_(target, data, len);
+      audio.jitter.release();
+    } else {
+      ESP_LOGV(TAG, "RTP packet %u lost for target '%s'", seq, target.spec.name.c_str());
+      this->conceal_lost_packet_(target);
+    }
+  }
+}
+
+void AirPlayBridge::update_rate_trim_(TargetRuntime &target, int64_t now_us) {
+  AudioPipeline &audio = *target.audio;
+  if (audio.jitter.timeline_pinned() || audio.jitter.depth() == 0) {
+    return;
+  }
+  // Without sender clock sync, the buffer level is the only sign of a rate mismatch: a sender running
+  // fast fills it up, a slow one drains it. Sample it every tick but only move the timeline occasionally.
+  const int64_t error_us = audio.jitter.buffered_us(now_us) - audio.jitter.latency_us();
+  audio.drift.update(error_us, now_us);
+  if (now_us - audio.last_trim_us >= RATE_TRIM_INTERVAL_US) {
+    audio.last_trim_us = now_us;
+    audio.rate_trim_ppm = audio.drift.trim_ppm();
+    audio.jitter.set_rate_trim(audio.rate_trim_ppm);
+  }
+}
+
+void AirPlayBridge::request_resends_(TargetRuntime &target, int64_t now_us) {
+  AudioPipeline &audio = *target.audio;
+  uint16_t first;
+  uint16_t count;
+  int64_t deadline_us;
+  if (!audio.jitter.take_gap(first, count, deadline_us)) {
+    return;
+  }
+  if (deadline_us - now_us < RESEND_MIN_LEAD_US) {
+    return;
+  }
+  const uint8_t payload[4] = {static_cast<uint8_t>(first >> 8), static_cast<uint8_t>(first & 0xFF),
+                              static_cast<uint8_t>(count >> 8), static_cast<uint8_t>(count & 0xFF)};
+  if (audio.events.push(AUDIO_EVENT_RESEND, payload, sizeof(payload))) {
+    audio.jitter.mark_requested(first, count);
+  }
+}
+
+void AirPlayBridge::conceal_lost_packet_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  if (audio.last_frame_samples == 0) {
+    return;
+  }
+  int16_t *frame = audio.last_frame;
+  const size_t samples = audio.last_frame_samples;
+  if (audio.concealing == 0) {
+    // First loss in a row: replay the previous frame, fading it out so it blends into silence.
+    const size_t frames = samples / 2;
+    for (size_t i = 0; i < frames; i++) {
+      const int32_t weight = static_cast<int32_t>(frames - i);
+      frame[i * 2] = static_cast<int16_t>(frame[i * 2] * weight / static_cast<int32_t>(frames));
+      frame[i * 2 + 1] = static_cast<int16_t>(frame[i * 2 + 1] * weight / static_cast<int32_t>(frames));
+    }
+  } else if (audio.concealing == 1) {
+    memset(frame, 0, samples * sizeof(int16_t));
+  }
+  if (audio.concealing < 2) {
+    audio.concealing++;
+  }
+  audio.concealed_packets++;
+  memcpy(audio.pcm + audio.pcm_samples, frame, samples * sizeof(int16_t));
+  audio.pcm_samples += samples;
+  if (audio.pcm_samples >= PCM_BLOCK_FRAMES * 2) {
+    this->resample_and_play_(target);
+  }
+}
+
+bool AirPlayBridge::allocate_audio_buffers_(AudioPipeline &audio) {
+  RAMAllocator<int16_t> allocator(this->audio_buffers_in_psram_ ? RAMAllocator<int16_t>::NONE
+                                                                : RAMAllocator<int16_t>::ALLOC_INTERNAL);
+  RAMAllocator<int32_t> wide_allocator(this->audio_buffers_in_psram_ ? RAMAllocator<int32_t>::NONE
+                                                                     : RAMAllocator<int32_t>::ALLOC_INTERNAL);
+  // A block is flushed as soon as it reaches PCM_BLOCK_FRAMES, so one more packet always fits behind it.
+  const size_t block_frames = PCM_BLOCK_FRAMES + MAX_FRAMES_PER_PACKET;
+  const size_t last_frame_capacity = MAX_FRAMES_PER_PACKET * 2;
+  const size_t pcm_capacity = block_frames * 2;
+  const size_t resample_capacity =
+      (audio.native_rate ? NativeResampler::max_output_frames(block_frames)
+                         : OutputResampler::max_output_frames(block_frames)) *
+      2;
+  // 24-bit output is packed three bytes to a sample, so the 32-bit buffer holds either.
+  const size_t wide_capacity = audio.output_bits > 16 ? resample_capacity : 0;
+  int16_t *last_frame = allocator.allocate(last_frame_capacity);
+  int16_t *pcm = allocator.allocate(pcm_capacity);
+  int16_t *resample_out = allocator.allocate(resample_capacity);
+  int32_t *wide_out = wide_capacity > 0 ? wide_allocator.allocate(wide_capacity) : nullptr;
+  if (last_frame == nullptr || pcm == nullptr || resample_out == nullptr ||
+      (wide_capacity > 0 && wide_out == nullptr)) {
+    if (last_frame != nullptr) {
+      allocator.deallocate(last_frame, last_frame_capacity);
+    }
+    if (pcm != nullptr) {
+      allocator.deallocate(pcm, pcm_capacity);
+    }
+    if (resample_out != nullptr) {
+      allocator.deallocate(resample_out, resample_capacity);
+    }
+    if (wide_out != nullptr) {
+      wide_allocator.deallocate(wide_out, wide_capacity);
+    }
     return false;
   }
-  target.alac_decoder = dec;
-  target.alac_initialized = true;
-  ESP_LOGI(TAG, "ALAC decoder initialized for target '%s'", target.spec.name.c_str());
+  audio.frame_capacity = MAX_FRAMES_PER_PACKET;
+  audio.last_frame = last_frame;
+  audio.pcm = pcm;
+  audio.pcm_capacity = pcm_capacity;
+  audio.resample_out = resample_out;
+  audio.resample_capacity = resample_capacity;
+  audio.wide_out = wide_out;
+  audio.wide_capacity = wide_capacity;
+  audio.buffer_bytes =
+      (last_frame_capacity + pcm_capacity + resample_capacity) * sizeof(int16_t) + wide_capacity * sizeof(int32_t);
   return true;
+}
+
+void AirPlayBridge::choose_output_format_(AudioPipeline &audio, const TargetSpec &spec) {
+  if (spec.speaker == nullptr) {
+    // The HTTP stream carries the AirPlay format unchanged.
+    audio.native_rate = true;
+    audio.output_channels = 2;
+    audio.output_bits = 16;
+    return;
+  }
+  // The configuration is the only reliable description of the speaker: before the first stream its reported
+  // stream info is ESPHome's default, not what the hardware takes. start_output_() sets this format on it.
+  audio.native_rate = AIRPLAY_OUTPUT_SAMPLE_RATE == AIRPLAY_SAMPLE_RATE;
+  audio.output_channels = spec.channels == 1 ? 1 : 2;
+  audio.output_bits = spec.bits_per_sample > 24 ? 32 : (spec.bits_per_sample > 16 ? 24 : 16);
+}
+
+uint32_t AirPlayBridge::output_sample_rate_(const AudioPipeline &audio) {
+  return audio.native_rate ? AIRPLAY_SAMPLE_RATE : AIRPLAY_OUTPUT_SAMPLE_RATE;
+}
+
+std::string AirPlayBridge::describe_output_format_(const AudioPipeline &audio) {
+  char buffer[96];
+  snprintf(buffer, sizeof(buffer), "%u Hz %s, %s, %u-bit%s", static_cast<unsigned>(output_sample_rate_(audio)),
+           audio.native_rate || OutputResampler::PASS_THROUGH ? "pass-through" : "resampled",
+           audio.output_channels == 1 ? "mono downmix" : "stereo", audio.output_bits,
+           audio.output_bits > 16 ? " (widened)" : "");
+  return buffer;
+}
+
+void AirPlayBridge::begin_audio_(TargetRuntime &target, const uint8_t *record, size_t record_len) {
+  AudioPipeline &audio = *target.audio;
+  const uint8_t codec = record_len > 0 ? record[0] : static_cast<uint8_t>(CODEC_NONE);
+  const bool encrypted = record_len >= 34 && record[1] != 0;
+  const size_t header_len = std::min<size_t>(record_len, encrypted ? 34 : 2);
+  const uint8_t *config = record + header_len;
+  const size_t config_len = record_len - header_len;
+  audio.codec = codec;
+  // Without a decrypt buffer there is no key either, and the ANNOUNCE was already refused.
+  audio.encrypted = encrypted && audio.decrypt_buffer != nullptr;
+  if (audio.encrypted) {
+    audio.cipher.set_key(record + 2, record + 18);
+  }
+  audio.pcm_samples = 0;
+  audio.resampler.reset();
+  audio.native_resampler.reset();
+  audio.jitter.reset();
+  audio.jitter.clear_timeline();
+  audio.jitter.set_rate_trim(0.0f);
+  audio.drift.reset();
+  audio.rate_trim_ppm = 0.0f;
+  size_t frame_length = AIRPLAY_FRAMES_PER_PACKET;
+  if (codec == CODEC_ALAC && config_len >= 24) {
+    // ALACSpecificConfig starts with the big-endian frames per packet; senders almost always use 352.
+    frame_length = (static_cast<size_t>(config[0]) << 24) | (static_cast<size_t>(config[1]) << 16) |
+                   (static_cast<size_t>(config[2]) << 8) | config[3];
+  } else if (codec == CODEC_AAC) {
+    frame_length = AAC_FRAMES_PER_PACKET;
+  }
+  if (frame_length > audio.frame_capacity) {
+    // The buffers are not regrown here: streaming never touches the heap. Such packets fail to decode
+    // and play as silence.
+    ESP_LOGW(TAG, "Target '%s' was sent %u-frame packets; only up to %u fit the audio buffers",
+             target.spec.name.c_str(), static_cast<unsigned>(frame_length),
+             static_cast<unsigned>(audio.frame_capacity));
+  }
+  audio.active = true;
+  audio.last_frame_samples = 0;
+  audio.concealing = 0;
+  audio.following = -1;
+  this->prepare_decoder_(target, codec, config, config_len);
+  this->start_output_(target);
+}
+
+void AirPlayBridge::follow_leader_(TargetRuntime &target, int leader) {
+  AudioPipeline &audio = *target.audio;
+  const AudioPipeline *leader_audio = this->runtimes_[leader].audio.get();
+  if (leader_audio == nullptr) {
+    return;
+  }
+  // Blocks arrive already resampled by the leader. Every pipeline is sized for the largest packet at setup
+  // and group members share the leader's rate, so they always fit; fan_out_() still drops any that do not.
+  // The member's speaker runs on its own clock, so it keeps a trim of its own, driven by its backlog.
+  audio.following = leader;
+  audio.native_resampler.reset();
+  audio.drift.reset();
+  audio.rate_trim_ppm = 0.0f;
+  audio.last_trim_us = esp_timer_get_time();
+  this->start_output_(target);
+}
+
+void AirPlayBridge::start_output_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  audio.pending_bytes = 0;
+  audio.output_started = false;
+  if (target.spec.speaker) {
+    // Something else sharing the speaker may have changed its format since the last stream.
+    target.spec.speaker->set_audio_stream_info(
+        audio::AudioStreamInfo(audio.output_bits, audio.output_channels, output_sample_rate_(audio)));
+    target.spec.speaker->start();
+  }
+}
+
+const char *AirPlayBridge::codec_name_(uint8_t codec) {
+  switch (codec) {
+    case CODEC_PCM:
+      return "PCM";
+    case CODEC_ALAC:
+      return "ALAC";
+    case CODEC_AAC:
+      return "AAC";
+    default:
+      return "unknown";
+  }
+}
+
+void AirPlayBridge::prepare_decoder_(TargetRuntime &target, uint8_t codec, const uint8_t *config,
+                                     size_t config_len) {
+  AudioPipeline &audio = *target.audio;
+  if (codec == CODEC_PCM) {
+    // L16 only needs its bytes swapped. An open decoder is left to idle out in case the next stream wants it.
+    ESP_LOGD(TAG, "PCM stream for target '%s'", target.spec.name.c_str());
+    return;
+  }
+#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
+  // Everything the decoder is opened with, which is also what decides whether a warm one can be reused.
+  std::string decoder_config;
+  esp_audio_type_t type;
+  switch (codec) {
+    case CODEC_ALAC:
+      if (config_len == 0 && audio.decoder_codec == CODEC_ALAC) {
+        // A sender that sends no config gets whatever ALAC decoder is already open.
+        decoder_config = audio.decoder_config;
+      } else if (config_len < 24) {
+        ESP_LOGW(TAG, "No ALAC config from the sender for target '%s'; audio will not decode",
+                 target.spec.name.c_str());
+        return;
+      } else {
+        decoder_config.assign(reinterpret_cast<const char *>(config), config_len);
+      }
+      type = ESP_AUDIO_TYPE_ALAC;
+      break;
+#if defined(AIRPLAY_USE_AAC)
+    case CODEC_AAC: {
+      // RAOP carries bare AAC access units in the AirPlay format itself, without ADTS headers.
+      esp_aac_dec_cfg_t aac_config{};
+      aac_config.sample_rate = AIRPLAY_SAMPLE_RATE;
+      aac_config.channel = 2;
+      aac_config.bits_per_sample = 16;
+      aac_config.no_adts_header = true;
+      decoder_config.assign(reinterpret_cast<const char *>(&aac_config), sizeof(aac_config));
+      type = ESP_AUDIO_TYPE_AAC;
+      break;
+    }
+#endif
+    default:
+      ESP_LOGW(TAG, "The sender chose a codec this build cannot decode for target '%s'", target.spec.name.c_str());
+      return;
+  }
+  // Reconnecting senders almost always send the same format again, so a warm decoder only needs a reset.
+  if (audio.decoder != nullptr && audio.decoder_codec == codec && audio.decoder_config == decoder_config) {
+    esp_audio_dec_reset(static_cast<esp_audio_dec_handle_t>(audio.decoder));
+    audio.decoder_reuses++;
+    ESP_LOGD(TAG, "Reusing %s decoder for target '%s'", codec_name_(codec), target.spec.name.c_str());
+    return;
+  }
+  close_decoder_(audio);
+  // The decoder keeps a pointer to its config, so the copy lives as long as the decoder does.
+  audio.decoder_config = std::move(decoder_config);
+  esp_audio_dec_cfg_t cfg = {.type = type,
+                            .cfg = audio.decoder_config.data(),
+                            .cfg_sz = static_cast<uint32_t>(audio.decoder_config.size())};
+  esp_audio_dec_handle_t dec = nullptr;
+  if (esp_audio_dec_open(&cfg, &dec) != ESP_AUDIO_ERR_OK) {
+    ESP_LOGW(TAG, "Failed to open %s decoder", codec_name_(codec));
+    audio.decoder_config.clear();
+    return;
+  }
+  audio.decoder = dec;
+  audio.decoder_codec = codec;
+  audio.decoder_opens++;
+  ESP_LOGI(TAG, "%s decoder initialized for target '%s'", codec_name_(codec), target.spec.name.c_str());
 #else
-  (void) target;
-  ESP_LOGW(TAG, "ALAC decoding requires esp_audio_codec (add idf_component.yml dependency)");
-  return false;
+  (void) audio;
+  (void) config;
+  (void) config_len;
+  ESP_LOGW(TAG, "%s decoding requires esp_audio_codec (add idf_component.yml dependency)", codec_name_(codec));
 #endif
 }
 
-void AirPlayBridge::resample_and_play_(TargetRuntime &target) {
-  if (!target.spec.speaker || target.pcm_buffer.empty()) {
+void AirPlayBridge::close_decoder_(AudioPipeline &audio) {
+#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
+  if (audio.decoder != nullptr) {
+    esp_audio_dec_close(static_cast<esp_audio_dec_handle_t>(audio.decoder));
+    audio.decoder = nullptr;
+  }
+#endif
+  audio.decoder_codec = CODEC_NONE;
+  audio.decoder_config.clear();
+}
+
+void AirPlayBridge::release_idle_decoder_(TargetRuntime &target, int64_t now_us) {
+  AudioPipeline &audio = *target.audio;
+  if (audio.decoder == nullptr || this->decoder_idle_timeout_ == 0 ||
+      now_us - audio.decoder_idle_since_us < static_cast<int64_t>(this->decoder_idle_timeout_) * 1000) {
+    return;
+  }
+  ESP_LOGD(TAG, "Freeing idle %s decoder for target '%s'", codec_name_(audio.decoder_codec), target.spec.name.c_str());
+  close_decoder_(audio);
+}
+
+void AirPlayBridge::end_audio_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  if (audio.following >= 0) {
+    // Nothing of its own to play out; the leader has written everything this target will get.
+    audio.following = -1;
+    audio.jitter.reset();
+    audio.pcm_samples = 0;
+  }
+  audio.active = false;
+  audio.draining = true;
+  this->play_out_(target);
+}
+
+void AirPlayBridge::play_out_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  // Whatever is still buffered plays regardless of its timestamp, as fast as the speaker takes it. A full
+  // speaker ends this tick's share; the task comes back on the next one instead of waiting here.
+  this->play_due_audio_(target, INT64_MAX);
+  if (audio.pending_bytes > 0) {
     return;
   }
-  const uint32_t in_rate = 44100;
-  const uint32_t out_rate = this->output_sample_rate_;
-  const size_t sample_size = 4;
-  const size_t in_samples = target.pcm_buffer.size() / sample_size;
-  if (in_samples == 0) {
+  this->resample_and_play_(target);
+  if (!this->flush_output_(target)) {
     return;
   }
+  audio.draining = false;
+  if (target.spec.speaker) {
+    target.spec.speaker->finish();
+  }
+  audio.decoder_idle_since_us = esp_timer_get_time();
+}
+
+void AirPlayBridge::cut_audio_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  // The new sender's START follows within moments. Its first packets are what should be heard, so the old
+  // stream is dropped instead of played out, and the speaker and decoder are left running for it.
+  audio.following = -1;
+  audio.active = false;
+  audio.jitter.reset();
+  audio.pcm_samples = 0;
+  audio.pending_bytes = 0;
+  audio.decoder_idle_since_us = esp_timer_get_time();
+}
 
-  if (in_rate == out_rate) {
-    target.spec.speaker->play(target.pcm_buffer.data(), target.pcm_buffer.size());
-    target.pcm_buffer.clear();
+void AirPlayBridge::flush_audio_(TargetRuntime &target, const uint8_t *data, size_t len) {
+  AudioPipeline &audio = *target.audio;
+  // A seek or track skip. Only audio from before the new position goes; the decoder and the speaker keep
+  // running, so the next audio plays once its latency has passed rather than after a restart.
+  audio.pcm_samples = 0;
+  audio.pending_bytes = 0;
+  if (audio.following >= 0 || !audio.active) {
     return;
   }
+  uint32_t timestamp;
+  if (len == sizeof(timestamp)) {
+    memcpy(&timestamp, data, sizeof(timestamp));
+    audio.jitter.flush(timestamp);
+  } else {
+    audio.jitter.reset();
+    audio.jitter.clear_timeline();
+  }
+  audio.resampler.reset();
+  audio.native_resampler.reset();
+  audio.drift.reset();
+  audio.last_frame_samples = 0;
+  audio.concealing = 0;
+}
 
-  const size_t out_samples = static_cast<size_t>(static_cast<double>(in_samples) * out_rate / in_rate);
-  std::vector<uint8_t> out;
-  out.reserve(out_samples * sample_size);
-  const int16_t *in = reinterpret_cast<const int16_t *>(target.pcm_buffer.data());
-  for (size_t i = 0; i < out_samples; i++) {
-    const double src_idx = static_cast<double>(i) * in_rate / out_rate;
-    const size_t idx = static_cast<size_t>(src_idx);
-    if (idx + 1 < in_samples) {
-      const float t = static_cast<float>(src_idx - idx);
-      const int16_t l = static_cast<int16_t>(in[idx * 2] * (1.0f - t) + in[(idx + 1) * 2] * t);
-      const int16_t r = static_cast<int16_t>(in[idx * 2 + 1] * (1.0f - t) + in[(idx + 1) * 2 + 1] * t);
-      out.push_back(static_cast<uint8_t>(l & 0xFF));
-      out.push_back(static_cast<uint8_t>((l >> 8) & 0xFF));
-      out.push_back(static_cast<uint8_t>(r & 0xFF));
-      out.push_back(static_cast<uint8_t>((r >> 8) & 0xFF));
+void AirPlayBridge::decode_rtp_audio_(TargetRuntime &target, const uint8_t *data, size_t len) {
+  AudioPipeline &audio = *target.audio;
+  const size_t rtp_header_len = 12;
+  if (len <= rtp_header_len) {
+    return;
+  }
+  const uint8_t *payload = data + rtp_header_len;
+  const size_t payload_len = len - rtp_header_len;
+  if (audio.encrypted) {
+    // The jitter buffer keeps the packet as received, so it is decrypted into scratch space.
+    const int64_t started_us = esp_timer_get_time();
+    audio.cipher.decrypt(payload, payload_len, audio.decrypt_buffer.get());
+    const uint32_t elapsed_us = static_cast<uint32_t>(esp_timer_get_time() - started_us);
+    audio.decrypted_packets++;
+    audio.decrypt_us_total += elapsed_us;
+    audio.decrypt_us_max = std::max(audio.decrypt_us_max, elapsed_us);
+    payload = audio.decrypt_buffer.get();
+  }
+  // Decode straight onto the end of the pending block; there is always room for one packet there.
+  int16_t *samples = audio.pcm + audio.pcm_samples;
+  const size_t capacity = audio.pcm_capacity - audio.pcm_samples;
+  size_t sample_count;
+  if (audio.codec == CODEC_PCM) {
+    // L16 is big-endian on the wire, so swapping bytes is all the decoding it needs.
+    sample_count = std::min(payload_len / 2, capacity) & ~size_t{1};
+    dsp::from_big_endian_16(payload, samples, sample_count);
+  } else {
+    sample_count = decode_payload_(audio, payload, payload_len, samples, capacity);
+  }
+  if (sample_count == 0) {
+    return;
+  }
+  if (audio.concealing != 0) {
+    // Ramp back in from the concealed (faded) audio.
+    const size_t fade = std::min(CONCEAL_FADE_IN_FRAMES, sample_count / 2);
+    for (size_t i = 0; i < fade; i++) {
+      samples[i * 2] = static_cast<int16_t>(samples[i * 2] * static_cast<int32_t>(i) / static_cast<int32_t>(fade));
+      samples[i * 2 + 1] =
+          static_cast<int16_t>(samples[i * 2 + 1] * static_cast<int32_t>(i) / static_cast<int32_t>(fade));
     }
+    audio.concealing = 0;
+  }
+  audio.last_frame_samples = std::min(sample_count, audio.frame_capacity * 2);
+  memcpy(audio.last_frame, samples, audio.last_frame_samples * sizeof(int16_t));
+  audio.pcm_samples += sample_count;
+  if (audio.pcm_samples >= PCM_BLOCK_FRAMES * 2) {
+    this->resample_and_play_(target);
+  }
+}
+
+size_t AirPlayBridge::decode_payload_(AudioPipeline &audio, const uint8_t *payload, size_t len, int16_t *out,
+                                      size_t capacity) {
+#if defined(AIRPLAY_USE_ESP_AUDIO_CODEC)
+  if (audio.decoder == nullptr || audio.decoder_codec != audio.codec) {
+    return 0;
+  }
+  size_t au_header_len = 4;
+  if (audio.codec == CODEC_AAC && len >= 2) {
+    // RFC 3640: the AU headers' length in bits, the AU headers themselves, then the access unit.
+    const size_t header_bits = (static_cast<size_t>(payload[0]) << 8) | payload[1];
+    au_header_len = 2 + (header_bits + 7) / 8;
   }
-  if (!out.empty()) {
-    target.spec.speaker->play(out.data(), out.size());
+  if (len <= au_header_len) {
+    return 0;
+  }
+  esp_audio_dec_in_raw_t raw_in = {.buffer = const_cast<uint8_t *>(payload + au_header_len),
+                                  .len = static_cast<uint32_t>(len - au_header_len),
+                                  .consumed = 0,
+                                  .frame_recover = ESP_AUDIO_DEC_RECOVERY_NONE};
+  esp_audio_dec_out_frame_t frame_out = {.buffer = reinterpret_cast<uint8_t *>(out),
+                                         .len = static_cast<uint32_t>(capacity * sizeof(int16_t)),
+                                         .needed_size = 0,
+                                         .decoded_size = 0};
+  if (esp_audio_dec_process(static_cast<esp_audio_dec_handle_t>(audio.decoder), &raw_in, &frame_out) !=
+      ESP_AUDIO_ERR_OK) {
+    return 0;
+  }
+  return frame_out.decoded_size / sizeof(int16_t);
+#else
+  (void) audio;
+  (void) payload;
+  (void) len;
+  (void) out;
+  (void) capacity;
+  return 0;
+#endif
+}
+
+void AirPlayBridge::resample_and_play_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  const size_t in_frames = audio.pcm_samples / 2;
+  if (in_frames == 0) {
+    return;
+  }
+  size_t out_frames;
+  if (audio.native_rate) {
+    audio.native_resampler.set_trim_ppm(audio.rate_trim_ppm);
+    out_frames = audio.native_resampler.process(audio.pcm, in_frames, audio.resample_out);
+  } else {
+    audio.resampler.set_trim_ppm(audio.rate_trim_ppm);
+    out_frames = audio.resampler.process(audio.pcm, in_frames, audio.resample_out);
   }
-  target.pcm_buffer.clear();
+  audio.pcm_samples = 0;
+  if (out_frames == 0) {
+    return;
+  }
+  // Group members get a copy of the block before this target's gain and format are applied to it.
+  const int index = static_cast<int>(&target - this->runtimes_.data());
+  for (auto &member : this->runtimes_) {
+    if (member.audio && member.audio->following == index) {
+      this->fan_out_(member, audio.resample_out, out_frames);
+    }
+  }
+  this->output_block_(target, out_frames);
+}
+
+void AirPlayBridge::fan_out_(TargetRuntime &member, const int16_t *block, size_t frames) {
+  AudioPipeline &audio = *member.audio;
+  if (!this->flush_output_(member)) {
+    // Its speaker has not taken the previous block yet, trim or not. Give that up rather than hold up the
+    // group.
+    audio.dropped_bytes += audio.pending_bytes;
+    audio.follower_dropped_bytes += audio.pending_bytes;
+    audio.pending_bytes = 0;
+  }
+  if (NativeResampler::max_output_frames(frames) * 2 > audio.resample_capacity) {
+    audio.dropped_bytes += frames * 2 * sizeof(int16_t);
+    audio.follower_dropped_bytes += frames * 2 * sizeof(int16_t);
+    return;
+  }
+  // The leader's output is already at the output rate, so the pass-through resampler only drops or repeats
+  // a single frame now and then for this member's trim.
+  audio.native_resampler.set_trim_ppm(audio.rate_trim_ppm);
+  const size_t out_frames = audio.native_resampler.process(block, frames, audio.resample_out);
+  this->output_block_(member, out_frames);
+  this->update_follower_trim_(member, esp_timer_get_time());
+}
+
+void AirPlayBridge::update_follower_trim_(TargetRuntime &member, int64_t now_us) {
+  AudioPipeline &audio = *member.audio;
+  // A member has no jitter buffer of its own; what its speaker would not take is the sign that it plays
+  // slower than the leader, and so the error the trim works against. Sampled after every block.
+  const size_t frame_bytes = audio.output_channels * (audio.output_bits == 24 ? 3 : audio.output_bits / 8);
+  const int64_t backlog_us = static_cast<int64_t>(audio.pending_bytes / frame_bytes) * 1000000 /
+                             static_cast<int64_t>(output_sample_rate_(audio));
+  audio.drift.update(backlog_us, now_us);
+  if (now_us - audio.last_trim_us >= RATE_TRIM_INTERVAL_US) {
+    audio.last_trim_us = now_us;
+    audio.rate_trim_ppm = audio.drift.trim_ppm();
+  }
+}
+
+void AirPlayBridge::output_block_(TargetRuntime &target, size_t out_frames) {
+  AudioPipeline &audio = *target.audio;
+  const int32_t target_gain = audio.target_gain.load();
+  if (audio.gain != target_gain || target_gain < 32767) {
+    dsp::gain_ramp_stereo_q15(audio.resample_out, out_frames, audio.gain, target_gain, VOLUME_RAMP_STEP);
+  }
+  size_t samples = out_frames * 2;
+  if (audio.output_channels == 1) {
+    dsp::downmix_to_mono(audio.resample_out, audio.resample_out, out_frames);
+    samples = out_frames;
+  }
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(audio.resample_out);
+  size_t bytes = samples * sizeof(int16_t);
+  if (audio.output_bits == 32) {
+    dsp::widen_to_int32(audio.resample_out, audio.wide_out, samples);
+    data = reinterpret_cast<const uint8_t *>(audio.wide_out);
+    bytes = samples * sizeof(int32_t);
+  } else if (audio.output_bits == 24) {
+    dsp::widen_to_int24(audio.resample_out, reinterpret_cast<uint8_t *>(audio.wide_out), samples);
+    data = reinterpret_cast<const uint8_t *>(audio.wide_out);
+    bytes = samples * 3;
+  }
+  if (!target.spec.speaker) {
+    // HTTP listeners keep their own pace; the ring never pushes back.
+    audio.stream.write(data, bytes);
+    return;
+  }
+  if (audio.output_started && !target.spec.speaker->has_buffered_data()) {
+    audio.underruns++;
+  }
+  audio.output_started = true;
+  const size_t written = target.spec.speaker->play(data, bytes);
+  if (written < bytes) {
+    // The speaker's buffer is full. Keep the rest and hold back further packets until it has room.
+    audio.overruns++;
+    audio.pending_out = data + written;
+    audio.pending_bytes = bytes - written;
+    audio.blocked_since_us = esp_timer_get_time();
+  }
+}
+
+bool AirPlayBridge::flush_output_(TargetRuntime &target) {
+  AudioPipeline &audio = *target.audio;
+  if (audio.pending_bytes == 0) {
+    return true;
+  }
+  const size_t written = target.spec.speaker->play(audio.pending_out, audio.pending_bytes);
+  audio.pending_out += written;
+  audio.pending_bytes -= written;
+  if (audio.pending_bytes == 0) {
+    return true;
+  }
+  const int64_t now_us = esp_timer_get_time();
+  if (written > 0) {
+    audio.blocked_since_us = now_us;
+  } else if (now_us - audio.blocked_since_us >= OUTPUT_STALL_TIMEOUT_US) {
+    ESP_LOGW(TAG, "Speaker for target '%s' stopped taking audio, dropping %u bytes", target.spec.name.c_str(),
+             static_cast<unsigned>(audio.pending_bytes));
+    audio.dropped_bytes += audio.pending_bytes;
+    audio.pending_bytes = 0;
+    return true;
+  }
+  return false;
 }
 #endif
 
@@ -2,9 +2,23 @@
 
 #include "esphome/components/media_player/media_player.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/helpers.h"
 #include "esphome/components/network/util.h"
 
+#include "audio_queue.h"
+#include "clock_sync.h"
+#include "drift_controller.h"
+#include "dsp_kernels.h"
+#include "http_stream.h"
+#include "jitter_buffer.h"
+#include "raop_crypto.h"
+#include "resampler.h"
+#include "rtsp_parser.h"
+#include "rx_buffer.h"
+#include "socket_mux.h"
+#include "stream_ring.h"
+
 #ifdef USE_ESP32
 #include <mdns.h>
 #endif
@@ -24,9 +38,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #endif
 
-#include <map>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -37,15 +53,38 @@ class Speaker;
 }  // namespace speaker
 }  // namespace esphome
 
+// Set by codegen from `output_sample_rate`; fixed at compile time so the resampler can be specialised.
+#ifndef AIRPLAY_OUTPUT_SAMPLE_RATE
+#define AIRPLAY_OUTPUT_SAMPLE_RATE 16000
+#endif
+
 namespace esphome {
 namespace airplay_bridge {
 
+// AirPlay audio is always 44.1 kHz.
+using OutputResampler = Resampler<44100, AIRPLAY_OUTPUT_SAMPLE_RATE>;
+// Used instead when the speaker runs at 44.1 kHz itself.
+using NativeResampler = Resampler<44100, 44100>;
+
 class AirPlayBridge : public Component {
  public:
   void set_port_base(uint16_t port_base) { this->port_base_ = port_base; }
   void set_media_url_template(const std::string &media_url_template) { this->media_url_template_ = media_url_template; }
-  void set_output_sample_rate(uint32_t rate) { this->output_sample_rate_ = rate; }
-  void add_target(media_player::MediaPlayer *player, const std::string &name, esphome::Component *speaker_component);
+  void set_rx_buffer_size(size_t size) { this->rx_buffer_size_ = size; }
+  void set_audio_task_core(int core) { this->audio_task_core_ = core; }
+  void set_audio_task_priority(uint8_t priority) { this->audio_task_priority_ = priority; }
+  void set_audio_queue_size(size_t size) { this->audio_queue_size_ = size; }
+  void set_stats_interval(uint32_t interval_ms) { this->stats_interval_ = interval_ms; }
+  void set_audio_buffers_in_psram(bool psram) { this->audio_buffers_in_psram_ = psram; }
+  void set_software_volume(bool software_volume) { this->software_volume_ = software_volume; }
+  void set_volume_publish_interval(uint32_t interval_ms) { this->volume_publish_interval_ = interval_ms; }
+  void set_decoder_idle_timeout(uint32_t timeout_ms) { this->decoder_idle_timeout_ = timeout_ms; }
+  void set_rsa_private_key(const std::string &pem) { this->rsa_private_key_ = pem; }
+  void set_http_port(uint16_t port) { this->http_port_ = port; }
+  void set_http_buffer_size(size_t size) { this->http_buffer_size_ = size; }
+  void set_http_max_clients(uint8_t max_clients) { this->http_max_clients_ = max_clients; }
+  void add_target(media_player::MediaPlayer *player, const std::string &name, esphome::Component *speaker_component,
+                  const std::string &group = "", uint8_t channels = 2, uint8_t bits_per_sample = 16);
 
   void setup() override;
   void loop() override;
@@ -57,15 +96,135 @@ class AirPlayBridge : public Component {
     media_player::MediaPlayer *player{nullptr};
     esphome::speaker::Speaker *speaker{nullptr};
     std::string name;
+    // Targets in the same group that stream from the same sender share one decode.
+    std::string group;
+    // Speaker output format as configured; the speaker's own stream info is only what was last set on it.
+    uint8_t channels{2};
+    uint8_t bits_per_sample{16};
     uint16_t port{0};
   };
 
-  struct RtspRequest {
-    std::string method;
-    std::string uri;
-    std::map<std::string, std::string> headers;
-    std::string body;
+#ifdef USE_ESP_IDF
+  enum AudioRecordType : uint8_t {
+    AUDIO_RECORD_RTP = 0,
+    AUDIO_RECORD_START = 1,
+    AUDIO_RECORD_STOP = 2,
+    AUDIO_RECORD_TIMELINE = 3,
+    // Play the group leader's output (one byte: its index in runtimes_) instead of decoding.
+    AUDIO_RECORD_FOLLOW = 4,
+    // Another sender took the target over: drop what is buffered instead of playing it out.
+    AUDIO_RECORD_HANDOVER = 5,
+    // Drop audio from before a seek or track skip (optionally four bytes: the new position's RTP timestamp).
+    AUDIO_RECORD_FLUSH = 6,
+    // Audio task -> main loop.
+    AUDIO_EVENT_RESEND = 16,
+  };
+
+  // RAOP codec numbers, as used in the `cn` TXT record. A START record carries one of these followed by
+  // the codec's config from the SDP.
+  enum AudioCodec : uint8_t {
+    CODEC_PCM = 0,
+    CODEC_ALAC = 1,
+    CODEC_AAC = 2,
+    CODEC_NONE = 0xFF,
+  };
+
+  /// Per-target audio state. The main loop only ever pushes into `queue` and pops from `events`; everything
+  /// else is owned by the audio task.
+  struct AudioPipeline {
+    AudioQueue queue;
+    AudioQueue events;
+    uint32_t dropped_packets{0};  // producer side
+    JitterBuffer jitter;
+    bool active{false};
+    // Decode and output scratch, allocated once at setup for the largest packet any codec produces
+    // (`frame_capacity` frames), so that streaming never touches the heap. Sample counts are int16 values
+    // (two per stereo frame).
+    size_t frame_capacity{0};
+    size_t buffer_bytes{0};
+    // Heap allocations the audio task made while inserting and playing packets, which should stay at zero.
+    // Only counted in builds with CONFIG_HEAP_USE_HOOKS.
+    uint32_t steady_allocations{0};
+    // Last decoded frame, replayed with a fade-out when a packet is lost.
+    int16_t *last_frame{nullptr};
+    size_t last_frame_samples{0};
+    // Decoded audio collected into blocks for the resampler.
+    int16_t *pcm{nullptr};
+    size_t pcm_capacity{0};
+    size_t pcm_samples{0};
+    int16_t *resample_out{nullptr};
+    size_t resample_capacity{0};
+    // Output samples widened for speakers wider than 16 bits; only allocated for those.
+    int32_t *wide_out{nullptr};
+    size_t wide_capacity{0};
+    uint8_t concealing{0};
+    uint32_t concealed_packets{0};
+    uint8_t codec{CODEC_NONE};
+    // Decoder for compressed codecs, kept open between streams and reused while the codec and its config
+    // stay the same. Freed after decoder_idle_timeout_ without a stream. PCM needs none.
+    void *decoder{nullptr};
+    uint8_t decoder_codec{CODEC_NONE};
+    std::string decoder_config;
+    int64_t decoder_idle_since_us{0};
+    uint32_t decoder_opens{0};
+    uint32_t decoder_reuses{0};
+    // Encrypted streams are decrypted packet by packet into `decrypt_buffer`, which is only allocated
+    // when an RSA key is configured.
+    bool encrypted{false};
+    PacketCipher cipher;
+    std::unique_ptr<uint8_t[]> decrypt_buffer;
+    uint32_t decrypted_packets{0};
+    uint32_t decrypt_us_max{0};
+    uint64_t decrypt_us_total{0};
+    OutputResampler resampler;
+    NativeResampler native_resampler;
+    // Format sent to the speaker, chosen once from what it reports at setup.
+    bool native_rate{false};
+    uint8_t output_channels{2};
+    uint8_t output_bits{16};
+    // Output the speaker has not accepted yet, still in resample_out or wide_out. While any is pending no
+    // more packets are released, so the backlog waits in the jitter buffer and the queue instead.
+    const uint8_t *pending_out{nullptr};
+    size_t pending_bytes{0};
+    int64_t blocked_since_us{0};
+    bool output_started{false};
+    // STOP arrived and the rest of the stream is being played out, a tick at a time as the speaker takes
+    // it. Further records wait in the queue until the speaker has been finished.
+    bool draining{false};
+    uint32_t underruns{0};
+    uint32_t overruns{0};
+    uint32_t dropped_bytes{0};
+    // Targets without a speaker publish their output here instead, for the HTTP stream to send.
+    StreamRing stream;
+    // Index of the group leader whose resampled output this target plays, or -1 while it decodes its own.
+    int following{-1};
+    // Output given up because this member's speaker was still behind when the leader's next block came.
+    uint32_t follower_dropped_bytes{0};
+    // Software volume: the main loop sets `target_gain`, the audio task ramps `gain` towards it. Q15.
+    std::atomic<int32_t> target_gain{32767};
+    int32_t gain{32767};
+    // Playback rate trim: from the drift controller while the timeline follows the first packet, or the
+    // sender's measured clock drift once sync packets pin it. A group member trims the leader's output by
+    // its own backlog instead. Positive means consume audio faster.
+    DriftController drift;
+    float rate_trim_ppm{0.0f};
+    int64_t last_trim_us{0};
+  };
+#endif
+
+#ifdef USE_ESP_IDF
+  // A further RTSP connection to a target that already has a client, typically a sender checking whether
+  // the receiver is available. It is answered on its own until an ANNOUNCE starts a stream, which takes the
+  // target over.
+  struct PendingConnection {
+    int fd{-1};
+    sockaddr_in peer_addr{};
+    uint32_t last_activity_ms{0};
+    RxBuffer rx;
+    RxBuffer tx;
+    RtspParser rtsp;
   };
+#endif
 
   struct TargetRuntime {
     TargetSpec spec;
@@ -76,18 +235,51 @@ class AirPlayBridge : public Component {
 #ifdef USE_ESP_IDF
     int server_fd{-1};
     int client_fd{-1};
+    // Bytes the socket would not take yet; sent ahead of anything else as soon as it has room.
+    RxBuffer tx;
+    std::vector<PendingConnection> pending;
+    uint32_t takeovers{0};
 #endif
-    std::string buffer;
+    RxBuffer rx;
+    RtspParser rtsp;
     std::string session_id;
     std::string announce_sdp;
+    // DACP-ID and Active-Remote from the ANNOUNCE: which sender session the stream belongs to.
+    std::string dacp_id;
+    std::string active_remote;
     float last_volume{0.5f};
+    // Volume changes reach the media player at most once per volume_publish_interval_.
+    uint32_t last_volume_publish_ms{0};
+    bool volume_publish_pending{false};
     bool streaming{false};
 #ifdef USE_ESP_IDF
-    void *alac_decoder{nullptr};
-    std::string alac_config;
-    bool alac_initialized{false};
-    std::vector<uint8_t> pcm_buffer;
-    size_t resample_phase{0};
+    std::unique_ptr<AudioPipeline> audio;
+    // Interleaved audio is waiting for room in the audio queue; the socket is not read meanwhile.
+    bool rx_blocked{false};
+    uint32_t rx_stalls{0};
+    uint16_t control_seq{0};
+    // Main loop view of `AudioPipeline::following`: while set, this target's own RTP is not queued.
+    int follow_leader{-1};
+    uint32_t shared_packets{0};
+    // Session key from the ANNOUNCE when the sender encrypts.
+    bool encrypted{false};
+    uint8_t aes_key[16]{};
+    uint8_t aes_iv[16]{};
+    // RAOP over UDP: local sockets/ports and where the sender wants control and timing traffic.
+    bool udp{false};
+    int audio_fd{-1};
+    int control_fd{-1};
+    int timing_fd{-1};
+    uint16_t audio_port{0};
+    uint16_t control_port{0};
+    uint16_t timing_port{0};
+    sockaddr_in peer_addr{};
+    uint16_t peer_control_port{0};
+    uint16_t peer_timing_port{0};
+    // Sender clock estimate from the timing-port exchange.
+    ClockSync clock;
+    uint32_t last_timing_request_ms{0};
+    uint8_t timing_requests_sent{0};
 #endif
   };
 
@@ -95,35 +287,116 @@ class AirPlayBridge : public Component {
   std::vector<TargetRuntime> runtimes_{};
   uint16_t port_base_{7000};
   std::string media_url_template_{};
-  uint32_t output_sample_rate_{16000};
+  size_t rx_buffer_size_{8192};
+  int audio_task_core_{-1};
+  uint8_t audio_task_priority_{5};
+  size_t audio_queue_size_{16384};
+  uint32_t stats_interval_{60000};
+  bool audio_buffers_in_psram_{false};
+  bool software_volume_{false};
+  uint32_t volume_publish_interval_{500};
+  uint32_t decoder_idle_timeout_{60000};
+  std::string rsa_private_key_{};
+  uint16_t http_port_{0};
+  size_t http_buffer_size_{65536};
+  uint8_t http_max_clients_{4};
   std::string device_id_colon_{};
   std::string device_id_raop_{};
+  uint8_t device_mac_[6]{};
   bool mdns_ready_{false};
+#ifdef USE_ESP_IDF
+  TaskHandle_t audio_task_handle_{nullptr};
+  std::unique_ptr<RaopKey> raop_key_{};
+  HttpStreamServer http_server_{};
+  SocketMux sockets_{};
+#endif
+  RtspResponse response_{};
 
   void setup_runtime_();
   bool setup_mdns_();
   void advertise_target_(const TargetRuntime &target);
   void handle_target_(TargetRuntime &target);
-  bool extract_next_request_(TargetRuntime &target, RtspRequest &request);
+  void close_client_(TargetRuntime &target);
+  void process_rx_(TargetRuntime &target);
   void handle_request_(TargetRuntime &target, const RtspRequest &request);
-  void send_response_(TargetRuntime &target, int status_code, const std::string &cseq,
-                      const std::map<std::string, std::string> &headers, const std::string &body = "");
-  void send_raw_(TargetRuntime &target, const std::string &data);
-  void send_simple_ok_(TargetRuntime &target, const std::string &cseq,
-                       const std::map<std::string, std::string> &headers = {});
-  static std::string trim_(const std::string &value);
-  static std::string to_lower_(const std::string &value);
+  /// Starts `response_` with the headers every reply except OPTIONS carries.
+  void begin_response_(int status_code, std::string_view cseq);
+  void begin_options_response_(std::string_view cseq, const std::string &apple_response);
+  /// Finishes `response_` with `body` and sends it.
+  void send_response_(TargetRuntime &target, std::string_view body = {});
+  void send_raw_(TargetRuntime &target, const char *data, size_t len);
   static float db_to_volume_(float db);
-  static std::string status_message_(int status_code);
   std::string render_media_url_(const TargetRuntime &target) const;
   void start_stream_(TargetRuntime &target);
-  void stop_stream_(TargetRuntime &target);
+  /// With `handover`, another stream is about to start on this target, from a new sender or from a new
+  /// ANNOUNCE: buffered audio is dropped rather than played out, and the media player is not stopped.
+  void stop_stream_(TargetRuntime &target, bool handover = false);
+  /// FLUSH: drops audio from before the position given in `rtp_info` and keeps the stream running.
+  void flush_stream_(TargetRuntime &target, std::string_view rtp_info);
+  /// Whether this target's volume is applied as a gain in the audio task rather than by its speaker.
+  bool software_gain_(const TargetRuntime &target) const;
   void apply_volume_(TargetRuntime &target, float volume);
+  /// With software gain, only sets the media player's volume and publishes its state: a volume call would
+  /// have the player attenuate the speaker again on top of the gain.
+  void publish_volume_(TargetRuntime &target);
+  void log_stats_();
 #ifdef USE_ESP_IDF
-  void process_rtp_audio_(TargetRuntime &target, const uint8_t *data, size_t len);
-  void process_interleaved_(TargetRuntime &target);
-  bool parse_alac_config_from_sdp_(TargetRuntime &target);
+  // Main loop (producer) side.
+  bool queue_audio_record_(TargetRuntime &target, AudioRecordType type, const uint8_t *data, size_t len);
+  void queue_start_record_(TargetRuntime &target);
+  /// The streaming member of `target`'s group that decodes the same sender session (DACP-ID and
+  /// Active-Remote) in the same codec, or -1 when `target` has to decode its own stream.
+  int find_group_leader_(const TargetRuntime &target) const;
+  static uint8_t codec_from_sdp_(const std::string &sdp);
+  static const char *codec_name_(uint8_t codec);
+  static bool parse_alac_config_from_sdp_(const std::string &sdp, std::string &config);
+  static std::string_view sdp_attribute_(const std::string &sdp, std::string_view name);
+  bool setup_encryption_(TargetRuntime &target);
+  std::string respond_to_challenge_(int fd, std::string_view challenge);
+  void accept_clients_(TargetRuntime &target);
+  void handle_pending_(TargetRuntime &target);
+  bool answer_pending_(TargetRuntime &target, PendingConnection &conn, const RtspRequest &request);
+  void take_over_(TargetRuntime &target, size_t index);
+  bool setup_udp_transport_(TargetRuntime &target, std::string_view transport);
+  static int open_udp_socket_(uint16_t &port);
+  bool flush_tx_(TargetRuntime &target);
+  void read_udp_(TargetRuntime &target);
+  void send_timing_request_(TargetRuntime &target);
+  void handle_timing_packet_(TargetRuntime &target, const uint8_t *packet, size_t len, const sockaddr_in &from);
+  void handle_sync_packet_(TargetRuntime &target, const uint8_t *packet, size_t len);
+  void service_audio_events_(TargetRuntime &target);
+  void send_resend_request_(TargetRuntime &target, uint16_t first, uint16_t count);
+  // Audio task (consumer) side.
+  static void audio_task_(void *arg);
+  /// One pass of the audio task over every target. Returns how long the task may sleep before the next one.
+  uint32_t service_audio_();
+  void drain_audio_queue_(TargetRuntime &target);
+  static void choose_output_format_(AudioPipeline &audio, const TargetSpec &spec);
+  static uint32_t output_sample_rate_(const AudioPipeline &audio);
+  static std::string describe_output_format_(const AudioPipeline &audio);
+  bool allocate_audio_buffers_(AudioPipeline &audio);
+  void begin_audio_(TargetRuntime &target, const uint8_t *record, size_t record_len);
+  void follow_leader_(TargetRuntime &target, int leader);
+  void start_output_(TargetRuntime &target);
+  void end_audio_(TargetRuntime &target);
+  void play_out_(TargetRuntime &target);
+  void cut_audio_(TargetRuntime &target);
+  void flush_audio_(TargetRuntime &target, const uint8_t *data, size_t len);
+  void prepare_decoder_(TargetRuntime &target, uint8_t codec, const uint8_t *config, size_t config_len);
+  static void close_decoder_(AudioPipeline &audio);
+  void release_idle_decoder_(TargetRuntime &target, int64_t now_us);
+  void play_due_audio_(TargetRuntime &target, int64_t now_us);
+  void update_rate_trim_(TargetRuntime &target, int64_t now_us);
+  void decode_rtp_audio_(TargetRuntime &target, const uint8_t *data, size_t len);
+  static size_t decode_payload_(AudioPipeline &audio, const uint8_t *payload, size_t len, int16_t *out,
+                                size_t capacity);
+  void request_resends_(TargetRuntime &target, int64_t now_us);
+  void conceal_lost_packet_(TargetRuntime &target);
   void resample_and_play_(TargetRuntime &target);
+  void fan_out_(TargetRuntime &member, const int16_t *block, size_t frames);
+  void update_follower_trim_(TargetRuntime &member, int64_t now_us);
+  void output_block_(TargetRuntime &target, size_t frames);
+  bool flush_output_(TargetRuntime &target);
 #endif
 };
 
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Lock-free single-producer/single-consumer queue of variable-length records.
+///
+/// Records are stored contiguously in a power-of-two byte ring behind a 4-byte header, so the consumer
+/// can hand a record straight to the decoder without copying it out. When a record does not fit before
+/// the end of the ring, the producer writes a padding record and continues at the start.
+class AudioQueue {
+ public:
+  static constexpr uint8_t RECORD_PADDING = 0xFF;
+  static constexpr size_t HEADER_SIZE = 4;
+
+  /// Allocates the ring; `capacity` is rounded up to a power of two.
+  void allocate(size_t capacity) {
+    size_t size = 256;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    this->storage_.reset(new uint8_t[size]);
+    this->capacity_ = static_cast<uint32_t>(size);
+  }
+
+  size_t capacity() const { return this->capacity_; }
+
+  /// Producer: whether push() would accept a record of `len` bytes right now.
+  bool fits(size_t len, size_t keep_free = 0) const {
+    const uint32_t need = record_size_(len);
+    const uint32_t write = this->write_.load(std::memory_order_relaxed);
+    const uint32_t read = this->read_.load(std::memory_order_acquire);
+    const uint32_t offset = write & (this->capacity_ - 1);
+    const uint32_t pad = offset + need > this->capacity_ ? this->capacity_ - offset : 0;
+    return (write - read) + pad + need + keep_free <= this->capacity_;
+  }
+
+  /// Producer: appends a record, leaving at least `keep_free` bytes unused so that small control records
+  /// can still be queued when audio has filled the ring. Returns false if there is not enough room.
+  bool push(uint8_t type, const uint8_t *data, size_t len, size_t keep_free = 0) {
+    if (!this->fits(len, keep_free)) {
+      return false;
+    }
+    const uint32_t need = record_size_(len);
+    const uint32_t write = this->write_.load(std::memory_order_relaxed);
+    const uint32_t offset = write & (this->capacity_ - 1);
+    const uint32_t pad = offset + need > this->capacity_ ? this->capacity_ - offset : 0;
+    uint32_t pos = offset;
+    if (pad != 0) {
+      this->write_header_(pos, RECORD_PADDING, 0);
+      pos = 0;
+    }
+    this->write_header_(pos, type, static_cast<uint16_t>(len));
+    if (len != 0) {
+      memcpy(this->storage_.get() + pos + HEADER_SIZE, data, len);
+    }
+    this->write_.store(write + pad + need, std::memory_order_release);
+
+    const uint32_t depth = this->pushed_.fetch_add(1, std::memory_order_relaxed) + 1 -
+                           this->popped_.load(std::memory_order_relaxed);
+    if (depth > this->high_water_.load(std::memory_order_relaxed)) {
+      this->high_water_.store(depth, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /// Consumer: returns the oldest record without removing it.
+  bool front(uint8_t &type, const uint8_t *&data, size_t &len) {
+    uint32_t read = this->read_.load(std::memory_order_relaxed);
+    const uint32_t write = this->write_.load(std::memory_order_acquire);
+    if (read == write) {
+      return false;
+    }
+    uint32_t offset = read & (this->capacity_ - 1);
+    if (this->storage_[offset] == RECORD_PADDING) {
+      read += this->capacity_ - offset;
+      this->read_.store(read, std::memory_order_release);
+      if (read == write) {
+        return false;
+      }
+      offset = 0;
+    }
+    const uint8_t *header = this->storage_.get() + offset;
+    type = header[0];
+    len = static_cast<size_t>(header[2]) | (static_cast<size_t>(header[3]) << 8);
+    data = header + HEADER_SIZE;
+    return true;
+  }
+
+  /// Consumer: releases the record returned by the last successful front().
+  void pop() {
+    const uint32_t read = this->read_.load(std::memory_order_relaxed);
+    const uint8_t *header = this->storage_.get() + (read & (this->capacity_ - 1));
+    const size_t len = static_cast<size_t>(header[2]) | (static_cast<size_t>(header[3]) << 8);
+    this->read_.store(read + record_size_(len), std::memory_order_release);
+    this->popped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// Number of records currently queued.
+  uint32_t depth() const {
+    return this->pushed_.load(std::memory_order_relaxed) - this->popped_.load(std::memory_order_relaxed);
+  }
+  /// Largest depth seen since allocation.
+  uint32_t high_water() const { return this->high_water_.load(std::memory_order_relaxed); }
+
+ protected:
+  static uint32_t record_size_(size_t len) { return static_cast<uint32_t>((HEADER_SIZE + len + 3) & ~size_t{3}); }
+
+  void write_header_(uint32_t pos, uint8_t type, uint16_t len) {
+    uint8_t *header = this->storage_.get() + pos;
+    header[0] = type;
+    header[1] = 0;
+    header[2] = static_cast<uint8_t>(len & 0xFF);
+    header[3] = static_cast<uint8_t>(len >> 8);
+  }
+
+  std::unique_ptr<uint8_t[]> storage_;
+  uint32_t capacity_{0};
+  std::atomic<uint32_t> write_{0};
+  std::atomic<uint32_t> read_{0};
+  std::atomic<uint32_t> pushed_{0};
+  std::atomic<uint32_t> popped_{0};
+  std::atomic<uint32_t> high_water_{0};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
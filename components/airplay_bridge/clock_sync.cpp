@@ -0,0 +1,113 @@
+#include "clock_sync.h"
+
+namespace esphome {
+namespace airplay_bridge {
+
+// Drift estimates beyond this are treated as measurement noise rather than a real clock difference.
+static const double MAX_DRIFT = 500e-6;
+// Shortest span of exchanges worth fitting a drift slope to.
+static const int64_t MIN_DRIFT_SPAN_US = 10000000;
+
+int64_t ClockSync::ntp_to_us(uint64_t ntp) {
+  const uint64_t seconds = ntp >> 32;
+  const uint64_t fraction = ntp & 0xFFFFFFFFULL;
+  return static_cast<int64_t>(seconds * 1000000ULL + ((fraction * 1000000ULL) >> 32));
+}
+
+uint64_t ClockSync::us_to_ntp(int64_t us) {
+  const uint64_t value = static_cast<uint64_t>(us);
+  const uint64_t seconds = value / 1000000ULL;
+  const uint64_t micros = value % 1000000ULL;
+  return (seconds << 32) | ((micros << 32) / 1000000ULL);
+}
+
+void ClockSync::reset() {
+  this->count_ = 0;
+  this->next_ = 0;
+  this->drift_ = 0.0;
+}
+
+void ClockSync::add_exchange(int64_t local_send_us, int64_t remote_recv_us, int64_t remote_send_us,
+                             int64_t local_recv_us) {
+  Exchange &exchange = this->history_[this->next_];
+  exchange.local_us = local_send_us + (local_recv_us - local_send_us) / 2;
+  exchange.offset_us = ((remote_recv_us - local_send_us) + (remote_send_us - local_recv_us)) / 2;
+  exchange.delay_us = (local_recv_us - local_send_us) - (remote_send_us - remote_recv_us);
+  this->next_ = (this->next_ + 1) % HISTORY;
+  if (this->count_ < HISTORY) {
+    this->count_++;
+  }
+  this->update_estimate_();
+}
+
+void ClockSync::update_estimate_() {
+  // Offset: lowest-delay exchange among the most recent ones.
+  const size_t window = this->count_ < FILTER_WINDOW ? this->count_ : FILTER_WINDOW;
+  const Exchange *best = nullptr;
+  for (size_t i = 1; i <= window; i++) {
+    const Exchange &candidate = this->history_[(this->next_ + HISTORY - i) % HISTORY];
+    if (best == nullptr || candidate.delay_us < best->delay_us) {
+      best = &candidate;
+    }
+  }
+  this->ref_local_us_ = best->local_us;
+  this->ref_offset_us_ = best->offset_us;
+  this->ref_delay_us_ = best->delay_us;
+
+  // Drift: least-squares slope over exchanges whose delay is close to the best one seen.
+  int64_t min_delay = best->delay_us;
+  for (size_t i = 0; i < this->count_; i++) {
+    if (this->history_[i].delay_us < min_delay) {
+      min_delay = this->history_[i].delay_us;
+    }
+  }
+  const int64_t max_delay = min_delay + min_delay / 2 + 500;
+  double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+  size_t n = 0;
+  int64_t first_local = 0, last_local = 0;
+  for (size_t i = 0; i < this->count_; i++) {
+    const Exchange &exchange = this->history_[i];
+    if (exchange.delay_us > max_delay) {
+      continue;
+    }
+    if (n == 0 || exchange.local_us < first_local) {
+      first_local = exchange.local_us;
+    }
+    if (n == 0 || exchange.local_us > last_local) {
+      last_local = exchange.local_us;
+    }
+    // Relative to the reference keeps the sums small enough for doubles to stay exact.
+    const double x = static_cast<double>(exchange.local_us - this->ref_local_us_);
+    const double y = static_cast<double>(exchange.offset_us - this->ref_offset_us_);
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    n++;
+  }
+  if (n < 4 || last_local - first_local < MIN_DRIFT_SPAN_US) {
+    return;
+  }
+  const double denominator = n * sum_xx - sum_x * sum_x;
+  if (denominator <= 0) {
+    return;
+  }
+  double slope = (n * sum_xy - sum_x * sum_y) / denominator;
+  if (slope > MAX_DRIFT) {
+    slope = MAX_DRIFT;
+  } else if (slope < -MAX_DRIFT) {
+    slope = -MAX_DRIFT;
+  }
+  this->drift_ = slope;
+  // The fitted line averages out per-exchange asymmetry better than any single exchange does.
+  this->ref_offset_us_ += static_cast<int64_t>((sum_y - slope * sum_x) / n);
+}
+
+int64_t ClockSync::remote_to_local(int64_t remote_us) const {
+  // remote = local + offset(local), offset(local) = ref_offset + drift * (local - ref_local); solve for local.
+  const double relative = static_cast<double>(remote_us - this->ref_offset_us_ - this->ref_local_us_);
+  return this->ref_local_us_ + static_cast<int64_t>(relative / (1.0 + this->drift_));
+}
+
+}  // namespace airplay_bridge
+}  // namespace esphome
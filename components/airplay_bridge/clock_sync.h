@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Estimates the offset and drift of a sender's clock from RAOP timing-port exchanges.
+///
+/// Each exchange yields the classic NTP quadruple: local send time, remote receive time, remote send time
+/// and local receive time. The offset is taken from the lowest-delay exchange among the most recent few,
+/// since queueing delay only ever adds error. Once enough low-delay exchanges span a long enough time, a
+/// least-squares line through them gives the drift and refines the offset. Together they map the
+/// sender's timeline (and with it RTP timestamps, via sync packets) onto the local clock.
+///
+/// All times are microseconds. Local times come from the caller's monotonic clock; remote times are the
+/// sender's NTP time converted with ntp_to_us().
+class ClockSync {
+ public:
+  static int64_t ntp_to_us(uint64_t ntp);
+  static uint64_t us_to_ntp(int64_t us);
+
+  void reset();
+  /// Adds one exchange. `local_send_us`/`local_recv_us` are local; the other two are remote.
+  void add_exchange(int64_t local_send_us, int64_t remote_recv_us, int64_t remote_send_us, int64_t local_recv_us);
+
+  bool synchronized() const { return this->count_ > 0; }
+  /// Converts a time on the sender's clock to the local clock.
+  int64_t remote_to_local(int64_t remote_us) const;
+
+  /// Remote minus local clock, at the reference exchange.
+  int64_t offset_us() const { return this->ref_offset_us_; }
+  /// Round-trip delay of the reference exchange.
+  int64_t delay_us() const { return this->ref_delay_us_; }
+  /// Sender clock rate relative to the local clock, in parts per million.
+  float drift_ppm() const { return static_cast<float>(this->drift_ * 1e6); }
+
+ protected:
+  static constexpr size_t HISTORY = 32;
+  // Number of most recent exchanges the offset filter picks the lowest-delay one from.
+  static constexpr size_t FILTER_WINDOW = 6;
+
+  struct Exchange {
+    int64_t local_us;
+    int64_t offset_us;
+    int64_t delay_us;
+  };
+
+  void update_estimate_();
+
+  Exchange history_[HISTORY]{};
+  size_t count_{0};
+  size_t next_{0};
+
+  int64_t ref_local_us_{0};
+  int64_t ref_offset_us_{0};
+  int64_t ref_delay_us_{0};
+  double drift_{0.0};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// PI controller that turns a buffer-depth error into a playback rate trim.
+///
+/// The input is how far the buffered audio is above (positive) or below its target, in microseconds. The
+/// output is a trim in parts per million: positive means audio must be consumed faster. The error is
+/// low-pass filtered first, because the depth moves in whole-packet steps as packets arrive and leave.
+/// The defaults settle a 200 ppm mismatch with a few milliseconds of steady error within a couple of
+/// minutes, and the integral term then walks the error back to zero.
+class DriftController {
+ public:
+  void reset() {
+    this->started_ = false;
+    this->filtered_us_ = 0.0f;
+    this->integral_ppm_ = 0.0f;
+    this->trim_ppm_ = 0.0f;
+  }
+
+  float update(int64_t error_us, int64_t now_us) {
+    if (!this->started_) {
+      this->started_ = true;
+      this->last_us_ = now_us;
+      this->filtered_us_ = static_cast<float>(error_us);
+      return this->trim_ppm_;
+    }
+    const float dt = static_cast<float>(now_us - this->last_us_) * 1e-6f;
+    this->last_us_ = now_us;
+    if (dt <= 0.0f) {
+      return this->trim_ppm_;
+    }
+    const float alpha = dt / (FILTER_TIME_S + dt);
+    this->filtered_us_ += alpha * (static_cast<float>(error_us) - this->filtered_us_);
+
+    const float error_ms = this->filtered_us_ * 1e-3f;
+    this->integral_ppm_ += KP_PPM_PER_MS * error_ms * dt / INTEGRAL_TIME_S;
+    this->integral_ppm_ = clamp_(this->integral_ppm_);
+    this->trim_ppm_ = clamp_(KP_PPM_PER_MS * error_ms + this->integral_ppm_);
+    return this->trim_ppm_;
+  }
+
+  float trim_ppm() const { return this->trim_ppm_; }
+
+ protected:
+  static constexpr float KP_PPM_PER_MS = 20.0f;
+  static constexpr float INTEGRAL_TIME_S = 300.0f;
+  static constexpr float FILTER_TIME_S = 2.0f;
+  static constexpr float MAX_TRIM_PPM = 500.0f;
+
+  static float clamp_(float value) {
+    return value > MAX_TRIM_PPM ? MAX_TRIM_PPM : (value < -MAX_TRIM_PPM ? -MAX_TRIM_PPM : value);
+  }
+
+  bool started_{false};
+  int64_t last_us_{0};
+  float filtered_us_{0.0f};
+  float integral_ppm_{0.0f};
+  float trim_ppm_{0.0f};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
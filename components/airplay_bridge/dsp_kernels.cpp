@@ -0,0 +1,265 @@
+#include "dsp_kernels.h"
+
+#if __has_include(<sdkconfig.h>)
+#include <sdkconfig.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define AIRPLAY_DSP_SSE2
+#elif (defined(CONFIG_IDF_TARGET_ESP32) || defined(CONFIG_IDF_TARGET_ESP32S3)) && __has_include(<dsps_mulc.h>)
+// esp-dsp's hand-written Xtensa loops, from the IDF component manager (see idf_component.yml).
+#include <dsps_add.h>
+#include <dsps_mulc.h>
+#define AIRPLAY_DSP_ESP_DSP
+#endif
+
+namespace esphome {
+namespace airplay_bridge {
+namespace dsp {
+
+// Truncates, as an arithmetic shift does, which is what esp-dsp's dsps_mulc_s16() does on the device.
+static inline int16_t scale_q15(int16_t sample, int32_t gain) {
+  const int32_t scaled = (static_cast<int32_t>(sample) * gain) >> 15;
+  return static_cast<int16_t>(scaled > 32767 ? 32767 : scaled);
+}
+
+// Moves `gain` towards `target`, scaling a frame per step, and returns how many frames that took. The
+// backends' gain_ramp_stereo_q15() run their gain_stereo_q15() over the rest at the final gain.
+static size_t ramp_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step) {
+  size_t i = 0;
+  for (; i < frames && gain != target; i++) {
+    const int32_t delta = target - gain;
+    gain += delta > step ? step : (delta < -step ? -step : delta);
+    samples[i * 2] = scale_q15(samples[i * 2], gain);
+    samples[i * 2 + 1] = scale_q15(samples[i * 2 + 1], gain);
+  }
+  return i;
+}
+
+namespace scalar {
+
+static void fir_stereo_q15(const int16_t *window, const int16_t *coefficients, size_t taps, int32_t &left,
+                           int32_t &right) {
+  int32_t l = 0;
+  int32_t r = 0;
+  for (size_t j = 0; j < taps; j++) {
+    l += static_cast<int32_t>(window[j * 2]) * coefficients[j];
+    r += static_cast<int32_t>(window[j * 2 + 1]) * coefficients[j];
+  }
+  left += l;
+  right += r;
+}
+
+static void gain_stereo_q15(int16_t *samples, size_t frames, int16_t gain) {
+  for (size_t i = 0; i < frames * 2; i++) {
+    samples[i] = scale_q15(samples[i], gain);
+  }
+}
+
+static void gain_ramp_stereo_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step) {
+  const size_t ramped = ramp_q15(samples, frames, gain, target, step);
+  gain_stereo_q15(samples + ramped * 2, frames - ramped, static_cast<int16_t>(gain));
+}
+
+static void downmix_to_mono(const int16_t *stereo, int16_t *mono, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    mono[i] = static_cast<int16_t>((static_cast<int32_t>(stereo[i * 2]) + stereo[i * 2 + 1]) >> 1);
+  }
+}
+
+static void widen_to_int32(const int16_t *in, int32_t *out, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    out[i] = static_cast<int32_t>(static_cast<uint32_t>(static_cast<int32_t>(in[i])) << 16);
+  }
+}
+
+static void from_big_endian_16(const uint8_t *in, int16_t *out, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    out[i] = static_cast<int16_t>((static_cast<uint16_t>(in[i * 2]) << 8) | in[i * 2 + 1]);
+  }
+}
+
+static void widen_to_int24(const int16_t *in, uint8_t *out, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    const uint16_t value = static_cast<uint16_t>(in[i]);
+    out[i * 3] = 0;
+    out[i * 3 + 1] = static_cast<uint8_t>(value);
+    out[i * 3 + 2] = static_cast<uint8_t>(value >> 8);
+  }
+}
+
+}  // namespace scalar
+
+// The other backends handle whole vectors and leave the remaining tail to the scalar loops. A kernel they
+// have no faster form of is the scalar one in their table row.
+
+#if defined(AIRPLAY_DSP_SSE2)
+
+namespace sse2 {
+
+static void fir_stereo_q15(const int16_t *window, const int16_t *coefficients, size_t taps, int32_t &left,
+                           int32_t &right) {
+  __m128i acc = _mm_setzero_si128();
+  size_t j = 0;
+  for (; j + 4 <= taps; j += 4) {
+    // L0 R0 L1 R1 L2 R2 L3 R3 -> L0 L1 R0 R1 L2 L3 R2 R3, against c0 c1 c0 c1 c2 c3 c2 c3.
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(window + j * 2));
+    w = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i c = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(coefficients + j));
+    const __m128i pairs = _mm_unpacklo_epi32(c, c);
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(w, pairs));
+  }
+  // Lanes hold L, R, L, R partial sums.
+  alignas(16) int32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+  left += lanes[0] + lanes[2];
+  right += lanes[1] + lanes[3];
+  scalar::fir_stereo_q15(window + j * 2, coefficients + j, taps - j, left, right);
+}
+
+static void gain_stereo_q15(int16_t *samples, size_t frames, int16_t gain) {
+  const size_t count = frames * 2;
+  const __m128i g = _mm_set1_epi16(gain);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i));
+    // The low and high halves of each 32-bit product, interleaved back into whole products.
+    const __m128i lo = _mm_mullo_epi16(x, g);
+    const __m128i hi = _mm_mulhi_epi16(x, g);
+    const __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+    const __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(samples + i), _mm_packs_epi32(p0, p1));
+  }
+  scalar::gain_stereo_q15(samples + i, (count - i) / 2, gain);
+}
+
+static void gain_ramp_stereo_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step) {
+  const size_t ramped = ramp_q15(samples, frames, gain, target, step);
+  gain_stereo_q15(samples + ramped * 2, frames - ramped, static_cast<int16_t>(gain));
+}
+
+static void downmix_to_mono(const int16_t *stereo, int16_t *mono, size_t frames) {
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    // Each 32-bit lane is one frame: L in the low half, R in the high half. Both loads come before the
+    // store, so running in place only ever overwrites frames already read.
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(stereo + i * 2));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(stereo + i * 2 + 8));
+    const __m128i sum_a = _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(a, 16));
+    const __m128i sum_b = _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(b, 16), 16), _mm_srai_epi32(b, 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(mono + i),
+                     _mm_packs_epi32(_mm_srai_epi32(sum_a, 1), _mm_srai_epi32(sum_b, 1)));
+  }
+  scalar::downmix_to_mono(stereo + i * 2, mono + i, frames - i);
+}
+
+static void widen_to_int32(const int16_t *in, int32_t *out, size_t samples) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_unpacklo_epi16(zero, x));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 4), _mm_unpackhi_epi16(zero, x));
+  }
+  scalar::widen_to_int32(in + i, out + i, samples - i);
+}
+
+static void from_big_endian_16(const uint8_t *in, int16_t *out, size_t samples) {
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+  }
+  scalar::from_big_endian_16(in + i * 2, out + i, samples - i);
+}
+
+}  // namespace sse2
+
+static const Backend BACKENDS[] = {
+    {"sse2", sse2::fir_stereo_q15, sse2::gain_stereo_q15, sse2::gain_ramp_stereo_q15, sse2::downmix_to_mono,
+     sse2::widen_to_int32, scalar::widen_to_int24, sse2::from_big_endian_16},
+    {"scalar", scalar::fir_stereo_q15, scalar::gain_stereo_q15, scalar::gain_ramp_stereo_q15,
+     scalar::downmix_to_mono, scalar::widen_to_int32, scalar::widen_to_int24, scalar::from_big_endian_16},
+};
+
+#elif defined(AIRPLAY_DSP_ESP_DSP)
+
+namespace esp_dsp {
+
+// esp-dsp has no 32-bit accumulating dot product (dsps_dotprod_s16() shifts its sum back down to 16 bits),
+// and nothing for the conversions, so the FIR and those stay scalar.
+
+static void gain_stereo_q15(int16_t *samples, size_t frames, int16_t gain) {
+  // (x * gain) >> 15 per sample, in place. At most unity gain, so it cannot overflow.
+  dsps_mulc_s16(samples, samples, static_cast<int>(frames * 2), gain, 1, 1);
+}
+
+static void gain_ramp_stereo_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step) {
+  const size_t ramped = ramp_q15(samples, frames, gain, target, step);
+  if (ramped < frames) {
+    gain_stereo_q15(samples + ramped * 2, frames - ramped, static_cast<int16_t>(gain));
+  }
+}
+
+static void downmix_to_mono(const int16_t *stereo, int16_t *mono, size_t frames) {
+  // (L + R) >> 1, with L and R read two samples apart. Frame i is written to sample i, at or before where
+  // it was read, so this works in place.
+  dsps_add_s16(stereo, stereo + 1, mono, static_cast<int>(frames), 2, 2, 1, 1);
+}
+
+}  // namespace esp_dsp
+
+static const Backend BACKENDS[] = {
+    {"esp-dsp", scalar::fir_stereo_q15, esp_dsp::gain_stereo_q15, esp_dsp::gain_ramp_stereo_q15,
+     esp_dsp::downmix_to_mono, scalar::widen_to_int32, scalar::widen_to_int24, scalar::from_big_endian_16},
+    {"scalar", scalar::fir_stereo_q15, scalar::gain_stereo_q15, scalar::gain_ramp_stereo_q15,
+     scalar::downmix_to_mono, scalar::widen_to_int32, scalar::widen_to_int24, scalar::from_big_endian_16},
+};
+
+#else
+
+static const Backend BACKENDS[] = {
+    {"scalar", scalar::fir_stereo_q15, scalar::gain_stereo_q15, scalar::gain_ramp_stereo_q15,
+     scalar::downmix_to_mono, scalar::widen_to_int32, scalar::widen_to_int24, scalar::from_big_endian_16},
+};
+
+#endif
+
+const Backend *backends(size_t &count) {
+  count = sizeof(BACKENDS) / sizeof(BACKENDS[0]);
+  return BACKENDS;
+}
+
+void fir_stereo_q15(const int16_t *window, const int16_t *coefficients, size_t taps, int32_t &left,
+                    int32_t &right) {
+  BACKENDS[0].fir_stereo_q15(window, coefficients, taps, left, right);
+}
+
+void gain_stereo_q15(int16_t *samples, size_t frames, int16_t gain) {
+  BACKENDS[0].gain_stereo_q15(samples, frames, gain);
+}
+
+void gain_ramp_stereo_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step) {
+  BACKENDS[0].gain_ramp_stereo_q15(samples, frames, gain, target, step);
+}
+
+void downmix_to_mono(const int16_t *stereo, int16_t *mono, size_t frames) {
+  BACKENDS[0].downmix_to_mono(stereo, mono, frames);
+}
+
+void widen_to_int32(const int16_t *in, int32_t *out, size_t samples) {
+  BACKENDS[0].widen_to_int32(in, out, samples);
+}
+
+void from_big_endian_16(const uint8_t *in, int16_t *out, size_t samples) {
+  BACKENDS[0].from_big_endian_16(in, out, samples);
+}
+
+void widen_to_int24(const int16_t *in, uint8_t *out, size_t samples) {
+  BACKENDS[0].widen_to_int24(in, out, samples);
+}
+
+}  // namespace dsp
+}  // namespace airplay_bridge
+}  // namespace esphome
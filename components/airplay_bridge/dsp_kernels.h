@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Per-sample kernels for the audio path.
+///
+/// Each kernel has a portable scalar version. Builds for an SSE2 host (any x86-64) add an SSE2 backend, and
+/// ESP32 and ESP32-S3 builds an esp-dsp one, which runs the gain and the downmix through esp-dsp's
+/// Xtensa loops and the rest through the scalar ones. The functions in `dsp` call the first backend in
+/// backends(). Every backend produces bit-identical output to the scalar one, which
+/// tests/dsp_kernels_test.cpp checks for each backend compiled in; that is why the Q15 gain truncates, as
+/// dsps_mulc_s16() does, rather than rounding.
+/// Buffers are interleaved 16-bit stereo unless a name says otherwise.
+namespace dsp {
+
+/// Adds the dot products of `taps` stereo frames with one row of Q15 coefficients to `left` and `right`.
+void fir_stereo_q15(const int16_t *window, const int16_t *coefficients, size_t taps, int32_t &left,
+                    int32_t &right);
+/// Scales `frames` stereo frames in place by a Q15 gain (32767 is unity), rounding towards minus infinity.
+void gain_stereo_q15(int16_t *samples, size_t frames, int16_t gain);
+/// Like gain_stereo_q15(), but first moves `gain` towards `target` by at most `step` per frame, so changes
+/// ramp in without zipper noise. `gain` is updated to where the ramp got to.
+void gain_ramp_stereo_q15(int16_t *samples, size_t frames, int32_t &gain, int32_t target, int32_t step);
+/// Averages each stereo frame into one mono sample, rounding down. `mono` may be the same buffer as
+/// `stereo`.
+void downmix_to_mono(const int16_t *stereo, int16_t *mono, size_t frames);
+/// Widens 16-bit samples to the top of 32-bit ones. `out` must not overlap `in`.
+void widen_to_int32(const int16_t *in, int32_t *out, size_t samples);
+/// Reads big-endian 16-bit samples (RTP L16) into native ones. `out` may not overlap `in`.
+void from_big_endian_16(const uint8_t *in, int16_t *out, size_t samples);
+/// Widens 16-bit samples to packed little-endian 24-bit ones, three bytes each. `out` must not overlap `in`.
+void widen_to_int24(const int16_t *in, uint8_t *out, size_t samples);
+
+/// One implementation of every kernel above.
+struct Backend {
+  const char *name;
+  void (*fir_stereo_q15)(const int16_t *, const int16_t *, size_t, int32_t &, int32_t &);
+  void (*gain_stereo_q15)(int16_t *, size_t, int16_t);
+  void (*gain_ramp_stereo_q15)(int16_t *, size_t, int32_t &, int32_t, int32_t);
+  void (*downmix_to_mono)(const int16_t *, int16_t *, size_t);
+  void (*widen_to_int32)(const int16_t *, int32_t *, size_t);
+  void (*widen_to_int24)(const int16_t *, uint8_t *, size_t);
+  void (*from_big_endian_16)(const uint8_t *, int16_t *, size_t);
+};
+
+/// Every backend compiled into this build, the one the `dsp` functions use first and "scalar" last.
+const Backend *backends(size_t &count);
+
+}  // namespace dsp
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,318 @@
+#include "http_stream.h"
+
+#ifdef USE_ESP_IDF
+
+#include "rtsp_parser.h"
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace esphome {
+namespace airplay_bridge {
+
+static const char *const TAG = "airplay_bridge";
+
+static const char *const STREAM_PREFIX = "/airplay/";
+// A client that has not sent a complete request by then is dropped.
+static const uint32_t REQUEST_TIMEOUT_MS = 5000;
+// Stereo 16-bit frames; listeners skip ahead in whole frames.
+static const uint32_t FRAME_BYTES = 4;
+static const uint32_t STREAM_SAMPLE_RATE = 44100;
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+static void set_non_blocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags >= 0) {
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+}
+
+static void append_le(std::string &out, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+  }
+}
+
+// A WAV header for a stream of unknown length: both sizes are left at their maximum, which players read
+// as "until the connection closes".
+static void append_wav_header(std::string &out) {
+  out += "RIFF";
+  append_le(out, 0xFFFFFFFF, 4);
+  out += "WAVEfmt ";
+  append_le(out, 16, 4);
+  append_le(out, 1, 2);  // PCM
+  append_le(out, 2, 2);
+  append_le(out, STREAM_SAMPLE_RATE, 4);
+  append_le(out, STREAM_SAMPLE_RATE * FRAME_BYTES, 4);
+  append_le(out, FRAME_BYTES, 2);
+  append_le(out, 16, 2);
+  out += "data";
+  append_le(out, 0xFFFFFFFF, 4);
+}
+
+static std::string percent_decode(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '%' && i + 2 < text.size()) {
+      const char hex[3] = {text[i + 1], text[i + 2], '\0'};
+      char *end = nullptr;
+      const long value = strtol(hex, &end, 16);
+      if (end == hex + 2) {
+        out.push_back(static_cast<char>(value));
+        i += 2;
+        continue;
+      }
+    }
+    out.push_back(text[i] == '+' ? ' ' : text[i]);
+  }
+  return out;
+}
+
+bool HttpStreamServer::start(uint16_t port, size_t max_clients, SocketMux *sockets) {
+  this->sockets_ = sockets;
+  this->port_ = port;
+  this->max_clients_ = max_clients;
+  this->server_fd_ = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+  if (this->server_fd_ < 0) {
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(this->server_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in bind_addr{};
+  bind_addr.sin_family = AF_INET;
+  bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  bind_addr.sin_port = htons(port);
+  if (bind(this->server_fd_, reinterpret_cast<sockaddr *>(&bind_addr), sizeof(bind_addr)) < 0 ||
+      listen(this->server_fd_, 2) < 0) {
+    close(this->server_fd_);
+    this->server_fd_ = -1;
+    return false;
+  }
+  set_non_blocking(this->server_fd_);
+  this->sockets_->add(this->server_fd_);
+  return true;
+}
+
+void HttpStreamServer::add_stream(const std::string &name, const StreamRing *ring) {
+  Stream stream;
+  stream.name = name;
+  stream.ring = ring;
+  this->streams_.push_back(std::move(stream));
+}
+
+void HttpStreamServer::loop() {
+  if (this->server_fd_ < 0) {
+    return;
+  }
+  if (this->sockets_->ready(this->server_fd_)) {
+    this->accept_clients_();
+  }
+  for (size_t i = 0; i < this->clients_.size();) {
+    Client &client = this->clients_[i];
+    const bool keep = client.responded ? this->send_pending_(client) : this->read_request_(client);
+    if (keep) {
+      i++;
+      continue;
+    }
+    if (client.stream >= 0) {
+      ESP_LOGD(TAG, "HTTP listener left '%s'", this->streams_[client.stream].name.c_str());
+    }
+    this->sockets_->remove(client.fd);
+    close(client.fd);
+    this->clients_.erase(this->clients_.begin() + i);
+  }
+}
+
+void HttpStreamServer::accept_clients_() {
+  while (true) {
+    sockaddr_in addr{};
+    socklen_t addr_len = sizeof(addr);
+    const int fd = accept(this->server_fd_, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+    if (fd < 0) {
+      return;
+    }
+    if (this->clients_.size() >= this->max_clients_) {
+      // Best effort; the socket is closed either way.
+      static const char BUSY[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      send(fd, BUSY, sizeof(BUSY) - 1, MSG_DONTWAIT);
+      close(fd);
+      ESP_LOGW(TAG, "HTTP stream: refusing a listener, already serving %u", static_cast<unsigned>(this->max_clients_));
+      continue;
+    }
+    set_non_blocking(fd);
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    Client client;
+    client.fd = fd;
+    client.connected_ms = millis();
+    this->sockets_->add(fd);
+    this->clients_.push_back(std::move(client));
+  }
+}
+
+bool HttpStreamServer::read_request_(Client &client) {
+  if (!this->sockets_->ready(client.fd)) {
+    return millis() - client.connected_ms < REQUEST_TIMEOUT_MS;
+  }
+  char buf[256];
+  while (true) {
+    const ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+    if (len == 0) {
+      return false;
+    }
+    if (len < 0) {
+      return would_block() && millis() - client.connected_ms < REQUEST_TIMEOUT_MS;
+    }
+    client.request.append(buf, static_cast<size_t>(len));
+    if (client.request.size() > MAX_REQUEST) {
+      return false;
+    }
+    if (client.request.find("\r\n\r\n") != std::string::npos) {
+      break;
+    }
+  }
+  // Request line: METHOD SP path SP version. Nothing in the headers matters here.
+  std::string_view text = client.request;
+  const std::string_view line = next_line(text);
+  const size_t method_end = line.find(' ');
+  const size_t path_end = line.find(' ', method_end == std::string_view::npos ? line.size() : method_end + 1);
+  if (method_end == std::string_view::npos || path_end == std::string_view::npos) {
+    return false;
+  }
+  const std::string_view method = line.substr(0, method_end);
+  const std::string_view path = line.substr(method_end + 1, path_end - method_end - 1);
+  this->start_response_(client, method, path);
+  client.responded = true;
+  client.request.clear();
+  client.request.shrink_to_fit();
+  return true;
+}
+
+void HttpStreamServer::start_response_(Client &client, std::string_view method, std::string_view path) {
+  const bool head = method == "HEAD";
+  if (method != "GET" && !head) {
+    client.header =
+        "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    return;
+  }
+  const int stream = this->find_stream_(path);
+  if (stream < 0) {
+    client.header = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    return;
+  }
+  // No length and no chunking: the body runs until either side closes, which every player handles.
+  client.header = "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: audio/wav\r\n"
+                  "Cache-Control: no-cache, no-store\r\n"
+                  "Connection: close\r\n\r\n";
+  if (head) {
+    return;
+  }
+  append_wav_header(client.header);
+  client.stream = stream;
+  client.pos = this->streams_[stream].ring->head();
+  ESP_LOGD(TAG, "HTTP listener joined '%s'", this->streams_[stream].name.c_str());
+}
+
+bool HttpStreamServer::send_pending_(Client &client) {
+  // Players send nothing after the request; reading only notices when they hang up.
+  if (this->sockets_->ready(client.fd)) {
+    char sink[64];
+    const ssize_t len = recv(client.fd, sink, sizeof(sink), 0);
+    if (len == 0 || (len < 0 && !would_block())) {
+      return false;
+    }
+  }
+  while (client.header_sent < client.header.size()) {
+    const ssize_t sent =
+        send(client.fd, client.header.data() + client.header_sent, client.header.size() - client.header_sent, 0);
+    if (sent < 0) {
+      return would_block();
+    }
+    client.header_sent += static_cast<size_t>(sent);
+  }
+  if (client.stream < 0) {
+    // An error or HEAD response, and it has all been sent.
+    return false;
+  }
+  if (!client.header.empty()) {
+    client.header.clear();
+    client.header.shrink_to_fit();
+    client.header_sent = 0;
+  }
+  Stream &stream = this->streams_[client.stream];
+  while (true) {
+    const size_t available =
+        stream.ring->copy(client.pos, this->send_buffer_, SEND_CHUNK, FRAME_BYTES, stream.skipped_bytes);
+    if (available == 0) {
+      return true;
+    }
+    const ssize_t sent = send(client.fd, this->send_buffer_, available, 0);
+    if (sent < 0) {
+      return would_block();
+    }
+    client.pos += static_cast<uint32_t>(sent);
+    stream.sent_bytes += static_cast<uint64_t>(sent);
+    if (static_cast<size_t>(sent) < available) {
+      return true;
+    }
+  }
+}
+
+int HttpStreamServer::find_stream_(std::string_view path) const {
+  const size_t query = path.find('?');
+  if (query != std::string_view::npos) {
+    path = path.substr(0, query);
+  }
+  const size_t prefix_len = strlen(STREAM_PREFIX);
+  if (path.substr(0, prefix_len) != STREAM_PREFIX) {
+    return -1;
+  }
+  // Anything after the target name, such as the session, is accepted and ignored so that players can
+  // reconnect to the same URL across sessions.
+  path.remove_prefix(prefix_len);
+  const std::string name = percent_decode(path.substr(0, path.find('/')));
+  for (size_t i = 0; i < this->streams_.size(); i++) {
+    if (iequals(this->streams_[i].name, name)) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void HttpStreamServer::stream_stats(const std::string &name, uint32_t &listeners, uint64_t &sent,
+                                    uint64_t &skipped) const {
+  listeners = 0;
+  sent = 0;
+  skipped = 0;
+  for (size_t i = 0; i < this->streams_.size(); i++) {
+    if (this->streams_[i].name != name) {
+      continue;
+    }
+    sent = this->streams_[i].sent_bytes;
+    skipped = this->streams_[i].skipped_bytes;
+    for (const auto &client : this->clients_) {
+      if (client.stream == static_cast<int>(i)) {
+        listeners++;
+      }
+    }
+  }
+}
+
+}  // namespace airplay_bridge
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+
+#include "socket_mux.h"
+#include "stream_ring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Serves each target's decoded audio as an endless WAV stream over HTTP, at `/airplay/<target>[/...]`.
+///
+/// Everything runs from the main loop on non-blocking sockets. A listener owns no audio memory: it only
+/// keeps a position in the target's StreamRing, and audio goes out through one SEND_CHUNK buffer shared
+/// by all listeners. One that cannot keep up skips ahead instead of growing a backlog. Per connection
+/// that leaves the request buffer, capped at MAX_REQUEST bytes, and the response header.
+///
+/// This is not zero-copy: every chunk is copied out of the ring into the shared 2 KB buffer before it is
+/// sent, once per listener, because the audio task may overwrite the ring while send() reads from it.
+class HttpStreamServer {
+ public:
+  static constexpr size_t MAX_REQUEST = 1024;
+  static constexpr size_t SEND_CHUNK = 2048;
+
+  /// Opens the listening socket. Returns false if the port cannot be bound. Sockets are watched through
+  /// `sockets`, which the owner polls before each loop().
+  bool start(uint16_t port, size_t max_clients, SocketMux *sockets);
+  bool started() const { return this->server_fd_ >= 0; }
+  uint16_t port() const { return this->port_; }
+
+  /// Registers a stream of 44.1 kHz 16-bit stereo under `name`. The ring must outlive the server.
+  void add_stream(const std::string &name, const StreamRing *ring);
+
+  /// Accepts, reads requests and sends whatever audio each listener has not had yet.
+  void loop();
+
+  size_t client_count() const { return this->clients_.size(); }
+  /// Listeners, bytes sent and bytes skipped by slow listeners for the stream called `name`.
+  void stream_stats(const std::string &name, uint32_t &listeners, uint64_t &sent, uint64_t &skipped) const;
+
+ protected:
+  struct Stream {
+    std::string name;
+    const StreamRing *ring;
+    uint64_t sent_bytes{0};
+    uint64_t skipped_bytes{0};
+  };
+
+  struct Client {
+    int fd{-1};
+    uint32_t connected_ms{0};
+    std::string request;
+    bool responded{false};
+    // Response header (and WAV header) still to send, then audio from `stream` at `pos`.
+    std::string header;
+    size_t header_sent{0};
+    int stream{-1};
+    uint32_t pos{0};
+  };
+
+  void accept_clients_();
+  bool read_request_(Client &client);
+  void start_response_(Client &client, std::string_view method, std::string_view path);
+  bool send_pending_(Client &client);
+  int find_stream_(std::string_view path) const;
+
+  SocketMux *sockets_{nullptr};
+  int server_fd_{-1};
+  uint16_t port_{0};
+  size_t max_clients_{4};
+  std::vector<Stream> streams_;
+  std::vector<Client> clients_;
+  // Audio is copied out of the ring and checked before it is sent, since the audio task keeps writing.
+  uint8_t send_buffer_[SEND_CHUNK];
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,270 @@
+#include "jitter_buffer.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace airplay_bridge {
+
+static const size_t RTP_HEADER_SIZE = 12;
+static const size_t SPARE_SLOTS = 4;
+
+static inline uint16_t read_u16(const uint8_t *p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+static inline uint32_t read_u32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+void JitterBuffer::allocate(size_t slot_count, size_t max_packet_size) {
+  size_t count = 4;
+  while (count < slot_count) {
+    count <<= 1;
+  }
+  this->slots_.reset(new Slot[count]);
+  this->storage_.reset(new uint8_t[count * max_packet_size]);
+  this->slot_count_ = count;
+  this->max_packet_size_ = max_packet_size;
+  this->reset();
+}
+
+void JitterBuffer::set_latency(uint32_t latency_frames, uint32_t sample_rate) {
+  this->sample_rate_ = sample_rate;
+  this->latency_us_ = static_cast<int64_t>(latency_frames) * 1000000 / sample_rate;
+  this->set_rate_trim(this->rate_trim_ppm_);
+}
+
+void JitterBuffer::set_rate_trim(float ppm) {
+  if (this->anchored_ && !this->timeline_pinned_) {
+    // Re-anchor at the last released packet so the trim only bends the timeline from here on.
+    const uint32_t timestamp = this->have_last_ ? this->last_timestamp_ : this->anchor_timestamp_;
+    this->anchor_us_ = this->playout_time_(timestamp);
+    this->anchor_timestamp_ = timestamp;
+  }
+  this->rate_trim_ppm_ = ppm;
+  const double rate = this->timeline_pinned_ ? 1.0 : 1.0 + ppm * 1e-6;
+  this->us_per_frame_ = 1000000.0 / (this->sample_rate_ * rate);
+}
+
+void JitterBuffer::reset() {
+  for (size_t i = 0; i < this->slot_count_; i++) {
+    this->slots_[i].valid = false;
+    this->slots_[i].requested = false;
+  }
+  this->held_ = 0;
+  this->late_run_ = 0;
+  this->gap_pending_ = false;
+  this->anchored_ = false;
+  this->have_last_ = false;
+  this->flushing_ = false;
+}
+
+void JitterBuffer::set_timeline(uint32_t timestamp, int64_t local_us, uint32_t sender_latency_frames) {
+  if (sender_latency_frames > this->max_latency_frames()) {
+    const int64_t sender_latency_us = static_cast<int64_t>(sender_latency_frames) * 1000000 / this->sample_rate_;
+    if (sender_latency_us > this->latency_us_) {
+      local_us -= sender_latency_us - this->latency_us_;
+    }
+  }
+  this->timeline_pinned_ = true;
+  this->anchor_timestamp_ = timestamp;
+  this->anchor_us_ = local_us;
+  this->us_per_frame_ = 1000000.0 / this->sample_rate_;
+}
+
+uint32_t JitterBuffer::max_latency_frames() const {
+  // Keep a few slots spare for network jitter and packets waiting on a retransmission.
+  if (this->slot_count_ <= SPARE_SLOTS) {
+    return 0;
+  }
+  return static_cast<uint32_t>(this->slot_count_ - SPARE_SLOTS) * this->frames_per_packet_;
+}
+
+void JitterBuffer::clear_timeline() {
+  this->timeline_pinned_ = false;
+  this->set_rate_trim(this->rate_trim_ppm_);
+}
+
+void JitterBuffer::flush(uint32_t timestamp) {
+  this->reset();
+  // The sender re-pins the timeline with its next sync packet; until then the first packet anchors it.
+  this->clear_timeline();
+  this->flushing_ = true;
+  this->flush_timestamp_ = timestamp;
+}
+
+void JitterBuffer::anchor_(uint16_t seq, uint32_t timestamp, int64_t now_us) {
+  this->anchored_ = true;
+  this->next_seq_ = seq;
+  this->newest_seq_ = seq;
+  this->newest_timestamp_ = timestamp;
+  this->first_timestamp_ = timestamp;
+  if (!this->timeline_pinned_) {
+    this->anchor_timestamp_ = timestamp;
+    this->anchor_us_ = now_us + this->latency_us_;
+  }
+  this->have_last_ = false;
+}
+
+int64_t JitterBuffer::playout_time_(uint32_t timestamp) const {
+  // Signed difference so that timestamps just before the anchor (reordered first packets) still work.
+  const int32_t delta = static_cast<int32_t>(timestamp - this->anchor_timestamp_);
+  return this->anchor_us_ + static_cast<int64_t>(delta * this->us_per_frame_);
+}
+
+int64_t JitterBuffer::buffered_us(int64_t now_us) const {
+  if (!this->anchored_ || this->held_ == 0) {
+    return 0;
+  }
+  return this->playout_time_(this->newest_timestamp_) - now_us;
+}
+
+bool JitterBuffer::insert(const uint8_t *packet, size_t len, int64_t now_us) {
+  if (len < RTP_HEADER_SIZE || len > this->max_packet_size_ || this->slot_count_ == 0) {
+    return false;
+  }
+  const uint16_t seq = read_u16(packet + 2);
+  const uint32_t timestamp = read_u32(packet + 4);
+  this->stats_.received++;
+
+  if (this->flushing_) {
+    if (static_cast<int32_t>(timestamp - this->flush_timestamp_) < 0) {
+      this->stats_.flushed++;
+      return false;
+    }
+    this->flushing_ = false;
+  }
+
+  if (!this->anchored_) {
+    this->anchor_(seq, timestamp, now_us);
+  }
+
+  const int16_t ahead = static_cast<int16_t>(seq - this->next_seq_);
+  if (ahead < 0) {
+    // A late retransmission now and then is normal. A whole buffer's worth in a row means the sender's
+    // sequence numbers went backwards, after a restart without a FLUSH, and would not catch up for minutes.
+    if (++this->late_run_ < this->slot_count_) {
+      this->stats_.late++;
+      return false;
+    }
+    this->stats_.resyncs++;
+    this->reset();
+    this->anchor_(seq, timestamp, now_us);
+  } else if (static_cast<size_t>(ahead) >= this->slot_count_) {
+    // Too far ahead to hold: the sender has jumped (or we stalled), so start over from this packet.
+    this->stats_.resyncs++;
+    this->reset();
+    this->anchor_(seq, timestamp, now_us);
+  }
+  this->late_run_ = 0;
+
+  const size_t index = seq & (this->slot_count_ - 1);
+  Slot &slot = this->slots_[index];
+  if (slot.valid) {
+    this->stats_.duplicates++;
+    return false;
+  }
+  const int16_t past_newest = static_cast<int16_t>(seq - this->newest_seq_);
+  if (slot.requested) {
+    this->stats_.resend_satisfied++;
+    slot.requested = false;
+  } else if (past_newest < 0) {
+    this->stats_.reordered++;
+  }
+  if (past_newest >= 0) {
+    if (past_newest > 1) {
+      this->stats_.gaps++;
+      this->gap_pending_ = true;
+      this->gap_first_ = static_cast<uint16_t>(this->newest_seq_ + 1);
+      this->gap_count_ = static_cast<uint16_t>(past_newest - 1);
+      this->gap_deadline_us_ =
+          this->playout_time_(timestamp - static_cast<uint32_t>(past_newest - 1) * this->frames_per_packet_);
+    }
+    this->newest_seq_ = seq;
+    this->newest_timestamp_ = timestamp;
+  }
+
+  memcpy(this->slot_data_(index), packet, len);
+  slot.valid = true;
+  slot.seq = seq;
+  slot.timestamp = timestamp;
+  slot.len = static_cast<uint16_t>(len);
+  this->held_++;
+  return true;
+}
+
+JitterBuffer::PopResult JitterBuffer::pop(int64_t now_us, const uint8_t *&data, size_t &len, uint16_t &seq) {
+  if (!this->anchored_ || this->held_ == 0) {
+    return PopResult::EMPTY;
+  }
+  const size_t index = this->next_seq_ & (this->slot_count_ - 1);
+  const Slot &slot = this->slots_[index];
+  if (slot.valid) {
+    if (this->playout_time_(slot.timestamp) > now_us) {
+      return PopResult::EMPTY;
+    }
+    data = this->slot_data_(index);
+    len = slot.len;
+    seq = slot.seq;
+    return PopResult::PACKET;
+  }
+
+  // The next packet is missing but a later one is waiting. Give up on it once it would have been due.
+  const uint32_t expected_timestamp =
+      this->have_last_ ? this->last_timestamp_ + this->frames_per_packet_ : this->first_timestamp_;
+  if (this->playout_time_(expected_timestamp) > now_us) {
+    return PopResult::EMPTY;
+  }
+  seq = this->next_seq_;
+  this->stats_.lost++;
+  this->slots_[index].requested = false;
+  this->last_timestamp_ = expected_timestamp;
+  this->have_last_ = true;
+  this->next_seq_++;
+  return PopResult::LOST;
+}
+
+void JitterBuffer::release() {
+  const size_t index = this->next_seq_ & (this->slot_count_ - 1);
+  Slot &slot = this->slots_[index];
+  if (!slot.valid) {
+    return;
+  }
+  if (this->have_last_) {
+    const uint32_t frames = slot.timestamp - this->last_timestamp_;
+    if (frames > 0 && frames <= 4096) {
+      this->frames_per_packet_ = frames;
+    }
+  }
+  this->last_timestamp_ = slot.timestamp;
+  this->have_last_ = true;
+  slot.valid = false;
+  this->held_--;
+  this->next_seq_++;
+}
+
+bool JitterBuffer::take_gap(uint16_t &first, uint16_t &count, int64_t &deadline_us) {
+  if (!this->gap_pending_) {
+    return false;
+  }
+  this->gap_pending_ = false;
+  first = this->gap_first_;
+  count = this->gap_count_;
+  deadline_us = this->gap_deadline_us_;
+  return true;
+}
+
+void JitterBuffer::mark_requested(uint16_t first, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    const uint16_t seq = static_cast<uint16_t>(first + i);
+    if (static_cast<uint16_t>(seq - this->next_seq_) >= this->slot_count_) {
+      continue;
+    }
+    Slot &slot = this->slots_[seq & (this->slot_count_ - 1)];
+    if (!slot.valid) {
+      slot.requested = true;
+      this->stats_.resend_requested++;
+    }
+  }
+}
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Reorders RTP packets by sequence number and releases them at their RTP timestamp.
+///
+/// The first packet of a stream anchors the RTP timeline to the local clock, delayed by the configured
+/// latency, unless the timeline has been pinned explicitly from sender clock sync. Every later packet is
+/// released when its timestamp comes due on that timeline. Packets that arrive late or twice are dropped.
+/// One too far ahead to fit, or the last of a slot_count() run of late ones, means the sender jumped, and
+/// the buffer starts over from it. A missing packet is given up on once its own playout time has passed
+/// and a later packet is already waiting, which leaves the whole latency window for a retransmission to
+/// arrive.
+///
+/// All times are in microseconds on a caller-supplied monotonic clock, which keeps the class free of
+/// platform dependencies.
+class JitterBuffer {
+ public:
+  enum class PopResult : uint8_t {
+    EMPTY,   // nothing due yet
+    PACKET,  // `data`/`len` point at the next packet; call release() when done with it
+    LOST,    // the next packet never arrived in time; `seq` says which one
+  };
+
+  struct Stats {
+    uint32_t received{0};
+    uint32_t reordered{0};
+    uint32_t duplicates{0};
+    uint32_t late{0};
+    uint32_t lost{0};
+    uint32_t resyncs{0};
+    uint32_t flushed{0};
+    uint32_t gaps{0};
+    uint32_t resend_requested{0};
+    uint32_t resend_satisfied{0};
+  };
+
+  /// Allocates storage for `slot_count` packets (rounded up to a power of two) of up to `max_packet_size`
+  /// bytes each.
+  void allocate(size_t slot_count, size_t max_packet_size);
+  /// Sets the delay between a stream's first packet arriving and its playout.
+  void set_latency(uint32_t latency_frames, uint32_t sample_rate);
+  /// Drops all packets and waits for a new first packet. A pinned timeline is kept.
+  void reset();
+  /// Pins the RTP timeline to the local clock: `timestamp` plays at `local_us`. `sender_latency_frames`
+  /// is how long before its playout the sender transmits a packet. When that is more than the slots can
+  /// hold, the timeline is moved earlier so that packets play the configured latency after they arrive
+  /// instead; otherwise every packet would land too far ahead and force a resync.
+  void set_timeline(uint32_t timestamp, int64_t local_us, uint32_t sender_latency_frames = 0);
+  /// Largest sender latency that set_timeline() keeps as is.
+  uint32_t max_latency_frames() const;
+  /// Goes back to anchoring the timeline on the first packet.
+  void clear_timeline();
+  /// Drops every held packet, and any that still arrive timestamped before `timestamp`, then anchors a
+  /// new timeline on the first packet at or after it. For a FLUSH, where the sender skips to a new position.
+  void flush(uint32_t timestamp);
+  bool timeline_pinned() const { return this->timeline_pinned_; }
+  /// Speeds up (positive) or slows down the first-packet timeline by `ppm`, so that playout can follow a
+  /// sender whose clock runs at a slightly different rate. Ignored while the timeline is pinned, since
+  /// sync packets then carry the sender's rate already.
+  void set_rate_trim(float ppm);
+
+  /// Stores one RTP packet (header included). Returns false if the packet was dropped.
+  bool insert(const uint8_t *packet, size_t len, int64_t now_us);
+  /// Returns the next packet if it is due at `now_us`.
+  PopResult pop(int64_t now_us, const uint8_t *&data, size_t &len, uint16_t &seq);
+  /// Frees the slot of the packet returned by the last pop().
+  void release();
+
+  /// Reports the sequence gap opened by the last insert(), if any, together with the playout time of its
+  /// first missing packet (the deadline for a retransmission). Each gap is reported once.
+  bool take_gap(uint16_t &first, uint16_t &count, int64_t &deadline_us);
+  /// Records that a retransmission was requested for `count` packets starting at `first`.
+  void mark_requested(uint16_t first, uint16_t count);
+
+  size_t slot_count() const { return this->slot_count_; }
+  /// Number of packets currently held.
+  size_t depth() const { return this->held_; }
+  /// How far ahead of `now_us` the newest held packet plays, or 0 when nothing is held.
+  int64_t buffered_us(int64_t now_us) const;
+  int64_t latency_us() const { return this->latency_us_; }
+  const Stats &stats() const { return this->stats_; }
+
+ protected:
+  struct Slot {
+    bool valid{false};
+    bool requested{false};
+    uint16_t seq{0};
+    uint32_t timestamp{0};
+    uint16_t len{0};
+  };
+
+  int64_t playout_time_(uint32_t timestamp) const;
+  void anchor_(uint16_t seq, uint32_t timestamp, int64_t now_us);
+  uint8_t *slot_data_(size_t index) { return this->storage_.get() + index * this->max_packet_size_; }
+
+  std::unique_ptr<Slot[]> slots_;
+  std::unique_ptr<uint8_t[]> storage_;
+  size_t slot_count_{0};
+  size_t max_packet_size_{0};
+  size_t held_{0};
+
+  uint32_t sample_rate_{44100};
+  int64_t latency_us_{0};
+  // Length of one RTP timestamp tick on the local clock, including any rate trim.
+  double us_per_frame_{1000000.0 / 44100};
+  float rate_trim_ppm_{0.0f};
+
+  bool anchored_{false};
+  // After flush(): packets timestamped before `flush_timestamp_` are still from the old position.
+  bool flushing_{false};
+  uint32_t flush_timestamp_{0};
+  uint16_t next_seq_{0};
+  // Late packets in a row; reaching slot_count_ resyncs.
+  size_t late_run_{0};
+  uint16_t newest_seq_{0};
+  uint32_t newest_timestamp_{0};
+  uint32_t first_timestamp_{0};
+  // RTP timestamp `anchor_timestamp_` plays at local time `anchor_us_`.
+  bool timeline_pinned_{false};
+  uint32_t anchor_timestamp_{0};
+  int64_t anchor_us_{0};
+  // Timestamp and size of the last released packet, used to estimate when a missing packet was due.
+  uint32_t last_timestamp_{0};
+  uint32_t frames_per_packet_{352};
+  bool have_last_{false};
+
+  bool gap_pending_{false};
+  uint16_t gap_first_{0};
+  uint16_t gap_count_{0};
+  int64_t gap_deadline_us_{0};
+
+  Stats stats_{};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,164 @@
+#include "raop_crypto.h"
+
+#ifdef AIRPLAY_USE_MBEDTLS
+
+#include <mbedtls/base64.h>
+#include <mbedtls/rsa.h>
+#include <mbedtls/version.h>
+
+#include <cstring>
+
+namespace esphome {
+namespace airplay_bridge {
+
+static const char *const DRBG_PERSONALIZATION = "airplay_bridge";
+
+bool decode_base64(std::string_view text, std::string &out) {
+  std::string padded;
+  padded.reserve(text.size() + 3);
+  for (char c : text) {
+    if (c != ' ' && c != '\r' && c != '\n' && c != '\t') {
+      padded.push_back(c);
+    }
+  }
+  while (padded.size() % 4 != 0) {
+    padded.push_back('=');
+  }
+  size_t length = 0;
+  out.resize(padded.size() / 4 * 3);
+  if (mbedtls_base64_decode(reinterpret_cast<unsigned char *>(&out[0]), out.size(), &length,
+                            reinterpret_cast<const unsigned char *>(padded.data()), padded.size()) != 0) {
+    out.clear();
+    return false;
+  }
+  out.resize(length);
+  return true;
+}
+
+RaopKey::RaopKey() {
+  mbedtls_pk_init(&this->pk_);
+  mbedtls_entropy_init(&this->entropy_);
+  mbedtls_ctr_drbg_init(&this->drbg_);
+}
+
+RaopKey::~RaopKey() {
+  mbedtls_ctr_drbg_free(&this->drbg_);
+  mbedtls_entropy_free(&this->entropy_);
+  mbedtls_pk_free(&this->pk_);
+}
+
+bool RaopKey::load(const std::string &pem) {
+  this->loaded_ = false;
+  // The private key operations are blinded, which needs a random source.
+  if (mbedtls_ctr_drbg_seed(&this->drbg_, mbedtls_entropy_func, &this->entropy_,
+                            reinterpret_cast<const unsigned char *>(DRBG_PERSONALIZATION),
+                            strlen(DRBG_PERSONALIZATION)) != 0) {
+    return false;
+  }
+  // PEM input has to include its terminating NUL in the length.
+  const auto *data = reinterpret_cast<const unsigned char *>(pem.c_str());
+#if MBEDTLS_VERSION_MAJOR >= 3
+  const int err = mbedtls_pk_parse_key(&this->pk_, data, pem.size() + 1, nullptr, 0, mbedtls_ctr_drbg_random,
+                                       &this->drbg_);
+#else
+  const int err = mbedtls_pk_parse_key(&this->pk_, data, pem.size() + 1, nullptr, 0);
+#endif
+  if (err != 0 || !mbedtls_pk_can_do(&this->pk_, MBEDTLS_PK_RSA)) {
+    return false;
+  }
+  this->loaded_ = true;
+  return true;
+}
+
+std::string RaopKey::respond_to_challenge(std::string_view challenge, const uint8_t ip[4], const uint8_t mac[6]) {
+  std::string decoded;
+  if (!this->loaded_ || !decode_base64(challenge, decoded) || decoded.size() > 16) {
+    return "";
+  }
+  uint8_t message[32]{};
+  memcpy(message, decoded.data(), decoded.size());
+  memcpy(message + decoded.size(), ip, 4);
+  memcpy(message + decoded.size() + 4, mac, 6);
+
+  mbedtls_rsa_context *rsa = mbedtls_pk_rsa(this->pk_);
+  mbedtls_rsa_set_padding(rsa, MBEDTLS_RSA_PKCS_V15, MBEDTLS_MD_NONE);
+  std::string signature(mbedtls_rsa_get_len(rsa), '\0');
+  // A PKCS#1 v1.5 signature over the raw bytes, with no DigestInfo.
+#if MBEDTLS_VERSION_MAJOR >= 3
+  const int err = mbedtls_rsa_pkcs1_sign(rsa, mbedtls_ctr_drbg_random, &this->drbg_, MBEDTLS_MD_NONE, sizeof(message),
+                                         message, reinterpret_cast<unsigned char *>(&signature[0]));
+#else
+  const int err = mbedtls_rsa_pkcs1_sign(rsa, mbedtls_ctr_drbg_random, &this->drbg_, MBEDTLS_RSA_PRIVATE,
+                                         MBEDTLS_MD_NONE, sizeof(message), message,
+                                         reinterpret_cast<unsigned char *>(&signature[0]));
+#endif
+  if (err != 0) {
+    return "";
+  }
+  std::string encoded((signature.size() + 2) / 3 * 4 + 1, '\0');
+  size_t length = 0;
+  if (mbedtls_base64_encode(reinterpret_cast<unsigned char *>(&encoded[0]), encoded.size(), &length,
+                            reinterpret_cast<const unsigned char *>(signature.data()), signature.size()) != 0) {
+    return "";
+  }
+  // Senders expect it without padding, like the challenge.
+  while (length > 0 && encoded[length - 1] == '=') {
+    length--;
+  }
+  encoded.resize(length);
+  return encoded;
+}
+
+bool RaopKey::unwrap_aes_key(std::string_view rsaaeskey, uint8_t key[16]) {
+  std::string wrapped;
+  if (!this->loaded_ || !decode_base64(rsaaeskey, wrapped)) {
+    return false;
+  }
+  mbedtls_rsa_context *rsa = mbedtls_pk_rsa(this->pk_);
+  if (wrapped.size() != mbedtls_rsa_get_len(rsa)) {
+    return false;
+  }
+  mbedtls_rsa_set_padding(rsa, MBEDTLS_RSA_PKCS_V21, MBEDTLS_MD_SHA1);
+  uint8_t plain[64];
+  size_t length = 0;
+  const auto *input = reinterpret_cast<const unsigned char *>(wrapped.data());
+#if MBEDTLS_VERSION_MAJOR >= 3
+  const int err = mbedtls_rsa_rsaes_oaep_decrypt(rsa, mbedtls_ctr_drbg_random, &this->drbg_, nullptr, 0, &length,
+                                                 input, plain, sizeof(plain));
+#else
+  const int err = mbedtls_rsa_rsaes_oaep_decrypt(rsa, mbedtls_ctr_drbg_random, &this->drbg_, MBEDTLS_RSA_PRIVATE,
+                                                 nullptr, 0, &length, input, plain, sizeof(plain));
+#endif
+  if (err != 0 || length != 16) {
+    return false;
+  }
+  memcpy(key, plain, 16);
+  return true;
+}
+
+PacketCipher::PacketCipher() { mbedtls_aes_init(&this->aes_); }
+
+PacketCipher::~PacketCipher() { mbedtls_aes_free(&this->aes_); }
+
+void PacketCipher::set_key(const uint8_t key[16], const uint8_t iv[16]) {
+  mbedtls_aes_setkey_dec(&this->aes_, key, 128);
+  memcpy(this->iv_, iv, sizeof(this->iv_));
+}
+
+void PacketCipher::decrypt(const uint8_t *in, size_t len, uint8_t *out) {
+  const size_t whole = len & ~static_cast<size_t>(15);
+  if (whole > 0) {
+    // CBC advances the IV it is given, and each packet has to start from the session IV again.
+    uint8_t iv[16];
+    memcpy(iv, this->iv_, sizeof(iv));
+    mbedtls_aes_crypt_cbc(&this->aes_, MBEDTLS_AES_DECRYPT, whole, iv, in, out);
+  }
+  if (len > whole && out != in) {
+    memcpy(out + whole, in + whole, len - whole);
+  }
+}
+
+}  // namespace airplay_bridge
+}  // namespace esphome
+
+#endif
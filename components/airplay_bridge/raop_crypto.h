@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if __has_include(<mbedtls/pk.h>)
+#define AIRPLAY_USE_MBEDTLS 1
+#include <mbedtls/aes.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/pk.h>
+#endif
+
+namespace esphome {
+namespace airplay_bridge {
+
+#ifdef AIRPLAY_USE_MBEDTLS
+
+/// Decodes base64 that may be missing its trailing padding, as RAOP senders send it.
+bool decode_base64(std::string_view text, std::string &out);
+
+/// Receiver side of the RAOP RSA handshake: answers Apple-Challenge and unwraps a session's AES key.
+///
+/// Senders encrypt to a fixed public key, so this only works with the matching private key, which has to
+/// come from the configuration; none is built in.
+class RaopKey {
+ public:
+  RaopKey();
+  ~RaopKey();
+  RaopKey(const RaopKey &) = delete;
+  RaopKey &operator=(const RaopKey &) = delete;
+
+  /// Parses a PEM (or DER) RSA private key. Returns false if it is not one.
+  bool load(const std::string &pem);
+  bool loaded() const { return this->loaded_; }
+
+  /// Apple-Response for a base64 Apple-Challenge: the challenge, the local IPv4 address and the MAC,
+  /// zero-padded to 32 bytes and signed with the private key. Returns an empty string on failure.
+  std::string respond_to_challenge(std::string_view challenge, const uint8_t ip[4], const uint8_t mac[6]);
+  /// Decrypts a base64 `rsaaeskey` SDP attribute (RSA-OAEP with SHA-1) into the 16-byte AES key.
+  bool unwrap_aes_key(std::string_view rsaaeskey, uint8_t key[16]);
+
+ protected:
+  mbedtls_pk_context pk_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  bool loaded_{false};
+};
+
+/// AES-128-CBC as RAOP applies it to audio payloads: every packet starts over from the session IV, and a
+/// trailing partial block is sent in the clear. mbedTLS uses the AES peripheral where it is built with it.
+class PacketCipher {
+ public:
+  PacketCipher();
+  ~PacketCipher();
+  PacketCipher(const PacketCipher &) = delete;
+  PacketCipher &operator=(const PacketCipher &) = delete;
+
+  void set_key(const uint8_t key[16], const uint8_t iv[16]);
+  /// Decrypts `len` payload bytes from `in` to `out`, which may be the same buffer.
+  void decrypt(const uint8_t *in, size_t len, uint8_t *out);
+
+ protected:
+  mbedtls_aes_context aes_;
+  uint8_t iv_[16]{};
+};
+
+#endif
+
+}  // namespace airplay_bridge
+}  // namespace esphome
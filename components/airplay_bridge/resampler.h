@@ -0,0 +1,268 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "dsp_kernels.h"
+
+namespace esphome {
+namespace airplay_bridge {
+
+namespace resampler_detail {
+
+// Just enough math to design the filter at compile time; none of this runs on the device.
+
+constexpr double PI = 3.14159265358979323846;
+
+constexpr double sin(double x) {
+  // Reduce to [-pi, pi], then a Taylor series that is exact to double precision on that range. The loops
+  // here stop as soon as a term no longer changes the result: the compiler's constexpr operation budget is
+  // what limits how large a filter table can be built.
+  const double turns = x / (2.0 * PI);
+  const double nearest = static_cast<double>(static_cast<int64_t>(turns + (turns < 0 ? -0.5 : 0.5)));
+  x -= nearest * 2.0 * PI;
+  double term = x;
+  double sum = x;
+  for (int k = 1; k < 24; k++) {
+    term *= -x * x / ((2.0 * k) * (2.0 * k + 1.0));
+    if (sum + term == sum) {
+      break;
+    }
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double sqrt(double x) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  // Newton's method from above decreases monotonically until it converges.
+  double guess = x > 1.0 ? x : 1.0;
+  for (int i = 0; i < 64; i++) {
+    const double next = 0.5 * (guess + x / guess);
+    if (next >= guess) {
+      break;
+    }
+    guess = next;
+  }
+  return guess;
+}
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window.
+constexpr double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    if (sum + term == sum) {
+      break;
+    }
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr uint32_t gcd(uint32_t a, uint32_t b) { return b == 0 ? a : gcd(b, a % b); }
+
+constexpr int16_t saturate16(int32_t value) {
+  return static_cast<int16_t>(value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+}
+
+}  // namespace resampler_detail
+
+/// Polyphase filter design for IN_RATE -> OUT_RATE, evaluated entirely at compile time.
+///
+/// The rate change is the exact ratio reduced by the gcd, so 44100 -> 16000 uses 160 filter phases stepped
+/// 441 at a time. Each phase is one row of a Kaiser-windowed sinc, normalised to unity gain and quantised
+/// to Q15. The finished table is a constexpr array and ends up in flash.
+template<uint32_t IN_RATE, uint32_t OUT_RATE> struct ResamplerDesign {
+  // Filter length in input frames when not decimating; scaled up by the decimation ratio otherwise so the
+  // transition band stays the same fraction of the output band.
+  static constexpr uint32_t BASE_TAPS = 24;
+  // Ratios with very few phases (such as 2:1) are spread over more, so that rate trims land between input
+  // frames instead of snapping to them.
+  static constexpr uint32_t MIN_PHASES = 64;
+  static constexpr uint32_t MAX_PHASES = 512;
+  // Largest table the compiler builds within its default constexpr budget (-fconstexpr-ops-limit, 2^25
+  // operations in GCC 12), at about 1200 operations per coefficient, with some margin.
+  static constexpr uint32_t MAX_TABLE_TAPS = 20480;
+  // Cutoff as a fraction of the lower of the two rates.
+  static constexpr double CUTOFF = 0.47;
+  // Kaiser window shape; about 60 dB of stopband attenuation.
+  static constexpr double KAISER_BETA = 6.0;
+
+  static constexpr uint32_t DIVISOR = resampler_detail::gcd(IN_RATE, OUT_RATE);
+  static constexpr uint32_t REDUCED_PHASES = OUT_RATE / DIVISOR;
+  static constexpr uint32_t SCALE =
+      REDUCED_PHASES < MIN_PHASES ? (MIN_PHASES + REDUCED_PHASES - 1) / REDUCED_PHASES : 1;
+  static constexpr uint32_t PHASES = REDUCED_PHASES * SCALE;
+  static constexpr uint32_t DECIMATION = IN_RATE / DIVISOR * SCALE;
+  static constexpr uint32_t TAPS =
+      ((IN_RATE > OUT_RATE ? (BASE_TAPS * IN_RATE + OUT_RATE - 1) / OUT_RATE : BASE_TAPS) + 1) & ~1U;
+
+  static_assert(REDUCED_PHASES <= MAX_PHASES, "output sample rate is not a simple enough ratio to the input");
+  static_assert(PHASES * TAPS <= MAX_TABLE_TAPS, "output sample rate needs too large a filter table");
+
+  using Table = std::array<int16_t, PHASES * TAPS>;
+
+  static constexpr double prototype_tap(double k, double cutoff, double half_length) {
+    const double x = 2.0 * cutoff * k;
+    const double sinc =
+        (x < 1e-12 && x > -1e-12) ? 1.0 : resampler_detail::sin(resampler_detail::PI * x) / (resampler_detail::PI * x);
+    const double w = k / half_length;
+    return sinc * resampler_detail::bessel_i0(KAISER_BETA * resampler_detail::sqrt(1.0 - w * w));
+  }
+
+  /// Row `phase` holds TAPS coefficients ordered oldest input first.
+  static constexpr Table build_coefficients() {
+    Table table{};
+    const double cutoff = CUTOFF * (IN_RATE > OUT_RATE ? static_cast<double>(OUT_RATE) / IN_RATE : 1.0) / PHASES;
+    const double center = (PHASES * TAPS - 1) / 2.0;
+    for (uint32_t phase = 0; phase < PHASES; phase++) {
+      // Tap j of a phase weights the input j frames before the newest one.
+      double taps[TAPS]{};
+      double sum = 0.0;
+      for (uint32_t j = 0; j < TAPS; j++) {
+        taps[j] = prototype_tap(phase + static_cast<double>(j) * PHASES - center, cutoff, center + 0.5);
+        sum += taps[j];
+      }
+      int32_t quantized_sum = 0;
+      uint32_t largest = TAPS - 1;
+      for (uint32_t j = 0; j < TAPS; j++) {
+        const double scaled = taps[j] / sum * 32768.0;
+        const int16_t value =
+            resampler_detail::saturate16(static_cast<int32_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5));
+        table[phase * TAPS + (TAPS - 1 - j)] = value;
+        quantized_sum += value;
+        if (value > table[phase * TAPS + largest]) {
+          largest = TAPS - 1 - j;
+        }
+      }
+      // Put the rounding error on the largest tap so every phase sums to exactly 1.0 in Q15.
+      table[phase * TAPS + largest] =
+          resampler_detail::saturate16(table[phase * TAPS + largest] + (32768 - quantized_sum));
+    }
+    return table;
+  }
+};
+
+/// Fixed-point polyphase resampler for interleaved 16-bit stereo, specialised on the rate pair.
+///
+/// Input history and the Q16 phase carry over between calls, so blocks of any size join without a seam.
+/// A small rate trim (in ppm) nudges the phase step, which is how playback follows a drifting clock.
+template<uint32_t IN_RATE, uint32_t OUT_RATE> class Resampler {
+ public:
+  using Design = ResamplerDesign<IN_RATE, OUT_RATE>;
+  static constexpr bool PASS_THROUGH = false;
+  static constexpr size_t TABLE_BYTES = sizeof(typename Design::Table);
+
+  /// Clears the history and phase, e.g. at the start of a stream.
+  void reset() {
+    memset(this->history_, 0, sizeof(this->history_));
+    this->history_pos_ = 0;
+    // Start a whole phase in so that the first output waits for the first input frame.
+    this->phase_ = WHOLE_PHASE;
+  }
+
+  /// Consumes faster (positive) or slower (negative) than the nominal ratio by `ppm`.
+  void set_trim_ppm(float ppm) {
+    this->step_ = NOMINAL_STEP + static_cast<int32_t>(static_cast<float>(NOMINAL_STEP) * ppm * 1e-6f);
+  }
+
+  /// Upper bound on the frames process() produces from `in_frames` input frames.
+  static constexpr size_t max_output_frames(size_t in_frames) {
+    // Nominal output plus headroom for the largest trim and for the phase carried in from the last call.
+    return in_frames * Design::PHASES / Design::DECIMATION + in_frames * Design::PHASES / Design::DECIMATION / 1000 + 2;
+  }
+
+  /// Resamples all `in_frames` stereo frames from `in` into `out`, which must hold max_output_frames().
+  /// Returns the number of frames written.
+  size_t process(const int16_t *in, size_t in_frames, int16_t *out) {
+    constexpr uint32_t TAPS = Design::TAPS;
+    size_t consumed = 0;
+    size_t produced = 0;
+    while (true) {
+      while (this->phase_ >= WHOLE_PHASE) {
+        if (consumed == in_frames) {
+          return produced;
+        }
+        this->push_(in[consumed * 2], in[consumed * 2 + 1]);
+        consumed++;
+        this->phase_ -= WHOLE_PHASE;
+      }
+      // The window starts just after the newest frame's first copy, i.e. at the oldest of the last TAPS.
+      const int16_t *window = &this->history_[(this->history_pos_ + 1) * 2];
+      const int16_t *coefficients = &COEFFICIENTS[(this->phase_ >> 16) * TAPS];
+      int32_t left = 1 << 14;
+      int32_t right = 1 << 14;
+      dsp::fir_stereo_q15(window, coefficients, TAPS, left, right);
+      out[produced * 2] = resampler_detail::saturate16(left >> 15);
+      out[produced * 2 + 1] = resampler_detail::saturate16(right >> 15);
+      produced++;
+      this->phase_ += this->step_;
+    }
+  }
+
+ protected:
+  static constexpr uint32_t WHOLE_PHASE = Design::PHASES << 16;
+  static constexpr uint32_t NOMINAL_STEP = Design::DECIMATION << 16;
+  static constexpr typename Design::Table COEFFICIENTS = Design::build_coefficients();
+
+  void push_(int16_t left, int16_t right) {
+    this->history_pos_ = this->history_pos_ + 1 == Design::TAPS ? 0 : this->history_pos_ + 1;
+    int16_t *slot = &this->history_[this->history_pos_ * 2];
+    slot[0] = left;
+    slot[1] = right;
+    slot[Design::TAPS * 2] = left;
+    slot[Design::TAPS * 2 + 1] = right;
+  }
+
+  // Stereo history, written twice (at i and i + TAPS) so the newest TAPS frames are always contiguous.
+  int16_t history_[Design::TAPS * 2 * 2]{};
+  uint32_t history_pos_{0};
+  uint32_t phase_{WHOLE_PHASE};
+  uint32_t step_{NOMINAL_STEP};
+};
+
+/// Equal rates: no filter at all. The rate trim is applied by dropping or repeating a single frame once
+/// it adds up to one.
+template<uint32_t RATE> class Resampler<RATE, RATE> {
+ public:
+  static constexpr bool PASS_THROUGH = true;
+  static constexpr size_t TABLE_BYTES = 0;
+
+  void reset() { this->residue_ = 0.0f; }
+  void set_trim_ppm(float ppm) { this->trim_ppm_ = ppm; }
+  static constexpr size_t max_output_frames(size_t in_frames) { return in_frames + 1; }
+
+  size_t process(const int16_t *in, size_t in_frames, int16_t *out) {
+    if (in_frames == 0) {
+      return 0;
+    }
+    // Accumulated in frame-ppm, so a whole frame is 1e6.
+    this->residue_ += static_cast<float>(in_frames) * this->trim_ppm_;
+    size_t out_frames = in_frames;
+    if (this->residue_ >= 1e6f && in_frames > 1) {
+      this->residue_ -= 1e6f;
+      out_frames--;
+    }
+    memcpy(out, in, out_frames * 2 * sizeof(int16_t));
+    if (this->residue_ <= -1e6f) {
+      this->residue_ += 1e6f;
+      out[out_frames * 2] = in[(in_frames - 1) * 2];
+      out[out_frames * 2 + 1] = in[(in_frames - 1) * 2 + 1];
+      out_frames++;
+    }
+    return out_frames;
+  }
+
+ protected:
+  float trim_ppm_{0.0f};
+  float residue_{0.0f};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,233 @@
+#include "rtsp_parser.h"
+
+namespace esphome {
+namespace airplay_bridge {
+
+static inline char ascii_lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }
+
+std::string_view trim_view(std::string_view value) {
+  const char *whitespace = " \r\n\t";
+  const size_t start = value.find_first_not_of(whitespace);
+  if (start == std::string_view::npos) {
+    return {};
+  }
+  const size_t end = value.find_last_not_of(whitespace);
+  return value.substr(start, end - start + 1);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool icontains(std::string_view haystack, std::string_view needle) {
+  if (needle.size() > haystack.size()) {
+    return false;
+  }
+  for (size_t i = 0; i + needle.size() <= haystack.size(); i++) {
+    if (iequals(haystack.substr(i, needle.size()), needle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string_view next_line(std::string_view &text) {
+  const size_t eol = text.find('\n');
+  std::string_view line;
+  if (eol == std::string_view::npos) {
+    line = text;
+    text = {};
+  } else {
+    line = text.substr(0, eol);
+    text.remove_prefix(eol + 1);
+  }
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
+std::string_view find_parameter(std::string_view list, std::string_view key, char separator) {
+  while (!list.empty()) {
+    const size_t end = list.find(separator);
+    const std::string_view item = trim_view(list.substr(0, end));
+    list = end == std::string_view::npos ? std::string_view{} : list.substr(end + 1);
+    const size_t equals = item.find('=');
+    if (equals != std::string_view::npos && iequals(trim_view(item.substr(0, equals)), key)) {
+      return trim_view(item.substr(equals + 1));
+    }
+  }
+  return {};
+}
+
+bool parse_uint(std::string_view text, uint32_t &out) {
+  if (text.empty()) {
+    return false;
+  }
+  uint32_t value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    const uint32_t digit = static_cast<uint32_t>(c - '0');
+    if (value > (UINT32_MAX - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+  out = value;
+  return true;
+}
+
+RtspParseResult RtspParser::parse(const uint8_t *data, size_t len, RtspRequest &request, size_t &consumed) {
+  const std::string_view buffer(reinterpret_cast<const char *>(data), len);
+
+  // Resume the terminator search a few bytes before where the previous attempt stopped, in case the
+  // "\r\n\r\n" straddled two reads.
+  const size_t search_from = this->scanned_ > 3 ? this->scanned_ - 3 : 0;
+  const size_t header_end = buffer.find("\r\n\r\n", search_from);
+  if (header_end == std::string_view::npos) {
+    this->scanned_ = len;
+    return RtspParseResult::INCOMPLETE;
+  }
+
+  request = RtspRequest{};
+  std::string_view headers = buffer.substr(0, header_end);
+
+  // Request line: METHOD URI RTSP/1.0
+  const std::string_view request_line = trim_view(next_line(headers));
+  const size_t method_end = request_line.find(' ');
+  request.method = request_line.substr(0, method_end);
+  if (method_end != std::string_view::npos) {
+    std::string_view rest = trim_view(request_line.substr(method_end + 1));
+    request.uri = rest.substr(0, rest.find(' '));
+  }
+  if (request.method.empty()) {
+    this->scanned_ = 0;
+    consumed = header_end + 4;
+    return RtspParseResult::MALFORMED;
+  }
+
+  while (!headers.empty()) {
+    const std::string_view line = next_line(headers);
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    const std::string_view key = trim_view(line.substr(0, colon));
+    const std::string_view value = trim_view(line.substr(colon + 1));
+    if (iequals(key, "CSeq")) {
+      request.cseq = value;
+    } else if (iequals(key, "Content-Length")) {
+      // Without a usable length the message boundary is lost, so treat it as a body that can never fit.
+      uint32_t content_length;
+      request.content_length = parse_uint(value, content_length) ? content_length : SIZE_MAX;
+    } else if (iequals(key, "Content-Type")) {
+      request.content_type = value;
+    } else if (iequals(key, "Apple-Challenge")) {
+      request.apple_challenge = value;
+    } else if (iequals(key, "Session")) {
+      request.session = value;
+    } else if (iequals(key, "Transport")) {
+      request.transport = value;
+    } else if (iequals(key, "RTP-Info")) {
+      request.rtp_info = value;
+    } else if (iequals(key, "DACP-ID")) {
+      request.dacp_id = value;
+    } else if (iequals(key, "Active-Remote")) {
+      request.active_remote = value;
+    }
+  }
+
+  // Compared before adding, so that a huge Content-Length cannot wrap the sum on a 32-bit size_t.
+  const size_t header_len = header_end + 4;
+  if (header_len > this->max_message_size_ || request.content_length > this->max_message_size_ - header_len) {
+    this->scanned_ = 0;
+    return RtspParseResult::TOO_LARGE;
+  }
+  const size_t total_len = header_len + request.content_length;
+  if (len < total_len) {
+    // Headers are complete but the body is not; resume the next search right at the known terminator.
+    this->scanned_ = header_end + 3;
+    return RtspParseResult::INCOMPLETE;
+  }
+
+  request.body = buffer.substr(header_len, request.content_length);
+  this->scanned_ = 0;
+  consumed = total_len;
+  return RtspParseResult::OK;
+}
+
+static const char *status_message(int status_code) {
+  switch (status_code) {
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 454:
+      return "Session Not Found";
+    case 455:
+      return "Method Not Valid in This State";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    default:
+      return "OK";
+  }
+}
+
+void RtspResponse::begin(int status_code, std::string_view cseq) {
+  this->buffer_.clear();
+  this->append_("RTSP/1.0 ");
+  this->append_uint_(static_cast<uint32_t>(status_code));
+  this->append_(" ");
+  this->append_(status_message(status_code));
+  this->append_("\r\n");
+  this->header("CSeq", cseq);
+}
+
+void RtspResponse::header(std::string_view name, std::string_view value) {
+  this->append_(name);
+  this->append_(": ");
+  this->append_(value);
+  this->append_("\r\n");
+}
+
+void RtspResponse::header(std::string_view name, uint32_t value) {
+  this->append_(name);
+  this->append_(": ");
+  this->append_uint_(value);
+  this->append_("\r\n");
+}
+
+void RtspResponse::finish(std::string_view body) {
+  if (!body.empty()) {
+    this->header("Content-Length", static_cast<uint32_t>(body.size()));
+  }
+  this->append_("\r\n");
+  this->append_(body);
+}
+
+void RtspResponse::append_uint_(uint32_t value) {
+  char digits[10];
+  size_t len = 0;
+  do {
+    digits[len++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (len > 0) {
+    this->buffer_.push_back(digits[--len]);
+  }
+}
+
+}  // namespace airplay_bridge
+}  // namespace esphome
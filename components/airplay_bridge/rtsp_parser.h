@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// One parsed RTSP request. All fields are views into the receive buffer and are only valid until the
+/// request's bytes are consumed from it.
+struct RtspRequest {
+  std::string_view method;
+  std::string_view uri;
+  std::string_view cseq;
+  std::string_view content_type;
+  std::string_view apple_challenge;
+  std::string_view session;
+  std::string_view transport;
+  std::string_view rtp_info;
+  // Identify the sender and its session; the same on every room a multi-room sender streams to.
+  std::string_view dacp_id;
+  std::string_view active_remote;
+  std::string_view body;
+  size_t content_length{0};
+};
+
+enum class RtspParseResult : uint8_t {
+  INCOMPLETE,
+  OK,
+  MALFORMED,
+  TOO_LARGE,  // the announced body can never fit in the receive buffer; the connection cannot recover
+};
+
+/// Incremental RTSP request parser that never allocates.
+///
+/// Only the headers the bridge acts on are extracted; everything else is skipped. When a request is
+/// still incomplete the parser remembers how far it already searched for the end of the header block,
+/// so a large message trickling in over several reads is not rescanned from the start every time.
+class RtspParser {
+ public:
+  /// Parses the request at the start of `data`. On OK or MALFORMED, `consumed` is set to the number of
+  /// bytes the caller should drop once it is done with `request`.
+  RtspParseResult parse(const uint8_t *data, size_t len, RtspRequest &request, size_t &consumed);
+
+  /// Forgets any partial scan state; call whenever the underlying buffer is cleared.
+  void reset() { this->scanned_ = 0; }
+  /// Largest whole request (headers and body) the caller can buffer. A Content-Length that would push a
+  /// request past it is reported as TOO_LARGE instead of waiting for bytes that cannot arrive.
+  void set_max_message_size(size_t size) { this->max_message_size_ = size; }
+
+ protected:
+  size_t scanned_{0};
+  size_t max_message_size_{SIZE_MAX};
+};
+
+/// Builds RTSP responses in place. The buffer is reused from one response to the next, so once it has
+/// grown to fit the largest reply, answering a request no longer allocates.
+class RtspResponse {
+ public:
+  /// Starts a new response with its status line and CSeq, discarding the previous one.
+  void begin(int status_code, std::string_view cseq);
+  void header(std::string_view name, std::string_view value);
+  void header(std::string_view name, uint32_t value);
+  /// Ends the header block, adding Content-Length when there is a body, and appends the body.
+  void finish(std::string_view body = {});
+
+  const char *data() const { return this->buffer_.data(); }
+  size_t size() const { return this->buffer_.size(); }
+
+ protected:
+  void append_(std::string_view text) { this->buffer_.append(text.data(), text.size()); }
+  void append_uint_(uint32_t value);
+
+  std::string buffer_;
+};
+
+/// Trims spaces, tabs and line endings from both ends of `value`.
+std::string_view trim_view(std::string_view value);
+
+/// ASCII case-insensitive equality.
+bool iequals(std::string_view a, std::string_view b);
+
+/// ASCII case-insensitive substring search.
+bool icontains(std::string_view haystack, std::string_view needle);
+
+/// Splits off the next line of `text` (without its line ending) and advances `text` past it.
+std::string_view next_line(std::string_view &text);
+
+/// Returns the value of `key` in a `key=value` list such as a Transport or RTP-Info header, or an empty
+/// view when the key is absent.
+std::string_view find_parameter(std::string_view list, std::string_view key, char separator = ';');
+
+/// Parses an unsigned decimal number; returns false if `text` is empty, not all digits or out of range.
+bool parse_uint(std::string_view text, uint32_t &out);
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Fixed-capacity receive buffer with a consume cursor.
+///
+/// Bytes are appended at the tail and dropped from the head by advancing a cursor, so consuming a
+/// parsed RTSP message or interleaved RTP frame is O(1). Unconsumed bytes are only moved back to the
+/// start of the storage when the tail runs out of room, which in practice means copying one partial
+/// frame rather than the whole backlog.
+class RxBuffer {
+ public:
+  void allocate(size_t capacity) {
+    this->storage_.reset(new uint8_t[capacity]);
+    this->capacity_ = capacity;
+    this->head_ = 0;
+    this->tail_ = 0;
+  }
+
+  size_t capacity() const { return this->capacity_; }
+  const uint8_t *data() const { return this->storage_.get() + this->head_; }
+  size_t size() const { return this->tail_ - this->head_; }
+  bool empty() const { return this->head_ == this->tail_; }
+  bool full() const { return this->size() == this->capacity_; }
+
+  uint8_t *write_ptr() { return this->storage_.get() + this->tail_; }
+  size_t writable() const { return this->capacity_ - this->tail_; }
+  void commit(size_t len) { this->tail_ += len; }
+
+  void consume(size_t len) {
+    this->head_ += len;
+    if (this->head_ >= this->tail_) {
+      this->head_ = 0;
+      this->tail_ = 0;
+    }
+  }
+
+  void clear() {
+    this->head_ = 0;
+    this->tail_ = 0;
+  }
+
+  /// Makes sure at least `min_free` bytes (or as many as possible) are writable at the tail by moving
+  /// the unconsumed bytes to the start of the storage. Returns the number of writable bytes.
+  size_t reserve(size_t min_free) {
+    if (this->writable() >= min_free || this->head_ == 0) {
+      return this->writable();
+    }
+    const size_t len = this->size();
+    memmove(this->storage_.get(), this->storage_.get() + this->head_, len);
+    this->bytes_moved_ += len;
+    this->head_ = 0;
+    this->tail_ = len;
+    return this->writable();
+  }
+
+  /// Total bytes moved by compaction since allocation.
+  uint64_t bytes_moved() const { return this->bytes_moved_; }
+
+ protected:
+  std::unique_ptr<uint8_t[]> storage_;
+  size_t capacity_{0};
+  size_t head_{0};
+  size_t tail_{0};
+  uint64_t bytes_moved_{0};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+
+#include "esphome/core/application.h"
+
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Read readiness for all of the component's sockets from one select() per loop.
+///
+/// Sockets are added when they are opened and removed before they are closed. Handlers then only touch
+/// sockets that have something to read, instead of calling accept() and recv() on every one of them each
+/// loop just to get EAGAIN. Where the ESPHome core can wait on sockets, they are also registered with it,
+/// so an idle main loop sleeps until one of them is readable rather than for a fixed interval.
+class SocketMux {
+ public:
+  void add(int fd) {
+    if (fd < 0 || std::find(this->fds_.begin(), this->fds_.end(), fd) != this->fds_.end()) {
+      return;
+    }
+    this->fds_.push_back(fd);
+    this->max_fd_ = std::max(this->max_fd_, fd);
+#ifdef USE_SOCKET_SELECT_SUPPORT
+    App.register_socket_fd(fd);
+#endif
+  }
+
+  void remove(int fd) {
+    auto it = std::find(this->fds_.begin(), this->fds_.end(), fd);
+    if (it == this->fds_.end()) {
+      return;
+    }
+    this->fds_.erase(it);
+    this->max_fd_ = this->fds_.empty() ? -1 : *std::max_element(this->fds_.begin(), this->fds_.end());
+    if (fd < FD_SETSIZE) {
+      FD_CLR(fd, &this->ready_);
+    }
+#ifdef USE_SOCKET_SELECT_SUPPORT
+    App.unregister_socket_fd(fd);
+#endif
+  }
+
+  /// Waits up to `timeout_ms` (0 just polls) for any socket to become readable. Returns the number ready.
+  int poll(uint32_t timeout_ms) {
+    FD_ZERO(&this->ready_);
+    if (this->fds_.empty()) {
+      return 0;
+    }
+    for (int fd : this->fds_) {
+      FD_SET(fd, &this->ready_);
+    }
+    timeval timeout{};
+    timeout.tv_sec = static_cast<time_t>(timeout_ms / 1000);
+    timeout.tv_usec = static_cast<suseconds_t>((timeout_ms % 1000) * 1000);
+    this->polls_++;
+    const int ready = select(this->max_fd_ + 1, &this->ready_, nullptr, nullptr, &timeout);
+    if (ready <= 0) {
+      FD_ZERO(&this->ready_);
+      return 0;
+    }
+    this->ready_polls_++;
+    return ready;
+  }
+
+  /// Whether `fd` was readable at the last poll().
+  bool ready(int fd) const { return fd >= 0 && fd < FD_SETSIZE && FD_ISSET(fd, &this->ready_); }
+
+  size_t size() const { return this->fds_.size(); }
+  uint32_t polls() const { return this->polls_; }
+  /// Polls that found at least one socket ready.
+  uint32_t ready_polls() const { return this->ready_polls_; }
+
+ protected:
+  std::vector<int> fds_;
+  int max_fd_{-1};
+  fd_set ready_{};
+  uint32_t polls_{0};
+  uint32_t ready_polls_{0};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "esphome/core/helpers.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace airplay_bridge {
+
+/// Broadcast byte ring: one producer and any number of readers, each keeping its own position.
+///
+/// The producer never waits for a reader. It overwrites the oldest bytes, and a reader that has fallen
+/// more than max_lag() behind is moved forward instead of holding data back for it. Readers copy out a
+/// chunk at a time and check afterwards that the producer did not reach it meanwhile, so a single copy of
+/// the audio serves every listener and none of them is ever handed half-overwritten bytes.
+class StreamRing {
+ public:
+  /// Allocates the ring; `capacity` is rounded up to a power of two. Returns false if out of memory.
+  bool allocate(size_t capacity, bool prefer_psram) {
+    size_t size = 4096;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    RAMAllocator<uint8_t> allocator(prefer_psram ? RAMAllocator<uint8_t>::NONE : RAMAllocator<uint8_t>::ALLOC_INTERNAL);
+    this->storage_ = allocator.allocate(size);
+    if (this->storage_ == nullptr) {
+      return false;
+    }
+    this->capacity_ = static_cast<uint32_t>(size);
+    return true;
+  }
+
+  size_t capacity() const { return this->capacity_; }
+  /// Half the ring; the other half is headroom for the producer while a reader sends from its position.
+  uint32_t max_lag() const { return this->capacity_ / 2; }
+
+  /// Producer: appends `len` bytes. Writes are expected in whole frames so reader positions stay aligned.
+  void write(const uint8_t *data, size_t len) {
+    uint32_t head = this->head_.load(std::memory_order_relaxed);
+    while (len > 0) {
+      // The head is published at least every max_lag() bytes, which is what lets overrun() tell a write
+      // still in progress from one that cannot have reached the reader yet.
+      const uint32_t offset = head & (this->capacity_ - 1);
+      size_t chunk = len < this->capacity_ - offset ? len : this->capacity_ - offset;
+      if (chunk > this->max_lag()) {
+        chunk = this->max_lag();
+      }
+      // Keeps the previous head visible ahead of the bytes it frees up being overwritten.
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(this->storage_ + offset, data, chunk);
+      data += chunk;
+      len -= chunk;
+      head += static_cast<uint32_t>(chunk);
+      this->head_.store(head, std::memory_order_release);
+    }
+  }
+
+  /// Position of the newest byte; where a new reader starts.
+  uint32_t head() const { return this->head_.load(std::memory_order_acquire); }
+
+  /// Reader: moves `pos` forward if it is more than max_lag() behind, in steps of `align` bytes so that it
+  /// stays on a frame boundary. Returns how many bytes were skipped.
+  uint32_t catch_up(uint32_t &pos, uint32_t align) const {
+    const uint32_t behind = this->head() - pos;
+    if (behind <= this->max_lag()) {
+      return 0;
+    }
+    const uint32_t skip = (behind - this->max_lag() + align - 1) / align * align;
+    pos += skip;
+    return skip;
+  }
+
+  /// Reader: true if the bytes at `pos` may have been overwritten by now, counting a write still in
+  /// progress. Call after reading them.
+  bool overrun(uint32_t pos) const {
+    // Orders the reads of the data before the load of the head, as in a seqlock.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // A write in progress covers at most max_lag() bytes past the head, so it only reaches positions more
+    // than capacity() - max_lag() = max_lag() behind the head.
+    return this->head_.load(std::memory_order_relaxed) - pos > this->max_lag();
+  }
+
+  /// Reader: copies up to `len` bytes from `pos` into `out` without advancing `pos`, and returns how many.
+  /// A reader too far behind is first moved forward as by catch_up(); if the producer overran the bytes
+  /// while they were being copied, it is moved forward again and the copy retried. Skipped bytes are
+  /// added to `skipped`.
+  size_t copy(uint32_t &pos, uint8_t *out, size_t len, uint32_t align, uint64_t &skipped) const {
+    while (true) {
+      skipped += this->catch_up(pos, align);
+      const uint32_t available = this->head() - pos;
+      if (len > available) {
+        len = available;
+      }
+      const uint32_t offset = pos & (this->capacity_ - 1);
+      const size_t first = len < this->capacity_ - offset ? len : this->capacity_ - offset;
+      memcpy(out, this->storage_ + offset, first);
+      memcpy(out + first, this->storage_, len - first);
+      if (!this->overrun(pos)) {
+        return len;
+      }
+    }
+  }
+
+ protected:
+  uint8_t *storage_{nullptr};
+  uint32_t capacity_{0};
+  std::atomic<uint32_t> head_{0};
+};
+
+}  // namespace airplay_bridge
+}  // namespace esphome
@@ -0,0 +1,865 @@
+// AirPlayBridge end to end on the host: senders talk RTSP to the real component over loopback TCP, and the
+// test runs the audio task's passes itself in between (see host/freertos/task.h), so every step is
+// deterministic. Covers a sender re-announcing a running stream with another codec, a FLUSH followed by
+// RECORD, which has to keep the stream running rather than restart it, a second sender taking over, the
+// UDP transport (timing, sync, audio and retransmissions, filtered by sender address), its interleaved TCP
+// fallback and its sockets being drained between sessions, the audio task streaming without a single heap
+// allocation, volume changes under `software_volume` reaching the media player's state, throttled, without
+// it applying them again, and group members following the member that decodes their sender session,
+// trimming its output to their own speaker's pace, and dropping out when it stops.
+
+#include "airplay_bridge.h"
+#include "esphome/components/speaker/speaker.h"
+#include "test.h"
+
+#include <esp_heap_caps.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every C++ allocation goes through the heap hook, as every heap_caps allocation does on the device.
+void *operator new(size_t size) {
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  esp_heap_trace_alloc_hook(ptr, size, 0);
+  return ptr;
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+using namespace esphome;
+using esphome::airplay_bridge::AirPlayBridge;
+
+namespace {
+
+const char *const ALAC_SDP =
+    "v=0\r\n"
+    "o=iTunes 3413821438 0 IN IP4 127.0.0.1\r\n"
+    "s=iTunes\r\n"
+    "c=IN IP4 127.0.0.1\r\n"
+    "t=0 0\r\n"
+    "m=audio 0 RTP/AVP 96\r\n"
+    "a=rtpmap:96 AppleLossless\r\n"
+    "a=fmtp:96 352 0 16 40 10 14 2 255 0 0 44100\r\n";
+
+const char *const PCM_SDP =
+    "v=0\r\n"
+    "o=iTunes 3413821438 0 IN IP4 127.0.0.1\r\n"
+    "s=iTunes\r\n"
+    "c=IN IP4 127.0.0.1\r\n"
+    "t=0 0\r\n"
+    "m=audio 0 RTP/AVP 96\r\n"
+    "a=rtpmap:96 L16/44100/2\r\n";
+
+const char *const TCP_TRANSPORT = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1;mode=record\r\n";
+
+const size_t FRAMES_PER_PACKET = 352;
+
+// Every bridge listens on ports of its own, offset by the pid so that concurrent runs do not collide.
+uint16_t next_port_base() {
+  static uint16_t port = static_cast<uint16_t>(20000 + getpid() % 20000);
+  port += 8;
+  return port;
+}
+
+// Opens the component's internals to the tests.
+class Bridge : public AirPlayBridge {
+ public:
+  using AirPlayBridge::AudioPipeline;
+  using AirPlayBridge::CODEC_ALAC;
+  using AirPlayBridge::CODEC_PCM;
+  using AirPlayBridge::TargetRuntime;
+
+  TargetRuntime &target(size_t index) { return this->runtimes_[index]; }
+  AudioPipeline &audio(size_t index) { return *this->runtimes_[index].audio; }
+
+  /// Polls every socket of the bridge the way its loop does, and returns how many are readable.
+  int ready_sockets() { return this->sockets_.poll(0); }
+
+  /// One pass of the audio task, run as that task.
+  void run_audio() {
+    host::current_task = this->audio_task_handle_;
+    this->service_audio_();
+    host::current_task = nullptr;
+  }
+};
+
+// One stereo packet of L16 audio whose samples count up from `first`, so that what reaches the speaker
+// shows which packets were played and in what order.
+std::vector<int16_t> packet_samples(int16_t first) {
+  std::vector<int16_t> samples(FRAMES_PER_PACKET * 2);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = static_cast<int16_t>(first + i);
+  }
+  return samples;
+}
+
+std::vector<uint8_t> rtp_packet(uint16_t seq, uint32_t timestamp, const std::vector<int16_t> &samples) {
+  std::vector<uint8_t> packet = {0x80, 0x60, static_cast<uint8_t>(seq >> 8), static_cast<uint8_t>(seq),
+                                 static_cast<uint8_t>(timestamp >> 24), static_cast<uint8_t>(timestamp >> 16),
+                                 static_cast<uint8_t>(timestamp >> 8), static_cast<uint8_t>(timestamp),
+                                 0, 0, 0, 1};
+  for (const int16_t sample : samples) {
+    packet.push_back(static_cast<uint8_t>(static_cast<uint16_t>(sample) >> 8));
+    packet.push_back(static_cast<uint8_t>(sample));
+  }
+  return packet;
+}
+
+// What the speaker is given for `samples`: native-endian 16-bit stereo, unchanged at unity gain.
+std::vector<uint8_t> speaker_bytes(const std::vector<int16_t> &samples) {
+  std::vector<uint8_t> bytes(samples.size() * sizeof(int16_t));
+  memcpy(bytes.data(), samples.data(), bytes.size());
+  return bytes;
+}
+
+// An RTSP client on a loopback connection to one target. The bridge's loop runs while it waits for replies.
+class Sender {
+ public:
+  Sender(Bridge &bridge, uint16_t port) : bridge_(bridge) {
+    this->fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    // The listen backlog completes the handshake before the bridge accepts.
+    CHECK(connect(this->fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+    fcntl(this->fd_, F_SETFL, fcntl(this->fd_, F_GETFL, 0) | O_NONBLOCK);
+    // Every send has to reach the bridge by its next loop, not wait for an ACK.
+    int on = 1;
+    setsockopt(this->fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  ~Sender() { close(this->fd_); }
+
+  /// Sends a request and runs the bridge until its reply is complete. Returns the status code, or 0 if no
+  /// reply came.
+  int request(const std::string &method, const std::string &headers = "", const std::string &body = "") {
+    const std::string message = this->message(method, headers, body);
+    this->send_bytes(message.data(), message.size());
+    return this->read_reply();
+  }
+
+  /// The next request, for sending together with others.
+  std::string message(const std::string &method, const std::string &headers = "", const std::string &body = "") {
+    std::string message = method + " rtsp://127.0.0.1/3413821438 RTSP/1.0\r\nCSeq: " + std::to_string(++this->cseq_) +
+                          "\r\n" + headers;
+    if (!body.empty()) {
+      message += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    return message + "\r\n" + body;
+  }
+
+  /// Sends one RTP packet interleaved on `channel`.
+  void send_interleaved(const std::vector<uint8_t> &packet, uint8_t channel = 0) {
+    std::vector<uint8_t> frame = {'$', channel, static_cast<uint8_t>(packet.size() >> 8),
+                                  static_cast<uint8_t>(packet.size())};
+    frame.insert(frame.end(), packet.begin(), packet.end());
+    this->send_bytes(frame.data(), frame.size());
+    this->bridge_.loop();
+  }
+
+  void send_bytes(const void *data, size_t len) { CHECK(send(this->fd_, data, len, 0) == static_cast<ssize_t>(len)); }
+
+  int read_reply() {
+    for (int attempt = 0; attempt < 200; attempt++) {
+      this->bridge_.loop();
+      char chunk[1024];
+      const ssize_t got = recv(this->fd_, chunk, sizeof(chunk), 0);
+      if (got > 0) {
+        this->buffer_.append(chunk, static_cast<size_t>(got));
+      } else if (got == 0) {
+        return 0;
+      } else {
+        usleep(500);
+      }
+      const size_t head_end = this->buffer_.find("\r\n\r\n");
+      if (head_end == std::string::npos) {
+        continue;
+      }
+      size_t body_len = 0;
+      const size_t length_at = this->buffer_.find("Content-Length: ");
+      if (length_at != std::string::npos && length_at < head_end) {
+        body_len = std::stoul(this->buffer_.substr(length_at + 16));
+      }
+      if (this->buffer_.size() < head_end + 4 + body_len) {
+        continue;
+      }
+      this->reply = this->buffer_.substr(0, head_end + 4 + body_len);
+      this->buffer_.erase(0, this->reply.size());
+      return std::stoi(this->reply.substr(this->reply.find(' ') + 1));
+    }
+    return 0;
+  }
+
+  /// Runs the bridge until `len` bytes that are not part of a reply have arrived, and returns them.
+  std::string read_raw(size_t len) {
+    for (int attempt = 0; attempt < 200 && this->buffer_.size() < len; attempt++) {
+      this->bridge_.loop();
+      char chunk[1024];
+      const ssize_t got = recv(this->fd_, chunk, sizeof(chunk), 0);
+      if (got > 0) {
+        this->buffer_.append(chunk, static_cast<size_t>(got));
+      } else {
+        usleep(500);
+      }
+    }
+    const std::string raw = this->buffer_.substr(0, len);
+    this->buffer_.erase(0, raw.size());
+    return raw;
+  }
+
+  /// Whether the bridge has closed the connection, after giving it a loop to do so.
+  bool closed() {
+    this->bridge_.loop();
+    char chunk[1024];
+    ssize_t got;
+    while ((got = recv(this->fd_, chunk, sizeof(chunk), 0)) > 0) {
+    }
+    return got == 0;
+  }
+
+  std::string reply;
+
+ protected:
+  Bridge &bridge_;
+  int fd_{-1};
+  int cseq_{0};
+  std::string buffer_;
+};
+
+// Datagrams on loopback can still be on their way when sendto() returns, so the bridge gets a few loops to
+// read them.
+void settle(Bridge &bridge) {
+  for (int i = 0; i < 5; i++) {
+    usleep(1000);
+    bridge.loop();
+  }
+}
+
+// A sender's UDP socket, bound to `address` on a port of its own.
+class UdpSocket {
+ public:
+  explicit UdpSocket(const char *address = "127.0.0.1") {
+    this->fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, address, &addr.sin_addr);
+    socklen_t addr_len = sizeof(addr);
+    CHECK(bind(this->fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+    getsockname(this->fd_, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+    this->port = ntohs(addr.sin_port);
+    fcntl(this->fd_, F_SETFL, fcntl(this->fd_, F_GETFL, 0) | O_NONBLOCK);
+  }
+  ~UdpSocket() { close(this->fd_); }
+
+  void send_to(uint16_t to_port, const std::vector<uint8_t> &packet) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(to_port);
+    CHECK(sendto(this->fd_, packet.data(), packet.size(), 0, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
+          static_cast<ssize_t>(packet.size()));
+  }
+
+  /// The most recent packet the bridge has sent here, after running its loop; empty if there is none.
+  std::vector<uint8_t> receive(Bridge &bridge) {
+    settle(bridge);
+    std::vector<uint8_t> latest;
+    uint8_t packet[1536];
+    ssize_t len;
+    while ((len = recv(this->fd_, packet, sizeof(packet), 0)) > 0) {
+      latest.assign(packet, packet + len);
+    }
+    return latest;
+  }
+
+  uint16_t port{0};
+
+ protected:
+  int fd_{-1};
+};
+
+// The number after `name=` in a Transport header.
+uint16_t transport_port(const std::string &reply, const char *name) {
+  const size_t at = reply.find(std::string(name) + "=");
+  return at == std::string::npos ? 0 : static_cast<uint16_t>(std::stoul(reply.substr(at + strlen(name) + 1)));
+}
+
+void put_u32(std::vector<uint8_t> &out, size_t at, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[at + i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+  }
+}
+
+void put_ntp(std::vector<uint8_t> &out, size_t at, uint64_t ntp) {
+  for (int i = 0; i < 8; i++) {
+    out[at + i] = static_cast<uint8_t>(ntp >> (56 - 8 * i));
+  }
+}
+
+// Runs the audio task until a stopped stream has been played out.
+void play_out(Bridge &bridge, size_t index) {
+  for (int pass = 0; pass < 16; pass++) {
+    bridge.run_audio();
+    if (!bridge.audio(index).draining) {
+      return;
+    }
+  }
+}
+
+// Announces a PCM stream as one session of a multi-room sender and starts it on the sender's connection.
+void start_session(Sender &sender, const std::string &active_remote) {
+  const std::string headers =
+      "Content-Type: application/sdp\r\nDACP-ID: 14413BE4996FEA4D\r\nActive-Remote: " + active_remote + "\r\n";
+  CHECK(sender.request("ANNOUNCE", headers, PCM_SDP) == 200);
+  CHECK(sender.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(sender.request("RECORD", "RTP-Info: seq=0;rtptime=0\r\n") == 200);
+}
+
+void test_reannounce_restarts_stream() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+  CHECK(bridge.target(0).audio != nullptr);
+
+  Sender sender(bridge, port);
+  CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", ALAC_SDP) == 200);
+  CHECK(sender.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(sender.request("RECORD", "RTP-Info: seq=0;rtptime=0\r\n") == 200);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+  CHECK(bridge.audio(0).codec == Bridge::CODEC_ALAC);
+  CHECK(speaker.starts == 1);
+
+  // The same sender announces PCM on the same connection, without a TEARDOWN in between. Its RECORD has
+  // to start a new stream with the new codec rather than leave the ALAC one running.
+  CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+  CHECK(sender.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(sender.request("RECORD", "RTP-Info: seq=100;rtptime=35200\r\n") == 200);
+  CHECK(bridge.target(0).streaming);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+  CHECK(bridge.audio(0).codec == Bridge::CODEC_PCM);
+  CHECK(speaker.starts == 2);
+  CHECK(speaker.finishes == 0);
+  CHECK(player.calls.empty());
+
+  // A seek: FLUSH, then RECORD from the new position. The stream keeps running, so there is no new START.
+  CHECK(sender.request("FLUSH", "RTP-Info: seq=200;rtptime=70400\r\n") == 200);
+  CHECK(sender.request("RECORD", "RTP-Info: seq=200;rtptime=70400\r\n") == 200);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+  CHECK(bridge.audio(0).codec == Bridge::CODEC_PCM);
+  CHECK(speaker.starts == 2);
+
+  // Audio from the new position decodes as PCM and reaches the speaker unchanged once the stream ends.
+  std::vector<uint8_t> expected;
+  for (uint16_t i = 0; i < 4; i++) {
+    const std::vector<int16_t> samples = packet_samples(static_cast<int16_t>(i * 1000));
+    sender.send_interleaved(rtp_packet(200 + i, 70400 + i * FRAMES_PER_PACKET, samples));
+    const std::vector<uint8_t> bytes = speaker_bytes(samples);
+    expected.insert(expected.end(), bytes.begin(), bytes.end());
+  }
+  bridge.run_audio();
+  CHECK(sender.request("TEARDOWN") == 200);
+  play_out(bridge, 0);
+  CHECK(!bridge.audio(0).active);
+  CHECK(speaker.finishes == 1);
+  CHECK(speaker.played == expected);
+}
+
+void test_takeover() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+
+  Sender first(bridge, port);
+  CHECK(first.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+  CHECK(first.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(first.request("RECORD") == 200);
+  for (uint16_t i = 0; i < 2; i++) {
+    first.send_interleaved(rtp_packet(i, i * FRAMES_PER_PACKET, packet_samples(-30000)));
+  }
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.depth() == 2);
+
+  // A second sender checks in while the first one streams. It is answered on its own connection, which
+  // stays pending, and the first stream carries on.
+  Sender second(bridge, port);
+  CHECK(second.request("OPTIONS") == 200);
+  CHECK(bridge.target(0).pending.size() == 1);
+  CHECK(bridge.target(0).takeovers == 0);
+  CHECK(bridge.target(0).streaming);
+
+  // Its ANNOUNCE arrives together with the SETUP behind it. The connection is promoted, and the SETUP
+  // still buffered on it moves into the target's own receive buffer and is answered from there.
+  const std::string burst = second.message("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) +
+                            second.message("SETUP", TCP_TRANSPORT);
+  second.send_bytes(burst.data(), burst.size());
+  CHECK(second.read_reply() == 200);
+  CHECK(second.read_reply() == 200);
+  CHECK(second.reply.find("Transport: RTP/AVP/TCP") != std::string::npos);
+  CHECK(first.closed());
+  CHECK(bridge.target(0).pending.empty());
+  CHECK(bridge.target(0).takeovers == 1);
+  CHECK(!bridge.target(0).streaming);
+
+  CHECK(second.request("RECORD") == 200);
+  CHECK(bridge.target(0).streaming);
+  // Only the new sender's audio is heard: the first stream's buffered packets are dropped, not played out.
+  const std::vector<int16_t> samples = packet_samples(0);
+  second.send_interleaved(rtp_packet(500, 0, samples));
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+  CHECK(speaker.starts == 2);
+  CHECK(speaker.finishes == 0);
+  CHECK(second.request("TEARDOWN") == 200);
+  play_out(bridge, 0);
+  CHECK(speaker.played == speaker_bytes(samples));
+}
+
+void test_udp_transport() {
+  using esphome::airplay_bridge::ClockSync;
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+
+  // The sender's side: RTSP, its control and timing ports, a socket to send audio from, and one on
+  // another address that is not part of the session.
+  Sender sender(bridge, port);
+  UdpSocket control;
+  UdpSocket timing;
+  UdpSocket audio;
+  UdpSocket stranger("127.0.0.2");
+  CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+  CHECK(sender.request("SETUP", "Transport: RTP/AVP/UDP;unicast;interleaved=0-1;mode=record;control_port=" +
+                                    std::to_string(control.port) + ";timing_port=" + std::to_string(timing.port) +
+                                    "\r\n") == 200);
+  CHECK(sender.reply.find("Transport: RTP/AVP/UDP") != std::string::npos);
+  const uint16_t server_port = transport_port(sender.reply, "server_port");
+  const uint16_t server_control = transport_port(sender.reply, "control_port");
+  const uint16_t server_timing = transport_port(sender.reply, "timing_port");
+  CHECK(server_port != 0 && server_control != 0 && server_timing != 0);
+  CHECK(bridge.target(0).udp);
+  CHECK(sender.request("RECORD") == 200);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+
+  // The bridge asks the sender for the time; the sender's clock runs 5 s ahead. The reply echoes the
+  // request's send time as its origin, which is how the bridge matches it up.
+  const int64_t sender_ahead_us = 5000000;
+  host::now_us += 300000;
+  const std::vector<uint8_t> timing_request = timing.receive(bridge);
+  CHECK(timing_request.size() == 32);
+  CHECK(timing_request.size() == 32 && timing_request[1] == (0x80 | 0x52));
+  if (timing_request.size() == 32) {
+    std::vector<uint8_t> response(32, 0);
+    response[0] = 0x80;
+    response[1] = 0x80 | 0x53;
+    std::copy(timing_request.begin() + 24, timing_request.end(), response.begin() + 8);
+    put_ntp(response, 16, ClockSync::us_to_ntp(host::now_us + sender_ahead_us));
+    put_ntp(response, 24, ClockSync::us_to_ntp(host::now_us + sender_ahead_us));
+    timing.send_to(server_timing, response);
+  }
+  settle(bridge);
+  CHECK(bridge.target(0).clock.synchronized());
+  CHECK(std::abs(bridge.target(0).clock.offset_us() - sender_ahead_us) < 10);
+
+  // Timing requests the other way are answered with the request's send time as the origin.
+  std::vector<uint8_t> request(32, 0);
+  request[0] = 0x80;
+  request[1] = 0x80 | 0x52;
+  put_ntp(request, 24, 0x0123456789ABCDEFull);
+  timing.send_to(server_timing, request);
+  const std::vector<uint8_t> response = timing.receive(bridge);
+  CHECK(response.size() == 32 && response[1] == (0x80 | 0x53));
+  CHECK(response.size() == 32 && std::equal(request.begin() + 24, request.end(), response.begin() + 8));
+
+  // A sync packet pins RTP timestamp 0 to 200 ms from now on the sender's clock.
+  std::vector<uint8_t> sync(20, 0);
+  sync[0] = 0x90;
+  sync[1] = 0x80 | 0x54;
+  put_u32(sync, 4, 0);
+  put_ntp(sync, 8, ClockSync::us_to_ntp(host::now_us + 200000 + sender_ahead_us));
+  put_u32(sync, 16, 0);
+  control.send_to(server_control, sync);
+  settle(bridge);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.timeline_pinned());
+
+  // Audio from the sender's address reaches the jitter buffer; the same from another address does not.
+  for (uint16_t seq : {0, 1, 2, 5}) {
+    audio.send_to(server_port, rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(0)));
+  }
+  stranger.send_to(server_port, rtp_packet(3, 3 * FRAMES_PER_PACKET, packet_samples(0)));
+  settle(bridge);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.stats().received == 4);
+  CHECK(bridge.audio(0).jitter.depth() == 4);
+
+  // Packets 3 and 4 are missing, so the bridge asks for them on the sender's control port.
+  const std::vector<uint8_t> resend = control.receive(bridge);
+  const std::vector<uint8_t> expected_resend = {0x80, 0x80 | 0x55, resend.size() > 3 ? resend[2] : uint8_t{0},
+                                                resend.size() > 3 ? resend[3] : uint8_t{0}, 0, 3, 0, 2};
+  CHECK(resend == expected_resend);
+
+  // Only the sender's retransmissions are taken.
+  for (uint16_t seq : {3, 4}) {
+    std::vector<uint8_t> retransmit = {0x80, 0x80 | 0x56, 0, 1};
+    const std::vector<uint8_t> packet = rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(0));
+    retransmit.insert(retransmit.end(), packet.begin(), packet.end());
+    stranger.send_to(server_control, retransmit);
+    control.send_to(server_control, retransmit);
+  }
+  settle(bridge);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.stats().received == 6);
+  CHECK(bridge.audio(0).jitter.stats().resend_satisfied == 2);
+  CHECK(bridge.audio(0).jitter.stats().duplicates == 0);
+  CHECK(bridge.audio(0).jitter.depth() == 6);
+  CHECK(sender.request("TEARDOWN") == 200);
+}
+
+void test_interleaved_fallback() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+
+  // A UDP session first, so that the target's UDP sockets exist.
+  UdpSocket control;
+  UdpSocket timing;
+  uint16_t server_port = 0;
+  {
+    Sender sender(bridge, port);
+    CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+    CHECK(sender.request("SETUP", "Transport: RTP/AVP/UDP;unicast;mode=record;control_port=" +
+                                      std::to_string(control.port) + ";timing_port=" + std::to_string(timing.port) +
+                                      "\r\n") == 200);
+    server_port = transport_port(sender.reply, "server_port");
+    CHECK(sender.request("TEARDOWN") == 200);
+  }
+
+  // The next sender asks for TCP: audio and retransmissions come interleaved on the RTSP connection.
+  Sender sender(bridge, port);
+  CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+  CHECK(sender.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(sender.reply.find("Transport: RTP/AVP/TCP") != std::string::npos);
+  CHECK(!bridge.target(0).udp);
+  CHECK(sender.request("RECORD") == 200);
+  bridge.run_audio();
+
+  // Stray UDP audio to the old session's port is drained, not queued.
+  UdpSocket audio;
+  audio.send_to(server_port, rtp_packet(0, 0, packet_samples(0)));
+  settle(bridge);
+  for (uint16_t seq : {0, 1, 3}) {
+    sender.send_interleaved(rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(0)));
+  }
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.stats().received == 3);
+
+  // The request for packet 2 comes back interleaved on channel 1, and so does the retransmission.
+  const std::string resend = sender.read_raw(12);
+  CHECK(resend.size() == 12 && resend[0] == '$' && resend[1] == 1 && resend[3] == 8);
+  CHECK(resend.size() == 12 && static_cast<uint8_t>(resend[5]) == (0x80 | 0x55));
+  CHECK(resend.size() == 12 && resend[9] == 2 && resend[11] == 1);
+  std::vector<uint8_t> retransmit = {0x80, 0x80 | 0x56, 0, 1};
+  const std::vector<uint8_t> packet = rtp_packet(2, 2 * FRAMES_PER_PACKET, packet_samples(0));
+  retransmit.insert(retransmit.end(), packet.begin(), packet.end());
+  sender.send_interleaved(retransmit, 1);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).jitter.stats().received == 4);
+  CHECK(bridge.audio(0).jitter.stats().resend_satisfied == 1);
+  CHECK(sender.request("TEARDOWN") == 200);
+}
+
+void test_udp_drained_between_sessions() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+
+  UdpSocket control;
+  UdpSocket timing;
+  std::string reply;
+  {
+    Sender sender(bridge, port);
+    CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+    CHECK(sender.request("SETUP", "Transport: RTP/AVP/UDP;unicast;mode=record;control_port=" +
+                                      std::to_string(control.port) + ";timing_port=" + std::to_string(timing.port) +
+                                      "\r\n") == 200);
+    reply = sender.reply;
+    CHECK(sender.request("TEARDOWN") == 200);
+  }
+  settle(bridge);
+  CHECK(bridge.target(0).client_fd < 0);
+
+  // The sender is gone but its last packets are still on the way. The sockets stay open and registered
+  // with the core for the next session, so the bridge has to read them or every select() returns at once.
+  UdpSocket late;
+  late.send_to(transport_port(reply, "server_port"), rtp_packet(0, 0, packet_samples(0)));
+  late.send_to(transport_port(reply, "control_port"), std::vector<uint8_t>(20, 0x80));
+  late.send_to(transport_port(reply, "timing_port"), std::vector<uint8_t>(32, 0x80));
+  settle(bridge);
+  CHECK(bridge.ready_sockets() == 0);
+  // Drained, not played.
+  play_out(bridge, 0);
+  CHECK(bridge.audio(0).jitter.stats().received == 0);
+}
+
+void test_no_allocations_while_streaming() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+
+  Sender sender(bridge, port);
+  CHECK(sender.request("ANNOUNCE", "Content-Type: application/sdp\r\n", PCM_SDP) == 200);
+  CHECK(sender.request("SETUP", TCP_TRANSPORT) == 200);
+  CHECK(sender.request("RECORD") == 200);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).active);
+
+  // Packets arrive and play in real time, one every 8 ms. Each phase streams two seconds.
+  uint16_t seq = 0;
+  const auto stream = [&]() {
+    for (int i = 0; i < 250; i++, seq++) {
+      sender.send_interleaved(rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(static_cast<int16_t>(seq))));
+      host::now_us += 8000;
+      bridge.run_audio();
+    }
+  };
+
+  // The stand-in speaker grows its buffer as it is played, on the audio task, and the count shows it.
+  stream();
+  CHECK(!speaker.played.empty());
+  CHECK(bridge.audio(0).steady_allocations > 0);
+
+  // With the speaker's buffer reserved up front, everything left is the component's own streaming path.
+  speaker.played.clear();
+  speaker.played.reserve(1 << 20);
+  bridge.audio(0).steady_allocations = 0;
+  stream();
+  CHECK(speaker.played.size() > 200 * FRAMES_PER_PACKET * 4);
+  CHECK(bridge.audio(0).jitter.stats().lost == 0);
+  CHECK(bridge.audio(0).steady_allocations == 0);
+  CHECK(sender.request("TEARDOWN") == 200);
+}
+
+void test_software_volume_publish() {
+  media_player::MediaPlayer player;
+  speaker::Speaker speaker;
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.set_software_volume(true);
+  bridge.set_volume_publish_interval(500);
+  bridge.add_target(&player, "Kitchen", &speaker);
+  bridge.setup();
+  host::now_us += 1000000;
+
+  Sender sender(bridge, port);
+  const auto set_volume = [&](const char *db) {
+    CHECK(sender.request("SET_PARAMETER", "Content-Type: text/parameters\r\n", std::string("volume: ") + db + "\r\n") ==
+          200);
+  };
+  // A slider drag: the first change is published straight away, the rest wait for the interval.
+  set_volume("-15.0");
+  CHECK(player.published_volumes.size() == 1);
+  CHECK(!player.published_volumes.empty() && player.published_volumes.back() == bridge.target(0).last_volume);
+  const float first = bridge.target(0).last_volume;
+  set_volume("-10.0");
+  set_volume("-5.0");
+  CHECK(player.published_volumes.size() == 1);
+  host::now_us += 500000;
+  bridge.run_scheduled();
+  CHECK(player.published_volumes.size() == 2);
+  CHECK(!player.published_volumes.empty() && player.published_volumes.back() == bridge.target(0).last_volume);
+  CHECK(bridge.target(0).last_volume > first);
+  CHECK(bridge.audio(0).target_gain.load() == static_cast<int32_t>(bridge.target(0).last_volume * 32767.0f + 0.5f));
+
+  // The gain is applied in the audio task only: neither the speaker nor a media player call applies it again.
+  CHECK(speaker.volumes.empty());
+  CHECK(std::none_of(player.calls.begin(), player.calls.end(),
+                     [](const media_player::MediaPlayerCall &call) { return call.has_volume; }));
+}
+
+void test_group_leader() {
+  media_player::MediaPlayer players[3];
+  speaker::Speaker speakers[3];
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&players[0], "Kitchen", &speakers[0], "downstairs");
+  bridge.add_target(&players[1], "Dining", &speakers[1], "downstairs");
+  bridge.add_target(&players[2], "Hall", &speakers[2], "downstairs");
+  bridge.setup();
+
+  Sender kitchen(bridge, port);
+  Sender dining(bridge, port + 1);
+  Sender hall(bridge, port + 2);
+  // The first member to start decodes for itself.
+  start_session(kitchen, "2543110914");
+  CHECK(bridge.target(0).follow_leader == -1);
+  // Another session from the same host plays something else, so it is not grouped with the first.
+  start_session(hall, "3810472295");
+  CHECK(bridge.target(2).follow_leader == -1);
+  // The kitchen's session reaching another room is played from the kitchen's decode.
+  start_session(dining, "2543110914");
+  CHECK(bridge.target(1).follow_leader == 0);
+  bridge.run_audio();
+  CHECK(bridge.audio(0).following == -1);
+  CHECK(bridge.audio(1).following == 0);
+  CHECK(bridge.audio(2).following == -1);
+  CHECK(bridge.audio(2).active);
+
+  // The sender streams to both rooms. Only the kitchen's copy is decoded, and both speakers play it.
+  uint16_t seq = 0;
+  const auto stream = [&](int packets, std::initializer_list<Sender *> senders) {
+    for (int i = 0; i < packets; i++, seq++) {
+      const std::vector<uint8_t> packet =
+          rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(static_cast<int16_t>(seq * 100)));
+      for (Sender *sender : senders) {
+        sender->send_interleaved(packet);
+      }
+      host::now_us += 8000;
+      bridge.run_audio();
+    }
+  };
+  stream(50, {&kitchen, &dining});
+  CHECK(bridge.target(1).shared_packets == 50);
+  CHECK(bridge.audio(1).jitter.stats().received == 0);
+  CHECK(!speakers[0].played.empty());
+  CHECK(speakers[1].played == speakers[0].played);
+  CHECK(speakers[2].played.empty());
+
+  // The kitchen stops. The dining room goes back to decoding its own copy and keeps playing.
+  CHECK(kitchen.request("TEARDOWN") == 200);
+  CHECK(bridge.target(1).follow_leader == -1);
+  CHECK(bridge.target(1).streaming);
+  play_out(bridge, 0);
+  CHECK(bridge.audio(1).following == -1);
+  CHECK(bridge.audio(1).active);
+  const size_t followed = speakers[1].played.size();
+  stream(50, {&dining});
+  CHECK(bridge.target(1).shared_packets == 50);
+  CHECK(bridge.audio(1).jitter.stats().received == 50);
+  CHECK(speakers[1].played.size() > followed);
+  CHECK(speakers[1].finishes == 0);
+  CHECK(dining.request("TEARDOWN") == 200);
+  CHECK(hall.request("TEARDOWN") == 200);
+}
+
+void test_group_follower_drift() {
+  media_player::MediaPlayer players[2];
+  speaker::Speaker speakers[2];
+  Bridge bridge;
+  const uint16_t port = next_port_base();
+  bridge.set_port_base(port);
+  bridge.set_stats_interval(0);
+  bridge.add_target(&players[0], "Kitchen", &speakers[0], "downstairs");
+  bridge.add_target(&players[1], "Dining", &speakers[1], "downstairs");
+  bridge.setup();
+
+  Sender kitchen(bridge, port);
+  Sender dining(bridge, port + 1);
+  start_session(kitchen, "2543110914");
+  start_session(dining, "2543110914");
+  bridge.run_audio();
+  CHECK(bridge.audio(1).following == 0);
+
+  // The dining room's speaker runs 300 ppm slower than the kitchen's: in the time the kitchen's plays a
+  // block, it makes room for a little less than that.
+  speakers[1].room = 0;
+  double credit = 0.0;
+  size_t leader_played = 0;
+  uint32_t settled_drops = 0;
+  uint16_t seq = 0;
+  for (int i = 0; i < 12000; i++, seq++) {
+    if (i == 1000) {
+      // Its speaker starts out with no room at all, which costs a few frames before the trim has settled.
+      settled_drops = bridge.audio(1).follower_dropped_bytes;
+    }
+    const std::vector<uint8_t> packet =
+        rtp_packet(seq, seq * FRAMES_PER_PACKET, packet_samples(static_cast<int16_t>(seq * 100)));
+    kitchen.send_interleaved(packet);
+    dining.send_interleaved(packet);
+    host::now_us += 8000;
+    bridge.run_audio();
+    credit += static_cast<double>(speakers[0].played.size() - leader_played) * (1.0 - 300e-6);
+    leader_played = speakers[0].played.size();
+    speakers[1].room += static_cast<size_t>(credit);
+    credit -= static_cast<size_t>(credit);
+  }
+
+  // From then on it keeps up by dropping single frames, and none of the leader's output is given up for it.
+  const Bridge::AudioPipeline &dining_audio = bridge.audio(1);
+  CHECK(dining_audio.following == 0);
+  CHECK(dining_audio.rate_trim_ppm > 150.0f && dining_audio.rate_trim_ppm <= 500.0f);
+  CHECK(settled_drops < 1024);
+  CHECK(dining_audio.follower_dropped_bytes == settled_drops);
+  CHECK(dining_audio.dropped_bytes == settled_drops);
+  CHECK(dining_audio.pending_bytes < speakers[0].played.size() - speakers[1].played.size());
+  CHECK(kitchen.request("TEARDOWN") == 200);
+  CHECK(dining.request("TEARDOWN") == 200);
+}
+
+}  // namespace
+
+int main() {
+  test_reannounce_restarts_stream();
+  test_takeover();
+  test_udp_transport();
+  test_interleaved_fallback();
+  test_udp_drained_between_sessions();
+  test_no_allocations_while_streaming();
+  test_software_volume_publish();
+  test_group_leader();
+  test_group_follower_drift();
+  return test::finish("airplay_bridge_test");
+}
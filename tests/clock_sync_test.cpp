@@ -0,0 +1,103 @@
+// ClockSync against a synthetic sender whose clock is offset and runs fast or slow, with timing exchanges
+// every 3 s over a link with random, asymmetric queueing delay.
+
+#include "clock_sync.h"
+#include "test.h"
+
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+
+using esphome::airplay_bridge::ClockSync;
+
+namespace {
+
+struct Lcg {
+  uint32_t state;
+  uint32_t next() {
+    this->state = this->state * 1664525u + 1013904223u;
+    return this->state >> 8;
+  }
+};
+
+struct Sender {
+  int64_t offset_us;
+  double drift;  // relative rate error, e.g. 100e-6
+  int64_t remote(int64_t local_us) const {
+    return local_us + this->offset_us + static_cast<int64_t>(std::llround(local_us * this->drift));
+  }
+};
+
+// Runs `exchanges` timing exchanges and returns the worst remote_to_local() error over the last few.
+int64_t run(ClockSync &sync, const Sender &sender, int exchanges, uint32_t seed) {
+  Lcg rng{seed};
+  int64_t worst = 0;
+  for (int i = 0; i < exchanges; i++) {
+    const int64_t local_send = 1000000 + static_cast<int64_t>(i) * 3000000;
+    // 1-3 ms each way, plus an occasional 30 ms queueing spike in one direction only.
+    int64_t up = 1000 + rng.next() % 2000;
+    int64_t down = 1000 + rng.next() % 2000;
+    if (rng.next() % 5 == 0) {
+      up += 30000;
+    }
+    const int64_t remote_recv = sender.remote(local_send + up);
+    const int64_t remote_send = remote_recv + 200;
+    const int64_t local_recv = local_send + up + 200 + down;
+    sync.add_exchange(local_send, remote_recv, remote_send, local_recv);
+    if (i >= exchanges - 5) {
+      const int64_t probe_local = local_recv + 1500000;
+      const int64_t error = std::llabs(sync.remote_to_local(sender.remote(probe_local)) - probe_local);
+      if (error > worst) {
+        worst = error;
+      }
+    }
+  }
+  return worst;
+}
+
+void test_offset_only() {
+  ClockSync sync;
+  CHECK(!sync.synchronized());
+  const Sender sender{-123456789, 0.0};
+  const int64_t worst = run(sync, sender, 40, 1);
+  CHECK(sync.synchronized());
+  // Up to 1 ms of per-exchange asymmetry over a two-minute span leaves a few ppm of slope noise.
+  CHECK(std::fabs(sync.drift_ppm()) < 10.0f);
+  // Asymmetry within one exchange is at most 1 ms; the fit averages it down further.
+  CHECK(worst < 1000);
+}
+
+void test_drifting_sender() {
+  for (double ppm : {-200.0, -37.5, 80.0, 200.0}) {
+    ClockSync sync;
+    const Sender sender{987654321, ppm * 1e-6};
+    const int64_t worst = run(sync, sender, 60, 7);
+    CHECK(std::fabs(sync.drift_ppm() - ppm) < 10.0);
+    CHECK(worst < 1000);
+  }
+}
+
+void test_drift_is_clamped() {
+  ClockSync sync;
+  const Sender sender{0, 2000e-6};
+  run(sync, sender, 40, 3);
+  CHECK(sync.drift_ppm() <= 500.0f);
+}
+
+void test_ntp_conversion() {
+  for (int64_t us : {int64_t{0}, int64_t{1}, int64_t{999999}, int64_t{1000000}, int64_t{3913056000123456}}) {
+    CHECK(ClockSync::ntp_to_us(ClockSync::us_to_ntp(us)) == us ||
+          ClockSync::ntp_to_us(ClockSync::us_to_ntp(us)) == us - 1);
+  }
+  CHECK(ClockSync::ntp_to_us(uint64_t{1} << 31) == 500000);
+}
+
+}  // namespace
+
+int main() {
+  test_offset_only();
+  test_drifting_sender();
+  test_drift_is_clamped();
+  test_ntp_conversion();
+  return test::finish("clock_sync_test");
+}
@@ -0,0 +1,129 @@
+// Closes the loop the way the audio task does without sender clock sync: a sender running up to 200 ppm
+// fast or slow fills a JitterBuffer, the buffer level drives DriftController every 5 ms tick, and its trim
+// bends the buffer's timeline once a second. Simulates one hour per case.
+
+#include "drift_controller.h"
+#include "jitter_buffer.h"
+#include "test.h"
+
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+using esphome::airplay_bridge::DriftController;
+using esphome::airplay_bridge::JitterBuffer;
+
+namespace {
+
+const uint32_t SAMPLE_RATE = 44100;
+const uint32_t FRAMES_PER_PACKET = 352;
+const uint32_t LATENCY_FRAMES = 2205;
+const size_t PACKET_SIZE = 12 + 16;
+const int64_t TICK_US = 5000;
+const int64_t TRIM_INTERVAL_US = 1000000;
+const int64_t DURATION_US = 3600LL * 1000000;
+// The loop gets this long to pull in a full 200 ppm step before the error bound applies.
+const int64_t SETTLE_US = 600LL * 1000000;
+
+struct Result {
+  float final_trim_ppm{0.0f};
+  int64_t worst_error_us{0};
+  uint32_t empty_ticks{0};
+  uint32_t played{0};
+  uint32_t sent{0};
+};
+
+Result simulate(double sender_ppm) {
+  JitterBuffer jitter;
+  jitter.allocate((LATENCY_FRAMES + FRAMES_PER_PACKET - 1) / FRAMES_PER_PACKET + 4, PACKET_SIZE);
+  jitter.set_latency(LATENCY_FRAMES, SAMPLE_RATE);
+  DriftController drift;
+  Result result;
+  uint32_t state = 12345;
+  uint8_t packet[PACKET_SIZE] = {0x80, 0x60};
+  int64_t last_trim_us = 0;
+  // Local time at which the sender, on its own clock, sends packet `result.sent`.
+  const double packet_us = FRAMES_PER_PACKET * 1e6 / SAMPLE_RATE / (1.0 + sender_ppm * 1e-6);
+  double next_send_us = 0.0;
+  for (int64_t now = 0; now < DURATION_US; now += TICK_US) {
+    while (next_send_us + 5000.0 <= now) {
+      state = state * 1664525u + 1013904223u;
+      const uint16_t seq = static_cast<uint16_t>(result.sent);
+      const uint32_t timestamp = result.sent * FRAMES_PER_PACKET;
+      packet[2] = seq >> 8;
+      packet[3] = seq & 0xff;
+      packet[4] = timestamp >> 24;
+      packet[5] = (timestamp >> 16) & 0xff;
+      packet[6] = (timestamp >> 8) & 0xff;
+      packet[7] = timestamp & 0xff;
+      // Arrives 5 ms after sending, plus up to 2 ms of jitter (folded into the arrival tick).
+      jitter.insert(packet, PACKET_SIZE, now - static_cast<int64_t>((state >> 8) % 2000));
+      result.sent++;
+      next_send_us += packet_us;
+    }
+    const uint8_t *data;
+    size_t len;
+    uint16_t seq;
+    while (jitter.pop(now, data, len, seq) == JitterBuffer::PopResult::PACKET) {
+      jitter.release();
+      result.played++;
+    }
+    if (jitter.depth() == 0) {
+      // A slow sender the trim fails to follow drains the buffer.
+      if (now >= SETTLE_US) {
+        result.empty_ticks++;
+      }
+      continue;
+    }
+    const int64_t error_us = jitter.buffered_us(now) - jitter.latency_us();
+    drift.update(error_us, now);
+    if (now - last_trim_us >= TRIM_INTERVAL_US) {
+      last_trim_us = now;
+      jitter.set_rate_trim(drift.trim_ppm());
+    }
+    if (now >= SETTLE_US && std::llabs(error_us) > result.worst_error_us) {
+      result.worst_error_us = std::llabs(error_us);
+    }
+  }
+  result.final_trim_ppm = drift.trim_ppm();
+  const JitterBuffer::Stats &stats = jitter.stats();
+  CHECK(stats.resyncs == 0);
+  CHECK(stats.lost == 0);
+  CHECK(stats.late == 0);
+  return result;
+}
+
+void test_tracks_sender_rate() {
+  for (double ppm : {-200.0, -50.0, 0.0, 50.0, 200.0}) {
+    const Result result = simulate(ppm);
+    // The trim settles on the sender's rate error...
+    CHECK(std::fabs(result.final_trim_ppm - ppm) < 10.0);
+    // ...with the buffer held within two packets of its target the whole hour,
+    CHECK(result.worst_error_us < 2 * static_cast<int64_t>(FRAMES_PER_PACKET) * 1000000 / SAMPLE_RATE);
+    CHECK(result.empty_ticks == 0);
+    // and nothing left behind or skipped: 200 ppm over an hour is 720 ms, about 90 packets.
+    CHECK(result.sent - result.played <= 8);
+  }
+}
+
+void test_reset() {
+  DriftController drift;
+  drift.update(10000, 0);
+  drift.update(10000, 1000000);
+  CHECK(drift.trim_ppm() > 0.0f);
+  drift.reset();
+  CHECK(drift.trim_ppm() == 0.0f);
+  // Far off target: the trim is clamped rather than chasing the error arbitrarily fast.
+  for (int64_t t = 0; t <= 60000000; t += 5000) {
+    drift.update(1000000, t);
+  }
+  CHECK(drift.trim_ppm() <= 500.0f);
+}
+
+}  // namespace
+
+int main() {
+  test_tracks_sender_rate();
+  test_reset();
+  return test::finish("drift_controller_test");
+}
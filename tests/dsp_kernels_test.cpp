@@ -0,0 +1,263 @@
+// Checks every DSP kernel, in every backend compiled in, bit for bit against a model written from its
+// definition in wider arithmetic. `--bench` also times each backend's kernels on packet-sized blocks.
+
+#include "dsp_kernels.h"
+#include "test.h"
+
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+using namespace esphome::airplay_bridge;
+
+namespace {
+
+struct Lcg {
+  uint32_t state;
+  uint32_t next() {
+    this->state = this->state * 1664525u + 1013904223u;
+    return this->state;
+  }
+  int16_t sample() { return static_cast<int16_t>(this->next() >> 16); }
+};
+
+// x * gain / 32768 rounded towards minus infinity, saturated to int16.
+int16_t model_scale(int16_t x, int32_t gain) {
+  const int64_t product = static_cast<int64_t>(x) * gain;
+  int64_t scaled = product >= 0 ? product / 32768 : -((-product + 32767) / 32768);
+  if (scaled > 32767) {
+    scaled = 32767;
+  }
+  return static_cast<int16_t>(scaled);
+}
+
+void test_fir(const dsp::Backend &backend) {
+  Lcg rng{1};
+  for (size_t taps : {1, 2, 3, 7, 24, 48, 68, 134}) {
+    std::vector<int16_t> window(taps * 2), coefficients(taps);
+    for (int round = 0; round < 200; round++) {
+      int64_t left = 1 << 14, right = -12345;
+      for (size_t j = 0; j < taps; j++) {
+        window[j * 2] = rng.sample();
+        window[j * 2 + 1] = rng.sample();
+        // Resampler rows sum to 32768, so no tap comes near full scale once there are many of them.
+        coefficients[j] = static_cast<int16_t>(static_cast<int16_t>(rng.next() >> 16) / static_cast<int>(taps));
+        left += static_cast<int64_t>(window[j * 2]) * coefficients[j];
+        right += static_cast<int64_t>(window[j * 2 + 1]) * coefficients[j];
+      }
+      int32_t l = 1 << 14, r = -12345;
+      backend.fir_stereo_q15(window.data(), coefficients.data(), taps, l, r);
+      CHECK(l == left && r == right);
+    }
+  }
+}
+
+void test_gain(const dsp::Backend &backend) {
+  // Every sample value at a spread of gains, including unity, silence and a single step.
+  std::vector<int16_t> all(65536), scaled(65536);
+  for (int32_t i = 0; i < 65536; i++) {
+    all[i] = static_cast<int16_t>(i - 32768);
+  }
+  for (int16_t gain : {int16_t{32767}, int16_t{32766}, int16_t{16384}, int16_t{12345}, int16_t{205}, int16_t{1},
+                       int16_t{0}}) {
+    scaled = all;
+    backend.gain_stereo_q15(scaled.data(), scaled.size() / 2, gain);
+    bool exact = true;
+    for (size_t i = 0; i < all.size(); i++) {
+      exact = exact && scaled[i] == model_scale(all[i], gain);
+    }
+    CHECK(exact);
+  }
+}
+
+void test_gain_ramp(const dsp::Backend &backend) {
+  Lcg rng{2};
+  std::vector<int16_t> samples(1000 * 2), expected;
+  for (auto &sample : samples) {
+    sample = rng.sample();
+  }
+  for (int32_t target : {0, 1000, 32767}) {
+    for (int32_t start : {0, 16384, 32767}) {
+      expected = samples;
+      int32_t model_gain = start;
+      for (size_t i = 0; i < 1000; i++) {
+        const int32_t delta = target - model_gain;
+        model_gain += delta > 205 ? 205 : (delta < -205 ? -205 : delta);
+        expected[i * 2] = model_scale(samples[i * 2], model_gain);
+        expected[i * 2 + 1] = model_scale(samples[i * 2 + 1], model_gain);
+      }
+      std::vector<int16_t> out = samples;
+      int32_t gain = start;
+      backend.gain_ramp_stereo_q15(out.data(), 1000, gain, target, 205);
+      CHECK(out == expected);
+      CHECK(gain == model_gain);
+    }
+  }
+}
+
+void test_downmix(const dsp::Backend &backend) {
+  Lcg rng{3};
+  std::vector<int16_t> stereo(4096 * 2);
+  for (auto &sample : stereo) {
+    sample = rng.sample();
+  }
+  stereo[0] = stereo[1] = -32768;
+  stereo[2] = stereo[3] = 32767;
+  stereo[4] = -1;
+  stereo[5] = 0;
+  std::vector<int16_t> expected(4096);
+  for (size_t i = 0; i < expected.size(); i++) {
+    const int32_t sum = stereo[i * 2] + stereo[i * 2 + 1];
+    // Rounds towards minus infinity, like an arithmetic shift.
+    expected[i] = static_cast<int16_t>(sum >= 0 ? sum / 2 : -((-sum + 1) / 2));
+  }
+  std::vector<int16_t> mono(4096);
+  backend.downmix_to_mono(stereo.data(), mono.data(), mono.size());
+  CHECK(mono == expected);
+  // In place, as output_block_() uses it.
+  backend.downmix_to_mono(stereo.data(), stereo.data(), mono.size());
+  CHECK(std::vector<int16_t>(stereo.begin(), stereo.begin() + 4096) == expected);
+}
+
+void test_conversions(const dsp::Backend &backend) {
+  std::vector<int16_t> all(65536);
+  std::vector<uint8_t> big_endian(65536 * 2);
+  for (int32_t i = 0; i < 65536; i++) {
+    all[i] = static_cast<int16_t>(i - 32768);
+    big_endian[i * 2] = static_cast<uint8_t>(static_cast<uint16_t>(all[i]) >> 8);
+    big_endian[i * 2 + 1] = static_cast<uint8_t>(static_cast<uint16_t>(all[i]));
+  }
+  std::vector<int16_t> decoded(65536);
+  backend.from_big_endian_16(big_endian.data(), decoded.data(), decoded.size());
+  CHECK(decoded == all);
+
+  std::vector<int32_t> wide(65536);
+  backend.widen_to_int32(all.data(), wide.data(), all.size());
+  bool exact = true;
+  for (size_t i = 0; i < all.size(); i++) {
+    exact = exact && wide[i] == static_cast<int32_t>(all[i]) * 65536;
+  }
+  CHECK(exact);
+}
+
+void test_widen_to_int24(const dsp::Backend &backend) {
+  std::vector<int16_t> all(65536);
+  for (int32_t i = 0; i < 65536; i++) {
+    all[i] = static_cast<int16_t>(i - 32768);
+  }
+  std::vector<uint8_t> packed(65536 * 3);
+  backend.widen_to_int24(all.data(), packed.data(), all.size());
+  bool exact = true;
+  for (size_t i = 0; i < all.size(); i++) {
+    const int32_t value = static_cast<int32_t>(packed[i * 3] | (packed[i * 3 + 1] << 8) | (packed[i * 3 + 2] << 16));
+    // Sign-extend the 24-bit value.
+    exact = exact && (value ^ 0x800000) - 0x800000 == static_cast<int32_t>(all[i]) * 256;
+  }
+  CHECK(exact);
+}
+
+// The dispatching kernels have to be the first backend, whatever the build picked.
+void test_dispatch(const dsp::Backend &first) {
+  Lcg rng{4};
+  std::vector<int16_t> samples(1027 * 2);
+  for (auto &sample : samples) {
+    sample = rng.sample();
+  }
+  std::vector<int16_t> a = samples, b = samples;
+  dsp::gain_stereo_q15(a.data(), 1027, 23456);
+  first.gain_stereo_q15(b.data(), 1027, 23456);
+  CHECK(a == b);
+  int32_t gain_a = 32767, gain_b = 32767;
+  dsp::gain_ramp_stereo_q15(a.data(), 1027, gain_a, 1000, 205);
+  first.gain_ramp_stereo_q15(b.data(), 1027, gain_b, 1000, 205);
+  CHECK(a == b && gain_a == gain_b);
+  int32_t l = 0, r = 0, first_l = 0, first_r = 0;
+  dsp::fir_stereo_q15(samples.data(), samples.data() + 1500, 22, l, r);
+  first.fir_stereo_q15(samples.data(), samples.data() + 1500, 22, first_l, first_r);
+  CHECK(l == first_l && r == first_r);
+  std::vector<int16_t> mono_a(1027), mono_b(1027);
+  dsp::downmix_to_mono(samples.data(), mono_a.data(), 1027);
+  first.downmix_to_mono(samples.data(), mono_b.data(), 1027);
+  CHECK(mono_a == mono_b);
+  std::vector<int32_t> wide_a(2054), wide_b(2054);
+  dsp::widen_to_int32(samples.data(), wide_a.data(), 2054);
+  first.widen_to_int32(samples.data(), wide_b.data(), 2054);
+  CHECK(wide_a == wide_b);
+  std::vector<uint8_t> packed_a(2054 * 3), packed_b(2054 * 3);
+  dsp::widen_to_int24(samples.data(), packed_a.data(), 2054);
+  first.widen_to_int24(samples.data(), packed_b.data(), 2054);
+  CHECK(packed_a == packed_b);
+  dsp::from_big_endian_16(packed_a.data(), a.data(), 2054);
+  first.from_big_endian_16(packed_a.data(), b.data(), 2054);
+  CHECK(a == b);
+}
+
+template<typename F> double ns_per_call(F &&kernel) {
+  const int calls = 200000;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; i++) {
+    kernel();
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+}
+
+// One 352-frame ALAC packet through each kernel, and one 48 kHz resampler row of 48 taps per output frame.
+void bench(const dsp::Backend &backend) {
+  const size_t frames = 352, taps = 48;
+  Lcg rng{5};
+  std::vector<int16_t> samples(frames * 2), coefficients(taps), mono(frames);
+  std::vector<int32_t> wide(frames * 2);
+  std::vector<uint8_t> big_endian(frames * 4);
+  for (auto &sample : samples) {
+    sample = rng.sample();
+  }
+  for (auto &coefficient : coefficients) {
+    coefficient = static_cast<int16_t>(32768 / taps);
+  }
+  for (auto &byte : big_endian) {
+    byte = static_cast<uint8_t>(rng.next() >> 24);
+  }
+  volatile int32_t sink = 0;
+  const double fir = ns_per_call([&] {
+    int32_t l = 0, r = 0;
+    for (size_t i = 0; i + taps <= frames; i++) {
+      backend.fir_stereo_q15(&samples[i * 2], coefficients.data(), taps, l, r);
+    }
+    sink = sink + l + r;
+  });
+  const double gain = ns_per_call([&] { backend.gain_stereo_q15(samples.data(), frames, 32767); });
+  const double downmix = ns_per_call([&] { backend.downmix_to_mono(samples.data(), mono.data(), frames); });
+  const double widen = ns_per_call([&] { backend.widen_to_int32(samples.data(), wide.data(), frames * 2); });
+  const double swap = ns_per_call([&] { backend.from_big_endian_16(big_endian.data(), samples.data(), frames * 2); });
+  std::printf("dsp_kernels bench (%s), ns per %zu-frame packet: fir %.0f (%zu rows of %zu taps), gain %.0f, "
+              "downmix %.0f, widen %.0f, from_big_endian %.0f\n",
+              backend.name, frames, fir, frames - taps + 1, taps, gain, downmix, widen, swap);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t count = 0;
+  const dsp::Backend *backends = dsp::backends(count);
+  CHECK(count >= 1 && std::strcmp(backends[count - 1].name, "scalar") == 0);
+  for (size_t i = 0; i < count; i++) {
+    const int before = test::failures();
+    test_fir(backends[i]);
+    test_gain(backends[i]);
+    test_downmix(backends[i]);
+    test_conversions(backends[i]);
+    test_gain_ramp(backends[i]);
+    test_widen_to_int24(backends[i]);
+    if (test::failures() != before) {
+      std::printf("dsp_kernels_test: backend %s differs from the model\n", backends[i].name);
+    }
+  }
+  test_dispatch(backends[0]);
+  if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+    for (size_t i = 0; i < count; i++) {
+      bench(backends[i]);
+    }
+  }
+  return test::finish("dsp_kernels_test");
+}
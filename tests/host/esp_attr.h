@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for esp_attr.h: there is no IRAM to place code in.
+
+#define IRAM_ATTR
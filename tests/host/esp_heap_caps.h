@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-in for the heap hook part of esp_heap_caps.h. ESP-IDF calls the hook from its allocator when
+// CONFIG_HEAP_USE_HOOKS is set; on the host the test's operator new does.
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps);
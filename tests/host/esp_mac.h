@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for esp_mac.h, with a fixed locally administered MAC.
+
+#include <cstdint>
+#include <cstring>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum { ESP_MAC_WIFI_STA } esp_mac_type_t;
+
+inline esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+  (void) type;
+  static const uint8_t HOST_MAC[6] = {0x02, 0x00, 0x5e, 0x10, 0x20, 0x30};
+  memcpy(mac, HOST_MAC, sizeof(HOST_MAC));
+  return ESP_OK;
+}
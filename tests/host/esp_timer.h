@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for esp_timer: a clock the tests set and advance by hand. millis() runs from it too.
+
+#include <cstdint>
+
+namespace host {
+inline int64_t now_us = 0;
+}  // namespace host
+
+inline int64_t esp_timer_get_time() { return host::now_us; }
@@ -0,0 +1,25 @@
+#pragma once
+
+// Host stand-in for ESPHome's AudioStreamInfo.
+
+#include <cstdint>
+
+namespace esphome {
+namespace audio {
+
+class AudioStreamInfo {
+ public:
+  AudioStreamInfo(uint8_t bits_per_sample = 16, uint8_t channels = 1, uint32_t sample_rate = 16000)
+      : bits_per_sample_(bits_per_sample), channels_(channels), sample_rate_(sample_rate) {}
+  uint8_t get_bits_per_sample() const { return this->bits_per_sample_; }
+  uint8_t get_channels() const { return this->channels_; }
+  uint32_t get_sample_rate() const { return this->sample_rate_; }
+
+ protected:
+  uint8_t bits_per_sample_;
+  uint8_t channels_;
+  uint32_t sample_rate_;
+};
+
+}  // namespace audio
+}  // namespace esphome
@@ -0,0 +1,63 @@
+#pragma once
+
+// Host stand-in for ESPHome's MediaPlayer: it records the calls made on it and the states it publishes.
+
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace media_player {
+
+enum MediaPlayerCommand : uint8_t {
+  MEDIA_PLAYER_COMMAND_PLAY = 0,
+  MEDIA_PLAYER_COMMAND_PAUSE = 1,
+  MEDIA_PLAYER_COMMAND_STOP = 2,
+};
+
+class MediaPlayer;
+
+class MediaPlayerCall {
+ public:
+  explicit MediaPlayerCall(MediaPlayer *parent) : parent_(parent) {}
+  MediaPlayerCall &set_command(MediaPlayerCommand command) {
+    this->has_command = true;
+    this->command = command;
+    return *this;
+  }
+  MediaPlayerCall &set_media_url(const std::string &url) {
+    this->media_url = url;
+    return *this;
+  }
+  MediaPlayerCall &set_volume(float volume) {
+    this->has_volume = true;
+    this->volume = volume;
+    return *this;
+  }
+  void perform();
+
+  bool has_command{false};
+  MediaPlayerCommand command{MEDIA_PLAYER_COMMAND_PLAY};
+  std::string media_url;
+  bool has_volume{false};
+  float volume{0.0f};
+
+ protected:
+  MediaPlayer *parent_;
+};
+
+class MediaPlayer {
+ public:
+  std::string get_name() const { return this->name; }
+  MediaPlayerCall make_call() { return MediaPlayerCall(this); }
+  void publish_state() { this->published_volumes.push_back(this->volume); }
+
+  float volume{1.0f};
+  std::string name;
+  std::vector<MediaPlayerCall> calls;
+  std::vector<float> published_volumes;
+};
+
+inline void MediaPlayerCall::perform() { this->parent_->calls.push_back(*this); }
+
+}  // namespace media_player
+}  // namespace esphome
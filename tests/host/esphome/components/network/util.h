@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for ESPHome's network helpers: the device is at 127.0.0.1.
+
+#include <array>
+#include <string>
+
+namespace esphome {
+namespace network {
+
+class IPAddress {
+ public:
+  IPAddress() = default;
+  explicit IPAddress(const std::string &address) : address_(address) {}
+  bool is_set() const { return !this->address_.empty(); }
+  std::string str() const { return this->address_; }
+
+ protected:
+  std::string address_;
+};
+
+using IPAddresses = std::array<IPAddress, 5>;
+
+inline IPAddresses get_ip_addresses() { return {IPAddress("127.0.0.1")}; }
+inline std::string get_use_address() { return "127.0.0.1"; }
+
+}  // namespace network
+}  // namespace esphome
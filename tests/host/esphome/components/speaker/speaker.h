@@ -0,0 +1,40 @@
+#pragma once
+
+// Host stand-in for ESPHome's Speaker: it keeps what it is played, up to `room` bytes until the test
+// makes room again, and records volume and state changes.
+
+#include "esphome/components/audio/audio.h"
+#include "esphome/core/component.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace speaker {
+
+class Speaker : public Component {
+ public:
+  size_t play(const uint8_t *data, size_t length) {
+    const size_t taken = std::min(length, this->room);
+    this->played.insert(this->played.end(), data, data + taken);
+    this->room -= taken;
+    return taken;
+  }
+  void start() { this->starts++; }
+  void finish() { this->finishes++; }
+  bool has_buffered_data() const { return !this->played.empty(); }
+  void set_volume(float volume) { this->volumes.push_back(volume); }
+  void set_audio_stream_info(const audio::AudioStreamInfo &info) { this->stream_info = info; }
+
+  size_t room{SIZE_MAX};
+  std::vector<uint8_t> played;
+  std::vector<float> volumes;
+  audio::AudioStreamInfo stream_info;
+  int starts{0};
+  int finishes{0};
+};
+
+}  // namespace speaker
+}  // namespace esphome
@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stand-in for the parts of ESPHome's Application the component uses: the device name and socket
+// registration, recording what is registered.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+class Application {
+ public:
+  const std::string &get_name() const { return this->name; }
+
+  bool register_socket_fd(int fd) {
+    this->socket_fds.push_back(fd);
+    return true;
+  }
+  void unregister_socket_fd(int fd) {
+    this->socket_fds.erase(std::remove(this->socket_fds.begin(), this->socket_fds.end(), fd), this->socket_fds.end());
+  }
+
+  std::string name{"host"};
+  std::vector<int> socket_fds;
+};
+
+inline Application App;
+
+}  // namespace esphome
@@ -0,0 +1,77 @@
+#pragma once
+
+// Host stand-in for ESPHome's Component. Named timeouts and intervals are kept rather than scheduled;
+// run_scheduled() runs the ones due on the test clock, as the scheduler would from the main loop.
+
+#include "esphome/core/hal.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+namespace setup_priority {
+inline const float AFTER_WIFI = 250.0f;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+
+  /// Runs every timeout and interval that is due, as the scheduler would.
+  void run_scheduled() {
+    const uint32_t now = millis();
+    for (size_t i = 0; i < this->scheduled_.size();) {
+      Scheduled &item = this->scheduled_[i];
+      if (now - item.start_ms < item.delay_ms) {
+        i++;
+        continue;
+      }
+      std::function<void()> callback = item.callback;
+      if (item.repeat) {
+        item.start_ms = now;
+        i++;
+      } else {
+        this->scheduled_.erase(this->scheduled_.begin() + i);
+      }
+      callback();
+    }
+  }
+
+ protected:
+  struct Scheduled {
+    std::string name;
+    uint32_t start_ms;
+    uint32_t delay_ms;
+    bool repeat;
+    std::function<void()> callback;
+  };
+
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+    this->schedule_(name, timeout, false, std::move(f));
+  }
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+    this->schedule_(name, interval, true, std::move(f));
+  }
+
+  void schedule_(const std::string &name, uint32_t delay, bool repeat, std::function<void()> &&f) {
+    // Like ESPHome, a new timeout or interval replaces one of the same name.
+    for (auto it = this->scheduled_.begin(); it != this->scheduled_.end(); ++it) {
+      if (it->name == name) {
+        this->scheduled_.erase(it);
+        break;
+      }
+    }
+    this->scheduled_.push_back(Scheduled{name, millis(), delay, repeat, std::move(f)});
+  }
+
+  std::vector<Scheduled> scheduled_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for ESPHome's generated defines.h: the tests build the esp-idf variant of the component for
+// an ESP32, with the core's socket registration available.
+
+#define USE_ESP32
+#define USE_ESP_IDF
+#define USE_SOCKET_SELECT_SUPPORT
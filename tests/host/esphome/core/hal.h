@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for ESPHome's hal.h, on the test clock from esp_timer.h.
+
+#include <esp_timer.h>
+
+#include <cstdint>
+
+namespace esphome {
+
+inline uint32_t millis() { return static_cast<uint32_t>(host::now_us / 1000); }
+
+}  // namespace esphome
@@ -0,0 +1,62 @@
+#pragma once
+
+// Host stand-in for the parts of ESPHome's helpers.h the component uses.
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <random>
+#include <string>
+
+namespace esphome {
+
+template<class T> class RAMAllocator {
+ public:
+  enum Flags : uint8_t { NONE = 0, ALLOC_INTERNAL = 1 << 1 };
+
+  RAMAllocator() = default;
+  explicit RAMAllocator(uint8_t flags) { (void) flags; }
+
+  T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::nothrow)); }
+  void deallocate(T *p, size_t n) {
+    (void) n;
+    ::operator delete(p);
+  }
+};
+
+template<typename T> const T &clamp(const T &value, const T &min, const T &max) {
+  return value < min ? min : (max < value ? max : value);
+}
+
+inline uint32_t random_uint32() {
+  static std::mt19937 rng(1);
+  return static_cast<uint32_t>(rng());
+}
+
+/// Like ESPHome's: at most `len` characters.
+inline std::string __attribute__((format(printf, 1, 3))) str_snprintf(const char *fmt, size_t len, ...) {
+  std::string out(len, '\0');
+  va_list args;
+  va_start(args, len);
+  const int written = vsnprintf(&out[0], len + 1, fmt, args);
+  va_end(args);
+  out.resize(written < 0 ? 0 : std::min(static_cast<size_t>(written), len));
+  return out;
+}
+
+inline std::string __attribute__((format(printf, 1, 2))) str_sprintf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  const int length = vsnprintf(nullptr, 0, fmt, args);
+  va_end(args);
+  std::string out(length < 0 ? 0 : static_cast<size_t>(length), '\0');
+  va_start(args, fmt);
+  vsnprintf(&out[0], out.size() + 1, fmt, args);
+  va_end(args);
+  return out;
+}
+
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in for ESPHome's logging. Messages are checked like printf formats and printed only when
+// AIRPLAY_TEST_LOG is set in the environment.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+namespace esphome {
+
+inline void __attribute__((format(printf, 3, 4))) host_log(char level, const char *tag, const char *format, ...) {
+  static const bool enabled = std::getenv("AIRPLAY_TEST_LOG") != nullptr;
+  if (!enabled) {
+    return;
+  }
+  std::printf("[%c][%s] ", level, tag);
+  va_list args;
+  va_start(args, format);
+  std::vprintf(format, args);
+  va_end(args);
+  std::printf("\n");
+}
+
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) esphome::host_log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esphome::host_log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esphome::host_log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esphome::host_log('D', tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esphome::host_log('V', tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) esphome::host_log('C', tag, __VA_ARGS__)
+#define YESNO(b) ((b) ? "YES" : "NO")
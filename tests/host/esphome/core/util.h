@@ -0,0 +1,3 @@
+#pragma once
+
+// Host stand-in for ESPHome's util.h; the component needs nothing from it here.
@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS basics the component uses.
+
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
@@ -0,0 +1,46 @@
+#pragma once
+
+// Host stand-in for FreeRTOS tasks. Creating a task only records it: the tests run the audio task's steps
+// themselves, on their own thread, so each test decides exactly when the consumer side runs. While they do,
+// host::current_task says which task is running, for xTaskGetCurrentTaskHandle().
+
+#include "freertos/FreeRTOS.h"
+
+#include <cstdint>
+
+struct HostTask {
+  void (*function)(void *);
+  void *arg;
+  uint32_t notifications;
+};
+typedef HostTask *TaskHandle_t;
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+namespace host {
+inline HostTask created_task{nullptr, nullptr, 0};
+inline TaskHandle_t current_task = nullptr;
+}  // namespace host
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*function)(void *), const char *name, uint32_t stack_size, void *arg,
+                                          uint32_t priority, TaskHandle_t *handle, BaseType_t core) {
+  (void) name;
+  (void) stack_size;
+  (void) priority;
+  (void) core;
+  host::created_task = HostTask{function, arg, 0};
+  *handle = &host::created_task;
+  return pdPASS;
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) { task->notifications++; }
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return host::current_task; }
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+  (void) clear_on_exit;
+  (void) ticks_to_wait;
+  const uint32_t count = host::created_task.notifications;
+  host::created_task.notifications = 0;
+  return count;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// Host stand-in for mbedTLS's AES, over OpenSSL's EVP AES-128-CBC with padding off. Like mbedTLS,
+// mbedtls_aes_crypt_cbc() leaves `iv` at the last ciphertext block, so consecutive calls chain.
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <cstring>
+
+#define MBEDTLS_AES_ENCRYPT 1
+#define MBEDTLS_AES_DECRYPT 0
+#define MBEDTLS_ERR_AES_INVALID_KEY_LENGTH -0x0020
+#define MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH -0x0022
+#define MBEDTLS_ERR_AES_BAD_INPUT_DATA -0x0021
+
+struct mbedtls_aes_context {
+  EVP_CIPHER_CTX *evp;
+};
+
+inline void mbedtls_aes_init(mbedtls_aes_context *ctx) { ctx->evp = EVP_CIPHER_CTX_new(); }
+inline void mbedtls_aes_free(mbedtls_aes_context *ctx) {
+  EVP_CIPHER_CTX_free(ctx->evp);
+  ctx->evp = nullptr;
+}
+
+inline int mbedtls_aes_setkey_dec(mbedtls_aes_context *ctx, const unsigned char *key, unsigned int keybits) {
+  if (keybits != 128) {
+    return MBEDTLS_ERR_AES_INVALID_KEY_LENGTH;
+  }
+  if (EVP_DecryptInit_ex(ctx->evp, EVP_aes_128_cbc(), nullptr, key, nullptr) != 1) {
+    return MBEDTLS_ERR_AES_BAD_INPUT_DATA;
+  }
+  EVP_CIPHER_CTX_set_padding(ctx->evp, 0);
+  return 0;
+}
+
+inline int mbedtls_aes_crypt_cbc(mbedtls_aes_context *ctx, int mode, size_t length, unsigned char iv[16],
+                                 const unsigned char *input, unsigned char *output) {
+  if (mode != MBEDTLS_AES_DECRYPT) {
+    return MBEDTLS_ERR_AES_BAD_INPUT_DATA;
+  }
+  if (length % 16 != 0) {
+    return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  // Taken before decrypting, which may be in place.
+  unsigned char next_iv[16];
+  memcpy(next_iv, input + length - 16, sizeof(next_iv));
+  int written = 0;
+  if (EVP_DecryptInit_ex(ctx->evp, nullptr, nullptr, nullptr, iv) != 1 ||
+      EVP_DecryptUpdate(ctx->evp, output, &written, input, static_cast<int>(length)) != 1 ||
+      static_cast<size_t>(written) != length) {
+    return MBEDTLS_ERR_AES_BAD_INPUT_DATA;
+  }
+  memcpy(iv, next_iv, sizeof(next_iv));
+  return 0;
+}
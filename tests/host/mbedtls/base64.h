@@ -0,0 +1,80 @@
+#pragma once
+
+// Host stand-in for mbedTLS's base64, with its buffer rules: decoding reports the size needed when `dst`
+// is too small, and encoding needs room for a terminating NUL that it does not count in `olen`.
+
+#include <cstddef>
+#include <cstdint>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL -0x002A
+#define MBEDTLS_ERR_BASE64_INVALID_CHARACTER -0x002C
+
+inline int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src,
+                                 size_t slen) {
+  static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const size_t needed = (slen + 2) / 3 * 4;
+  if (dlen < needed + 1) {
+    *olen = needed + 1;
+    return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+  }
+  size_t o = 0;
+  for (size_t i = 0; i < slen; i += 3) {
+    const uint32_t b = (src[i] << 16) | (i + 1 < slen ? src[i + 1] << 8 : 0) | (i + 2 < slen ? src[i + 2] : 0);
+    dst[o++] = ALPHABET[(b >> 18) & 63];
+    dst[o++] = ALPHABET[(b >> 12) & 63];
+    dst[o++] = i + 1 < slen ? ALPHABET[(b >> 6) & 63] : '=';
+    dst[o++] = i + 2 < slen ? ALPHABET[b & 63] : '=';
+  }
+  dst[o] = '\0';
+  *olen = o;
+  return 0;
+}
+
+inline int mbedtls_base64_decode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src,
+                                 size_t slen) {
+  auto value = [](unsigned char c) -> int {
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int i = 0; i < 64; i++) {
+      if (ALPHABET[i] == c) {
+        return i;
+      }
+    }
+    return -1;
+  };
+  size_t digits = 0, padding = 0;
+  for (size_t i = 0; i < slen; i++) {
+    if (src[i] == '=') {
+      padding++;
+    } else if (padding > 0 || value(src[i]) < 0) {
+      return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    } else {
+      digits++;
+    }
+  }
+  if (padding > 2 || (digits + padding) % 4 != 0) {
+    return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+  }
+  const size_t needed = (digits + padding) / 4 * 3 - padding;
+  if (dst == nullptr || dlen < needed) {
+    *olen = needed;
+    return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+  }
+  uint32_t bits = 0;
+  size_t count = 0, o = 0;
+  for (size_t i = 0; i < digits; i++) {
+    bits = (bits << 6) | static_cast<uint32_t>(value(src[i]));
+    if (++count % 4 == 0) {
+      dst[o++] = static_cast<unsigned char>(bits >> 16);
+      dst[o++] = static_cast<unsigned char>(bits >> 8);
+      dst[o++] = static_cast<unsigned char>(bits);
+    }
+  }
+  if (count % 4 == 3) {
+    dst[o++] = static_cast<unsigned char>(bits >> 10);
+    dst[o++] = static_cast<unsigned char>(bits >> 2);
+  } else if (count % 4 == 2) {
+    dst[o++] = static_cast<unsigned char>(bits >> 4);
+  }
+  *olen = o;
+  return 0;
+}
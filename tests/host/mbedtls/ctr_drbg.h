@@ -0,0 +1,26 @@
+#pragma once
+
+// Host stand-in for mbedTLS's CTR_DRBG, drawing from OpenSSL's RNG. Seeding only checks the entropy source.
+
+#include <openssl/rand.h>
+
+#include <cstddef>
+
+struct mbedtls_ctr_drbg_context {};
+
+inline void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx) { (void) ctx; }
+inline void mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx) { (void) ctx; }
+
+inline int mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context *ctx, int (*f_entropy)(void *, unsigned char *, size_t),
+                                 void *p_entropy, const unsigned char *custom, size_t len) {
+  (void) ctx;
+  (void) custom;
+  (void) len;
+  unsigned char seed[32];
+  return f_entropy(p_entropy, seed, sizeof(seed));
+}
+
+inline int mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t output_len) {
+  (void) p_rng;
+  return RAND_bytes(output, static_cast<int>(output_len)) == 1 ? 0 : -0x0034;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Host stand-in for mbedTLS's entropy source, drawing from OpenSSL's RNG.
+
+#include <openssl/rand.h>
+
+#include <cstddef>
+
+struct mbedtls_entropy_context {};
+
+inline void mbedtls_entropy_init(mbedtls_entropy_context *ctx) { (void) ctx; }
+inline void mbedtls_entropy_free(mbedtls_entropy_context *ctx) { (void) ctx; }
+
+inline int mbedtls_entropy_func(void *data, unsigned char *output, size_t len) {
+  (void) data;
+  return RAND_bytes(output, static_cast<int>(len)) == 1 ? 0 : -0x003C;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for the message digest identifiers of mbedTLS's md.h.
+
+typedef enum {
+  MBEDTLS_MD_NONE = 0,
+  MBEDTLS_MD_SHA1 = 4,
+} mbedtls_md_type_t;
@@ -0,0 +1,67 @@
+#pragma once
+
+// Host stand-in for the key parsing of mbedTLS's pk.h, over OpenSSL. Only RSA keys are supported; the
+// parsed key is reached through mbedtls_pk_rsa() as in mbedTLS.
+
+#include "rsa.h"
+
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <cstddef>
+#include <cstring>
+
+#define MBEDTLS_ERR_PK_KEY_INVALID_FORMAT -0x3D00
+
+typedef enum {
+  MBEDTLS_PK_NONE = 0,
+  MBEDTLS_PK_RSA = 1,
+} mbedtls_pk_type_t;
+
+struct mbedtls_pk_context {
+  mbedtls_rsa_context *rsa;
+};
+
+inline void mbedtls_pk_init(mbedtls_pk_context *ctx) { ctx->rsa = nullptr; }
+
+inline void mbedtls_pk_free(mbedtls_pk_context *ctx) {
+  if (ctx->rsa != nullptr) {
+    EVP_PKEY_free(ctx->rsa->key);
+    delete ctx->rsa;
+    ctx->rsa = nullptr;
+  }
+}
+
+/// Like mbedTLS, PEM input has to be NUL-terminated with the NUL counted in `keylen`; anything else is
+/// read as DER.
+inline int mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen,
+                                const unsigned char *pwd, size_t pwdlen,
+                                int (*f_rng)(void *, unsigned char *, size_t), void *p_rng) {
+  (void) pwd;
+  (void) pwdlen;
+  (void) f_rng;
+  (void) p_rng;
+  EVP_PKEY *parsed = nullptr;
+  if (keylen > 0 && key[keylen - 1] == '\0' && strstr(reinterpret_cast<const char *>(key), "-----BEGIN") != nullptr) {
+    BIO *bio = BIO_new_mem_buf(key, static_cast<int>(keylen - 1));
+    parsed = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+  } else {
+    const unsigned char *der = key;
+    parsed = d2i_AutoPrivateKey(nullptr, &der, static_cast<long>(keylen));
+  }
+  if (parsed == nullptr) {
+    return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+  }
+  mbedtls_pk_free(ctx);
+  ctx->rsa = new mbedtls_rsa_context;
+  ctx->rsa->key = parsed;
+  return 0;
+}
+
+inline int mbedtls_pk_can_do(const mbedtls_pk_context *ctx, mbedtls_pk_type_t type) {
+  return type == MBEDTLS_PK_RSA && ctx->rsa != nullptr && EVP_PKEY_get_base_id(ctx->rsa->key) == EVP_PKEY_RSA;
+}
+
+inline mbedtls_rsa_context *mbedtls_pk_rsa(const mbedtls_pk_context pk) { return pk.rsa; }
@@ -0,0 +1,83 @@
+#pragma once
+
+// Host stand-in for the RSA operations of mbedTLS's rsa.h that raop_crypto.cpp uses, over OpenSSL's
+// EVP_PKEY: raw PKCS#1 v1.5 signing (MBEDTLS_MD_NONE) and RSAES-OAEP decryption. Anything else fails with
+// MBEDTLS_ERR_RSA_BAD_INPUT_DATA.
+
+#include "md.h"
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include <cstddef>
+#include <cstring>
+
+#define MBEDTLS_RSA_PKCS_V15 0
+#define MBEDTLS_RSA_PKCS_V21 1
+#define MBEDTLS_ERR_RSA_BAD_INPUT_DATA -0x4080
+#define MBEDTLS_ERR_RSA_PRIVATE_FAILED -0x4300
+#define MBEDTLS_ERR_RSA_OUTPUT_TOO_LARGE -0x4400
+
+struct mbedtls_rsa_context {
+  EVP_PKEY *key{nullptr};
+  int padding{MBEDTLS_RSA_PKCS_V15};
+  mbedtls_md_type_t hash_id{MBEDTLS_MD_NONE};
+};
+
+inline int mbedtls_rsa_set_padding(mbedtls_rsa_context *ctx, int padding, mbedtls_md_type_t hash_id) {
+  ctx->padding = padding;
+  ctx->hash_id = hash_id;
+  return 0;
+}
+
+inline size_t mbedtls_rsa_get_len(const mbedtls_rsa_context *ctx) {
+  return static_cast<size_t>(EVP_PKEY_get_size(ctx->key));
+}
+
+inline int mbedtls_rsa_pkcs1_sign(mbedtls_rsa_context *ctx, int (*f_rng)(void *, unsigned char *, size_t),
+                                  void *p_rng, mbedtls_md_type_t md_alg, unsigned int hashlen,
+                                  const unsigned char *hash, unsigned char *sig) {
+  (void) f_rng;
+  (void) p_rng;
+  if (ctx->padding != MBEDTLS_RSA_PKCS_V15 || md_alg != MBEDTLS_MD_NONE) {
+    return MBEDTLS_ERR_RSA_BAD_INPUT_DATA;
+  }
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new(ctx->key, nullptr);
+  size_t length = mbedtls_rsa_get_len(ctx);
+  // With no signature digest set, OpenSSL pads and signs the bytes as they are, like MBEDTLS_MD_NONE.
+  const bool ok = pctx != nullptr && EVP_PKEY_sign_init(pctx) == 1 &&
+                  EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) == 1 &&
+                  EVP_PKEY_sign(pctx, sig, &length, hash, hashlen) == 1;
+  EVP_PKEY_CTX_free(pctx);
+  return ok ? 0 : MBEDTLS_ERR_RSA_PRIVATE_FAILED;
+}
+
+inline int mbedtls_rsa_rsaes_oaep_decrypt(mbedtls_rsa_context *ctx, int (*f_rng)(void *, unsigned char *, size_t),
+                                          void *p_rng, const unsigned char *label, size_t label_len, size_t *olen,
+                                          const unsigned char *input, unsigned char *output, size_t output_max_len) {
+  (void) f_rng;
+  (void) p_rng;
+  (void) label;
+  if (ctx->padding != MBEDTLS_RSA_PKCS_V21 || ctx->hash_id != MBEDTLS_MD_SHA1 || label_len != 0) {
+    return MBEDTLS_ERR_RSA_BAD_INPUT_DATA;
+  }
+  const size_t key_length = mbedtls_rsa_get_len(ctx);
+  unsigned char plain[512];
+  size_t length = sizeof(plain);
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new(ctx->key, nullptr);
+  const bool ok = key_length <= sizeof(plain) && pctx != nullptr && EVP_PKEY_decrypt_init(pctx) == 1 &&
+                  EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_OAEP_PADDING) == 1 &&
+                  EVP_PKEY_CTX_set_rsa_oaep_md(pctx, EVP_sha1()) == 1 &&
+                  EVP_PKEY_CTX_set_rsa_mgf1_md(pctx, EVP_sha1()) == 1 &&
+                  EVP_PKEY_decrypt(pctx, plain, &length, input, key_length) == 1;
+  EVP_PKEY_CTX_free(pctx);
+  if (!ok) {
+    return MBEDTLS_ERR_RSA_PRIVATE_FAILED;
+  }
+  if (length > output_max_len) {
+    return MBEDTLS_ERR_RSA_OUTPUT_TOO_LARGE;
+  }
+  memcpy(output, plain, length);
+  *olen = length;
+  return 0;
+}
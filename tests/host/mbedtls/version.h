@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in for mbedTLS: the tests build raop_crypto.cpp against the 3.x API that ESP-IDF ships,
+// implemented over the build host's OpenSSL.
+
+#define MBEDTLS_VERSION_MAJOR 3
@@ -0,0 +1,38 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF mDNS component: services are counted, not announced.
+
+#include <esp_mac.h>
+
+#include <cstddef>
+#include <cstdint>
+
+typedef struct {
+  const char *key;
+  const char *value;
+} mdns_txt_item_t;
+
+namespace host {
+inline int mdns_services = 0;
+}  // namespace host
+
+inline esp_err_t mdns_init() { return ESP_OK; }
+inline esp_err_t mdns_hostname_set(const char *hostname) {
+  (void) hostname;
+  return ESP_OK;
+}
+inline esp_err_t mdns_instance_name_set(const char *instance_name) {
+  (void) instance_name;
+  return ESP_OK;
+}
+inline esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto,
+                                  uint16_t port, mdns_txt_item_t txt[], size_t num_items) {
+  (void) instance_name;
+  (void) service_type;
+  (void) proto;
+  (void) port;
+  (void) txt;
+  (void) num_items;
+  host::mdns_services++;
+  return ESP_OK;
+}
@@ -0,0 +1,232 @@
+// HttpStreamServer over loopback: a listener's response starts with the WAV header for 44.1 kHz 16-bit
+// stereo, then every byte the producer writes. A listener that stops reading is moved forward once it falls
+// too far behind, in whole frames, while another listener on the same stream keeps getting every byte.
+
+#include "http_stream.h"
+#include "test.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using esphome::airplay_bridge::HttpStreamServer;
+using esphome::airplay_bridge::SocketMux;
+using esphome::airplay_bridge::StreamRing;
+
+namespace {
+
+const size_t RING_SIZE = 16384;
+const size_t WAV_HEADER_LEN = 44;
+// Frames per write: half of what a listener may fall behind, so one that keeps reading is never skipped.
+const uint32_t BLOCK_FRAMES = RING_SIZE / 2 / 4 / 2;
+
+// A port of its own, offset by the pid so that concurrent runs do not collide.
+uint16_t next_port() {
+  static uint16_t port = static_cast<uint16_t>(40000 + getpid() % 20000);
+  return ++port;
+}
+
+// The server with its ring and socket mux, run the way the bridge's loop runs it.
+struct Server {
+  Server() {
+    CHECK(this->ring.allocate(RING_SIZE, false));
+    this->port = next_port();
+    CHECK(this->http.start(this->port, 4, &this->sockets));
+    this->http.add_stream("Living Room", &this->ring);
+  }
+
+  void loop() {
+    this->sockets.poll(0);
+    this->http.loop();
+  }
+
+  /// Writes `frames` stereo frames, each holding its own number, and runs the loop.
+  void produce(uint32_t frames) {
+    std::vector<uint32_t> block(frames);
+    for (uint32_t &frame : block) {
+      frame = this->next_frame++;
+    }
+    this->ring.write(reinterpret_cast<const uint8_t *>(block.data()), block.size() * sizeof(uint32_t));
+    this->loop();
+  }
+
+  StreamRing ring;
+  SocketMux sockets;
+  HttpStreamServer http;
+  uint16_t port{0};
+  uint32_t next_frame{0};
+};
+
+// A player on a loopback connection. `receive_buffer` caps how much the kernel queues for it while it is
+// not reading.
+class Listener {
+ public:
+  Listener(Server &server, const std::string &path, int receive_buffer = 0) : server_(server) {
+    this->fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (receive_buffer > 0) {
+      setsockopt(this->fd_, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.port);
+    CHECK(connect(this->fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+    fcntl(this->fd_, F_SETFL, fcntl(this->fd_, F_GETFL, 0) | O_NONBLOCK);
+    const std::string request = "GET " + path + " HTTP/1.1\r\nHost: bridge.local\r\nIcy-MetaData: 1\r\n\r\n";
+    CHECK(send(this->fd_, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+  }
+  ~Listener() { close(this->fd_); }
+
+  /// Reads everything that has arrived, running the server's loop a few times first.
+  void read() {
+    for (int i = 0; i < 5; i++) {
+      this->server_.loop();
+      usleep(100);
+    }
+    char chunk[4096];
+    ssize_t got;
+    while ((got = recv(this->fd_, chunk, sizeof(chunk), 0)) > 0) {
+      this->received.append(chunk, static_cast<size_t>(got));
+    }
+  }
+
+  /// The response header, or empty while it is incomplete.
+  std::string header() const {
+    const size_t end = this->received.find("\r\n\r\n");
+    return end == std::string::npos ? std::string() : this->received.substr(0, end + 4);
+  }
+
+  /// The frame numbers in the body after the WAV header.
+  std::vector<uint32_t> frames() const {
+    const size_t start = this->header().size() + WAV_HEADER_LEN;
+    std::vector<uint32_t> out;
+    if (this->header().empty() || this->received.size() < start) {
+      return out;
+    }
+    out.resize((this->received.size() - start) / sizeof(uint32_t));
+    memcpy(out.data(), this->received.data() + start, out.size() * sizeof(uint32_t));
+    return out;
+  }
+
+  std::string received;
+
+ protected:
+  Server &server_;
+  int fd_{-1};
+};
+
+uint32_t le(const std::string &bytes, size_t at, size_t len) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < len; i++) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[at + i])) << (8 * i);
+  }
+  return value;
+}
+
+void test_wav_header() {
+  Server server;
+  Listener listener(server, "/airplay/Living%20Room/3413821438");
+  listener.read();
+  const std::string header = listener.header();
+  CHECK(header.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+  CHECK(header.find("Content-Type: audio/wav\r\n") != std::string::npos);
+  CHECK(header.find("Content-Length") == std::string::npos);
+  CHECK(listener.received.size() == header.size() + WAV_HEADER_LEN);
+  if (listener.received.size() != header.size() + WAV_HEADER_LEN) {
+    return;
+  }
+  const std::string wav = listener.received.substr(header.size());
+  CHECK(wav.compare(0, 4, "RIFF") == 0);
+  CHECK(le(wav, 4, 4) == 0xFFFFFFFF);
+  CHECK(wav.compare(8, 8, "WAVEfmt ") == 0);
+  CHECK(le(wav, 16, 4) == 16);
+  CHECK(le(wav, 20, 2) == 1);
+  CHECK(le(wav, 22, 2) == 2);
+  CHECK(le(wav, 24, 4) == 44100);
+  CHECK(le(wav, 28, 4) == 44100 * 4);
+  CHECK(le(wav, 32, 2) == 4);
+  CHECK(le(wav, 34, 2) == 16);
+  CHECK(wav.compare(36, 4, "data") == 0);
+  CHECK(le(wav, 40, 4) == 0xFFFFFFFF);
+
+  // Audio starts at the newest byte when the listener joined and follows the header directly.
+  server.produce(300);
+  listener.read();
+  const std::vector<uint32_t> frames = listener.frames();
+  CHECK(frames.size() == 300);
+  CHECK(!frames.empty() && frames.front() == 0 && frames.back() == 299);
+
+  // Unknown streams are refused.
+  Listener stranger(server, "/airplay/Attic");
+  stranger.read();
+  CHECK(stranger.header().compare(0, 22, "HTTP/1.1 404 Not Found") == 0);
+}
+
+void test_slow_listener() {
+  Server server;
+  Listener fast(server, "/airplay/living%20room");
+  Listener slow(server, "/airplay/Living+Room", 4096);
+  fast.read();
+  slow.read();
+  CHECK(server.http.client_count() == 2);
+
+  // The slow player stops reading. Once its socket is full the server can no longer send to it, and the
+  // stream goes on without it.
+  uint64_t skipped = 0;
+  // Loopback grows the socket buffers to megabytes, so that takes a while.
+  for (int block = 0; block < 4000 && skipped == 0; block++) {
+    server.produce(BLOCK_FRAMES);
+    fast.read();
+    uint32_t listeners;
+    uint64_t sent;
+    server.http.stream_stats("Living Room", listeners, sent, skipped);
+  }
+  CHECK(skipped > 0);
+  CHECK(skipped % 4 == 0);
+  // Carry on well past the point where the slow listener fell behind.
+  for (int block = 0; block < 20; block++) {
+    server.produce(BLOCK_FRAMES);
+    fast.read();
+  }
+
+  // The fast player got every frame, in order.
+  const std::vector<uint32_t> fast_frames = fast.frames();
+  CHECK(fast_frames.size() == server.next_frame);
+  bool in_order = true;
+  for (size_t i = 0; i < fast_frames.size(); i++) {
+    in_order = in_order && fast_frames[i] == i;
+  }
+  CHECK(in_order);
+
+  // The slow one reads again and gets whole frames: what was queued for it, then a jump to the newest.
+  for (int i = 0; i < 20; i++) {
+    slow.read();
+  }
+  const std::vector<uint32_t> slow_frames = slow.frames();
+  CHECK((slow.received.size() - slow.header().size() - WAV_HEADER_LEN) % 4 == 0);
+  CHECK(slow_frames.size() < server.next_frame);
+  CHECK(!slow_frames.empty() && slow_frames.front() == 0 && slow_frames.back() == server.next_frame - 1);
+  size_t jumps = 0;
+  for (size_t i = 1; i < slow_frames.size(); i++) {
+    CHECK(slow_frames[i] > slow_frames[i - 1]);
+    jumps += slow_frames[i] != slow_frames[i - 1] + 1;
+  }
+  CHECK(jumps > 0);
+}
+
+}  // namespace
+
+int main() {
+  // A listener hanging up must not end the test; on the device, send() on a closed socket just fails.
+  signal(SIGPIPE, SIG_IGN);
+  test_wav_header();
+  test_slow_listener();
+  return test::finish("http_stream_test");
+}
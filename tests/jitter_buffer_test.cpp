@@ -0,0 +1,309 @@
+// Replays synthetic RTP traces through JitterBuffer: a steady 44.1 kHz sender, network jitter, reordering,
+// duplicates and loss, and a sender restarting at a lower sequence number, with playout polled on a 1 ms
+// tick the way the audio task does it.
+
+#include "jitter_buffer.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+using esphome::airplay_bridge::JitterBuffer;
+
+namespace {
+
+const uint32_t SAMPLE_RATE = 44100;
+const uint32_t FRAMES_PER_PACKET = 352;
+const uint32_t LATENCY_FRAMES = 2205;
+const size_t PACKET_SIZE = 12 + FRAMES_PER_PACKET * 4;
+const int64_t TICK_US = 1000;
+
+struct Arrival {
+  int64_t at_us;
+  uint16_t seq;
+  uint32_t timestamp;
+};
+
+struct Trace {
+  std::vector<Arrival> arrivals;
+  uint32_t sent{0};
+  uint32_t dropped{0};
+  uint32_t duplicated{0};
+  uint32_t swapped{0};
+};
+
+struct Replay {
+  int64_t first_play_us{-1};
+  uint32_t played{0};
+  uint32_t lost{0};
+  bool in_order{true};
+  bool early{false};
+};
+
+// Deterministic so that a failure reproduces.
+struct Lcg {
+  uint32_t state;
+  uint32_t next() {
+    this->state = this->state * 1664525u + 1013904223u;
+    return this->state >> 8;
+  }
+  bool chance(uint32_t per_mille) { return this->next() % 1000 < per_mille; }
+};
+
+int64_t send_time_us(uint32_t index) {
+  return static_cast<int64_t>(index) * FRAMES_PER_PACKET * 1000000 / SAMPLE_RATE;
+}
+
+Trace make_trace(uint32_t packets, uint16_t first_seq, uint32_t first_timestamp, uint32_t drop_per_mille,
+                 uint32_t dup_per_mille, uint32_t swap_per_mille, int64_t jitter_us, uint32_t seed) {
+  Trace trace;
+  Lcg rng{seed};
+  trace.sent = packets;
+  for (uint32_t i = 0; i < packets; i++) {
+    const uint16_t seq = static_cast<uint16_t>(first_seq + i);
+    const uint32_t timestamp = first_timestamp + i * FRAMES_PER_PACKET;
+    // Never drop the first packet: the buffer anchors on it, and the test wants a known anchor.
+    if (i != 0 && rng.chance(drop_per_mille)) {
+      trace.dropped++;
+      continue;
+    }
+    const int64_t at = send_time_us(i) + 5000 + static_cast<int64_t>(rng.next() % (jitter_us + 1));
+    trace.arrivals.push_back({at, seq, timestamp});
+    if (rng.chance(dup_per_mille)) {
+      trace.duplicated++;
+      trace.arrivals.push_back({at + 1500, seq, timestamp});
+    }
+  }
+  // Swap neighbours in arrival order, so that a later packet overtakes an earlier one.
+  for (size_t i = 2; i + 1 < trace.arrivals.size(); i++) {
+    if (trace.arrivals[i].seq != trace.arrivals[i + 1].seq && rng.chance(swap_per_mille)) {
+      std::swap(trace.arrivals[i].seq, trace.arrivals[i + 1].seq);
+      std::swap(trace.arrivals[i].timestamp, trace.arrivals[i + 1].timestamp);
+      trace.swapped++;
+      i++;
+    }
+  }
+  std::stable_sort(trace.arrivals.begin(), trace.arrivals.end(),
+                   [](const Arrival &a, const Arrival &b) { return a.at_us < b.at_us; });
+  return trace;
+}
+
+void make_packet(uint8_t *packet, uint16_t seq, uint32_t timestamp) {
+  memset(packet, 0, PACKET_SIZE);
+  packet[0] = 0x80;
+  packet[1] = 0x60;
+  packet[2] = seq >> 8;
+  packet[3] = seq & 0xff;
+  packet[4] = timestamp >> 24;
+  packet[5] = (timestamp >> 16) & 0xff;
+  packet[6] = (timestamp >> 8) & 0xff;
+  packet[7] = timestamp & 0xff;
+  // Payload carries the sequence number so that a mixed-up slot would show.
+  packet[12] = packet[2];
+  packet[13] = packet[3];
+}
+
+// With a `sender_latency_frames`, the timeline is pinned once a second the way sync packets do it: the
+// sender plays packet i `sender_latency_frames` after sending it, starting from `first_timestamp`.
+Replay replay(JitterBuffer &jitter, const Trace &trace, uint32_t sender_latency_frames = 0,
+              uint32_t first_timestamp = 0) {
+  Replay result;
+  uint8_t packet[PACKET_SIZE];
+  size_t next = 0;
+  bool have_seq = false;
+  uint16_t last_seq = 0;
+  const int64_t end_us = trace.arrivals.back().at_us + 4000000;
+  for (int64_t now = 0; now <= end_us; now += TICK_US) {
+    if (sender_latency_frames != 0 && now % 1000000 == 0) {
+      const uint32_t sending = first_timestamp + static_cast<uint32_t>(now * SAMPLE_RATE / 1000000);
+      jitter.set_timeline(sending - sender_latency_frames, now, sender_latency_frames);
+    }
+    while (next < trace.arrivals.size() && trace.arrivals[next].at_us <= now) {
+      make_packet(packet, trace.arrivals[next].seq, trace.arrivals[next].timestamp);
+      jitter.insert(packet, PACKET_SIZE, now);
+      next++;
+    }
+    const uint8_t *data;
+    size_t len;
+    uint16_t seq;
+    for (;;) {
+      const JitterBuffer::PopResult popped = jitter.pop(now, data, len, seq);
+      if (popped == JitterBuffer::PopResult::EMPTY) {
+        break;
+      }
+      if (have_seq && seq != static_cast<uint16_t>(last_seq + 1)) {
+        result.in_order = false;
+      }
+      have_seq = true;
+      last_seq = seq;
+      if (popped == JitterBuffer::PopResult::LOST) {
+        result.lost++;
+        continue;
+      }
+      if (len != PACKET_SIZE || data[12] != (seq >> 8) || data[13] != (seq & 0xff)) {
+        result.in_order = false;
+      }
+      if (!jitter.timeline_pinned()) {
+        // Unpinned, the first packet arrives 5..5+jitter ms in and plays LATENCY later; nothing may play
+        // before its send time plus that latency.
+        const uint32_t index = static_cast<uint16_t>(seq - trace.arrivals.front().seq);
+        if (now < send_time_us(index) + jitter.latency_us()) {
+          result.early = true;
+        }
+      }
+      if (result.played == 0) {
+        result.first_play_us = now;
+      }
+      result.played++;
+      jitter.release();
+    }
+  }
+  return result;
+}
+
+JitterBuffer make_buffer() {
+  JitterBuffer jitter;
+  const size_t latency_packets = (LATENCY_FRAMES + FRAMES_PER_PACKET - 1) / FRAMES_PER_PACKET;
+  jitter.allocate(latency_packets + 4, PACKET_SIZE);
+  jitter.set_latency(LATENCY_FRAMES, SAMPLE_RATE);
+  return jitter;
+}
+
+void test_clean_stream() {
+  JitterBuffer jitter = make_buffer();
+  const Trace trace = make_trace(2000, 1000, 0, 0, 0, 0, 2000, 1);
+  const Replay result = replay(jitter, trace);
+  CHECK(result.played == 2000);
+  CHECK(result.lost == 0);
+  CHECK(result.in_order);
+  CHECK(!result.early);
+  CHECK(jitter.stats().resyncs == 0);
+  CHECK(jitter.depth() == 0);
+}
+
+void test_reorder_duplicates_and_loss() {
+  JitterBuffer jitter = make_buffer();
+  // Starts just below the sequence wrap so that the replay also crosses 65535 -> 0.
+  const Trace trace = make_trace(3000, 64000, 0xfff00000u, 20, 10, 30, 20000, 7);
+  CHECK(trace.dropped > 0 && trace.duplicated > 0 && trace.swapped > 0);
+  const Replay result = replay(jitter, trace);
+  const JitterBuffer::Stats &stats = jitter.stats();
+  CHECK(result.in_order);
+  CHECK(!result.early);
+  CHECK(result.played == trace.sent - trace.dropped);
+  CHECK(result.lost == trace.dropped);
+  CHECK(stats.lost == trace.dropped);
+  CHECK(stats.duplicates == trace.duplicated);
+  CHECK(stats.reordered >= trace.swapped);
+  CHECK(stats.late == 0);
+  CHECK(stats.resyncs == 0);
+}
+
+// A sender latency that fits the slots keeps the sender's own timing.
+void test_pinned_timeline() {
+  JitterBuffer jitter = make_buffer();
+  const uint32_t latency = 3 * FRAMES_PER_PACKET;
+  CHECK(latency <= jitter.max_latency_frames());
+  const Trace trace = make_trace(2000, 500, 123456, 10, 5, 20, 2000, 3);
+  const Replay result = replay(jitter, trace, latency, 123456);
+  CHECK(result.in_order);
+  CHECK(result.played == trace.sent - trace.dropped);
+  CHECK(jitter.stats().resyncs == 0);
+  const int64_t expected = static_cast<int64_t>(latency) * 1000000 / SAMPLE_RATE;
+  CHECK(result.first_play_us >= expected && result.first_play_us <= expected + TICK_US);
+}
+
+// iTunes and AirPlay 1 senders ask for 88200 frames (2 s), others for 11025. Neither fits the slots, so
+// the timeline falls back to the configured latency instead of resyncing on every packet.
+void test_pinned_timeline_long_sender_latency() {
+  for (uint32_t latency : {11025u, 88200u}) {
+    JitterBuffer jitter = make_buffer();
+    CHECK(latency > jitter.max_latency_frames());
+    const Trace trace = make_trace(2000, 500, 0x7ffff000u, 10, 5, 20, 2000, 5);
+    const Replay result = replay(jitter, trace, latency, 0x7ffff000u);
+    CHECK(result.in_order);
+    CHECK(result.played == trace.sent - trace.dropped);
+    CHECK(result.lost == trace.dropped);
+    CHECK(jitter.stats().resyncs == 0);
+    CHECK(result.first_play_us >= jitter.latency_us() && result.first_play_us <= jitter.latency_us() + TICK_US);
+  }
+}
+
+void test_gap_reporting() {
+  JitterBuffer jitter = make_buffer();
+  uint8_t packet[PACKET_SIZE];
+  make_packet(packet, 10, 0);
+  CHECK(jitter.insert(packet, PACKET_SIZE, 0));
+  make_packet(packet, 14, 4 * FRAMES_PER_PACKET);
+  CHECK(jitter.insert(packet, PACKET_SIZE, 1000));
+  uint16_t first, count;
+  int64_t deadline;
+  CHECK(jitter.take_gap(first, count, deadline));
+  CHECK(first == 11 && count == 3);
+  CHECK(deadline == jitter.latency_us() + static_cast<int64_t>(FRAMES_PER_PACKET * 1000000.0 / SAMPLE_RATE));
+  CHECK(!jitter.take_gap(first, count, deadline));
+  jitter.mark_requested(first, count);
+  CHECK(jitter.stats().resend_requested == 3);
+  make_packet(packet, 12, 2 * FRAMES_PER_PACKET);
+  CHECK(jitter.insert(packet, PACKET_SIZE, 2000));
+  CHECK(jitter.stats().resend_satisfied == 1);
+}
+
+void test_flush() {
+  JitterBuffer jitter = make_buffer();
+  uint8_t packet[PACKET_SIZE];
+  for (uint16_t seq = 0; seq < 4; seq++) {
+    make_packet(packet, seq, seq * FRAMES_PER_PACKET);
+    jitter.insert(packet, PACKET_SIZE, seq * 1000);
+  }
+  jitter.flush(100000);
+  CHECK(jitter.depth() == 0);
+  // Still in flight from the old position: dropped.
+  make_packet(packet, 4, 4 * FRAMES_PER_PACKET);
+  CHECK(!jitter.insert(packet, PACKET_SIZE, 5000));
+  CHECK(jitter.stats().flushed == 1);
+  // The new position anchors a fresh timeline, whatever its sequence number.
+  make_packet(packet, 900, 100000);
+  CHECK(jitter.insert(packet, PACKET_SIZE, 6000));
+  const uint8_t *data;
+  size_t len;
+  uint16_t seq;
+  CHECK(jitter.pop(6000, data, len, seq) == JitterBuffer::PopResult::EMPTY);
+  CHECK(jitter.pop(6000 + jitter.latency_us(), data, len, seq) == JitterBuffer::PopResult::PACKET);
+  CHECK(seq == 900);
+}
+
+// A sender restarting without a FLUSH starts over at a lower sequence number. Its packets look late at
+// first, but a buffer's worth of them in a row resyncs instead of dropping everything until the sequence
+// numbers climb back.
+void test_backward_jump() {
+  JitterBuffer jitter = make_buffer();
+  Trace trace = make_trace(2000, 30000, 0, 0, 0, 0, 2000, 11);
+  for (Arrival &arrival : trace.arrivals) {
+    if (arrival.timestamp >= 1000 * FRAMES_PER_PACKET) {
+      arrival.seq = static_cast<uint16_t>(arrival.seq - 29000);
+    }
+  }
+  const Replay result = replay(jitter, trace);
+  const JitterBuffer::Stats &stats = jitter.stats();
+  CHECK(stats.resyncs == 1);
+  CHECK(stats.late == jitter.slot_count() - 1);
+  CHECK(result.played == trace.sent - stats.late);
+  CHECK(result.lost == 0);
+  CHECK(jitter.depth() == 0);
+}
+
+}  // namespace
+
+int main() {
+  test_clean_stream();
+  test_reorder_duplicates_and_loss();
+  test_pinned_timeline();
+  test_pinned_timeline_long_sender_latency();
+  test_gap_reporting();
+  test_flush();
+  test_backward_jump();
+  return test::finish("jitter_buffer_test");
+}
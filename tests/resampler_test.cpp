@@ -0,0 +1,183 @@
+// Resampler quality and throughput: THD+N of a 1 kHz tone, attenuation of a tone above the output Nyquist
+// frequency, frame accounting under a rate trim, and (with --bench) frames per second of the FIR path.
+
+#include "resampler.h"
+#include "test.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using esphome::airplay_bridge::Resampler;
+
+namespace {
+
+const uint32_t IN_RATE = 44100;
+const size_t BLOCK_FRAMES = 352;
+
+std::vector<int16_t> tone(double frequency, double amplitude, size_t frames) {
+  std::vector<int16_t> samples(frames * 2);
+  for (size_t i = 0; i < frames; i++) {
+    const double value = amplitude * 32767.0 * std::sin(2.0 * M_PI * frequency * i / IN_RATE);
+    samples[i * 2] = static_cast<int16_t>(std::lround(value));
+    samples[i * 2 + 1] = static_cast<int16_t>(std::lround(-value));
+  }
+  return samples;
+}
+
+// Feeds `in` through `resampler` in packet-sized blocks, as the audio task does.
+template<typename R> std::vector<int16_t> run(R &resampler, const std::vector<int16_t> &in) {
+  std::vector<int16_t> out;
+  std::vector<int16_t> block(R::max_output_frames(BLOCK_FRAMES) * 2);
+  const size_t frames = in.size() / 2;
+  for (size_t pos = 0; pos < frames; pos += BLOCK_FRAMES) {
+    const size_t count = std::min(BLOCK_FRAMES, frames - pos);
+    const size_t produced = resampler.process(&in[pos * 2], count, block.data());
+    CHECK(produced <= R::max_output_frames(count));
+    out.insert(out.end(), block.begin(), block.begin() + produced * 2);
+  }
+  return out;
+}
+
+// Least-squares fit of DC plus a sine at `frequency` to one channel of `samples`, skipping the filter's
+// start-up. Returns the residual (everything but the tone) relative to the tone, in dB, and the tone's
+// RMS level.
+double thd_n_db(const std::vector<int16_t> &samples, int channel, double frequency, double rate, double &tone_rms) {
+  const size_t skip = 256;
+  const size_t frames = samples.size() / 2;
+  double s[3][3] = {}, b[3] = {};
+  for (size_t i = skip; i < frames; i++) {
+    const double phase = 2.0 * M_PI * frequency * i / rate;
+    const double basis[3] = {std::sin(phase), std::cos(phase), 1.0};
+    const double y = samples[i * 2 + channel];
+    for (int r = 0; r < 3; r++) {
+      b[r] += basis[r] * y;
+      for (int c = 0; c < 3; c++) {
+        s[r][c] += basis[r] * basis[c];
+      }
+    }
+  }
+  // Solve the 3x3 normal equations by Gaussian elimination.
+  for (int p = 0; p < 3; p++) {
+    for (int r = p + 1; r < 3; r++) {
+      const double f = s[r][p] / s[p][p];
+      for (int c = p; c < 3; c++) {
+        s[r][c] -= f * s[p][c];
+      }
+      b[r] -= f * b[p];
+    }
+  }
+  double x[3];
+  for (int r = 2; r >= 0; r--) {
+    double sum = b[r];
+    for (int c = r + 1; c < 3; c++) {
+      sum -= s[r][c] * x[c];
+    }
+    x[r] = sum / s[r][r];
+  }
+  double residual = 0.0;
+  for (size_t i = skip; i < frames; i++) {
+    const double phase = 2.0 * M_PI * frequency * i / rate;
+    const double fit = x[0] * std::sin(phase) + x[1] * std::cos(phase) + x[2];
+    const double error = samples[i * 2 + channel] - fit;
+    residual += error * error;
+  }
+  const double count = static_cast<double>(frames - skip);
+  tone_rms = std::sqrt((x[0] * x[0] + x[1] * x[1]) / 2.0);
+  return 10.0 * std::log10(residual / count / (tone_rms * tone_rms));
+}
+
+double rms(const std::vector<int16_t> &samples, int channel) {
+  const size_t skip = 256;
+  double sum = 0.0;
+  const size_t frames = samples.size() / 2;
+  for (size_t i = skip; i < frames; i++) {
+    sum += static_cast<double>(samples[i * 2 + channel]) * samples[i * 2 + channel];
+  }
+  return std::sqrt(sum / (frames - skip));
+}
+
+template<uint32_t OUT_RATE> void check_quality(double max_thd_n_db, double min_alias_rejection_db) {
+  // Passband: a 1 kHz tone at -6 dBFS comes out at the same level with little else.
+  {
+    Resampler<IN_RATE, OUT_RATE> resampler;
+    resampler.reset();
+    const std::vector<int16_t> out = run(resampler, tone(1000.0, 0.5, IN_RATE));
+    const size_t expected = static_cast<size_t>(OUT_RATE);
+    CHECK(out.size() / 2 + 2 >= expected && out.size() / 2 <= expected + 2);
+    for (int channel = 0; channel < 2; channel++) {
+      double level;
+      const double thd_n = thd_n_db(out, channel, 1000.0, OUT_RATE, level);
+      CHECK(thd_n < max_thd_n_db);
+      CHECK(std::fabs(20.0 * std::log10(level / (0.5 * 32767.0 / std::sqrt(2.0)))) < 0.1);
+    }
+  }
+  // Stopband: a tone between the output Nyquist frequency and the input's must not fold back.
+  if (OUT_RATE < IN_RATE) {
+    const double frequency = std::min(0.75 * OUT_RATE, 0.45 * IN_RATE);
+    Resampler<IN_RATE, OUT_RATE> resampler;
+    resampler.reset();
+    const std::vector<int16_t> in = tone(frequency, 0.5, IN_RATE);
+    const std::vector<int16_t> out = run(resampler, in);
+    CHECK(20.0 * std::log10(rms(out, 0) / rms(in, 0)) < -min_alias_rejection_db);
+  }
+}
+
+template<uint32_t OUT_RATE> void check_trim() {
+  // Consuming 500 ppm faster yields 500 ppm fewer output frames, so playback catches up on the sender.
+  const std::vector<int16_t> in = tone(440.0, 0.5, IN_RATE * 10);
+  Resampler<IN_RATE, OUT_RATE> nominal, trimmed;
+  nominal.reset();
+  trimmed.reset();
+  trimmed.set_trim_ppm(500.0f);
+  const double nominal_frames = run(nominal, in).size() / 2;
+  const double trimmed_frames = run(trimmed, in).size() / 2;
+  const double ppm = (nominal_frames - trimmed_frames) / nominal_frames * 1e6;
+  CHECK(ppm > 450.0 && ppm < 550.0);
+}
+
+template<uint32_t OUT_RATE> void bench() {
+  const std::vector<int16_t> in = tone(1000.0, 0.5, IN_RATE * 20);
+  Resampler<IN_RATE, OUT_RATE> resampler;
+  resampler.reset();
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<int16_t> out = run(resampler, in);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::printf("resampler bench: 44100 -> %u, %u taps x %u phases: %.1f Mframes/s in, %.0fx real time\n",
+              static_cast<unsigned>(OUT_RATE), static_cast<unsigned>(Resampler<IN_RATE, OUT_RATE>::Design::TAPS),
+              static_cast<unsigned>(Resampler<IN_RATE, OUT_RATE>::Design::PHASES), in.size() / 2 / seconds / 1e6,
+              20.0 / seconds);
+  CHECK(!out.empty());
+}
+
+void test_pass_through() {
+  Resampler<IN_RATE, IN_RATE> resampler;
+  resampler.reset();
+  const std::vector<int16_t> in = tone(1000.0, 0.5, IN_RATE);
+  CHECK(run(resampler, in) == in);
+  // A trim drops one frame per 1e6 / ppm.
+  resampler.set_trim_ppm(100.0f);
+  const std::vector<int16_t> long_in = tone(1000.0, 0.5, IN_RATE * 10);
+  const size_t dropped = long_in.size() / 2 - run(resampler, long_in).size() / 2;
+  CHECK(dropped >= 43 && dropped <= 45);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  // Q15 coefficients, 16-bit output and a 60 dB Kaiser design bound how clean the output can be.
+  check_quality<48000>(-70.0, 0.0);
+  check_quality<16000>(-70.0, 65.0);
+  check_quality<22050>(-70.0, 65.0);
+  check_quality<8000>(-70.0, 65.0);
+  check_trim<48000>();
+  check_trim<16000>();
+  test_pass_through();
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench<48000>();
+    bench<16000>();
+    bench<22050>();
+  }
+  return test::finish("resampler_test");
+}
@@ -0,0 +1,237 @@
+// RtspParser against a recorded-style iOS session: whole, pipelined, trickled one byte at a time, and with
+// hostile Content-Length values. `--bench` also times parsing the session and building the replies.
+
+#include "rtsp_parser.h"
+#include "test.h"
+
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+using namespace esphome::airplay_bridge;
+
+namespace {
+
+const char ANNOUNCE_BODY[] =
+    "v=0\r\n"
+    "o=iTunes 3413821438 0 IN IP4 192.168.1.20\r\n"
+    "s=iTunes\r\n"
+    "c=IN IP4 192.168.1.20\r\n"
+    "t=0 0\r\n"
+    "m=audio 0 RTP/AVP 96\r\n"
+    "a=rtpmap:96 AppleLossless\r\n"
+    "a=fmtp:96 352 0 16 40 10 14 2 255 0 0 44100\r\n";
+
+std::string session() {
+  std::string text;
+  text += "OPTIONS * RTSP/1.0\r\n"
+          "CSeq: 0\r\n"
+          "X-Apple-Device-ID: 0xa4d1d2800b68\r\n"
+          "Apple-Challenge: Gyv9jNE+lrW1cJjHBJbIxQ\r\n"
+          "DACP-ID: 14413BE4996FEA4D\r\n"
+          "Active-Remote: 2543110914\r\n"
+          "User-Agent: AirPlay/381.13\r\n\r\n";
+  text += "ANNOUNCE rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 1\r\n"
+          "Content-Type: application/sdp\r\n"
+          "DACP-ID: 14413BE4996FEA4D\r\n"
+          "Active-Remote: 2543110914\r\n"
+          "Content-Length: " +
+          std::to_string(sizeof(ANNOUNCE_BODY) - 1) +
+          "\r\n"
+          "User-Agent: AirPlay/381.13\r\n\r\n";
+  text += ANNOUNCE_BODY;
+  text += "SETUP rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 2\r\n"
+          "Transport: RTP/AVP/UDP;unicast;interleaved=0-1;mode=record;control_port=6001;timing_port=6002\r\n"
+          "User-Agent: AirPlay/381.13\r\n\r\n";
+  text += "RECORD rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 3\r\n"
+          "Session: 1\r\n"
+          "Range: npt=0-\r\n"
+          "RTP-Info: seq=17349;rtptime=1646906298\r\n"
+          "User-Agent: AirPlay/381.13\r\n\r\n";
+  text += "SET_PARAMETER rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 4\r\n"
+          "Session: 1\r\n"
+          "Content-Type: text/parameters\r\n"
+          "Content-Length: 20\r\n\r\n"
+          "volume: -11.123877\r\n";
+  text += "FLUSH rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 5\r\n"
+          "Session: 1\r\n"
+          "RTP-Info: seq=17900;rtptime=1647100000\r\n\r\n";
+  text += "TEARDOWN rtsp://192.168.1.42/3413821438 RTSP/1.0\r\n"
+          "CSeq: 6\r\n"
+          "Session: 1\r\n\r\n";
+  return text;
+}
+
+const char *const METHODS[] = {"OPTIONS", "ANNOUNCE", "SETUP", "RECORD", "SET_PARAMETER", "FLUSH", "TEARDOWN"};
+const size_t REQUEST_COUNT = sizeof(METHODS) / sizeof(METHODS[0]);
+
+struct Seen {
+  std::string method, cseq, challenge, transport, rtp_info, session, dacp_id, active_remote, body;
+};
+
+Seen capture(const RtspRequest &request) {
+  return {std::string(request.method),    std::string(request.cseq),     std::string(request.apple_challenge),
+          std::string(request.transport), std::string(request.rtp_info), std::string(request.session),
+          std::string(request.dacp_id),   std::string(request.active_remote), std::string(request.body)};
+}
+
+// Feeds `text` through a buffer the way the bridge does: append `chunk` bytes, parse everything complete,
+// drop the consumed bytes.
+std::vector<Seen> feed(const std::string &text, size_t chunk) {
+  std::vector<Seen> seen;
+  RtspParser parser;
+  std::string buffer;
+  for (size_t pos = 0; pos < text.size(); pos += chunk) {
+    buffer.append(text, pos, chunk);
+    for (;;) {
+      RtspRequest request;
+      size_t consumed = 0;
+      const RtspParseResult result =
+          parser.parse(reinterpret_cast<const uint8_t *>(buffer.data()), buffer.size(), request, consumed);
+      if (result == RtspParseResult::INCOMPLETE || result == RtspParseResult::TOO_LARGE) {
+        break;
+      }
+      if (result == RtspParseResult::OK) {
+        seen.push_back(capture(request));
+      }
+      buffer.erase(0, consumed);
+    }
+  }
+  CHECK(buffer.empty());
+  return seen;
+}
+
+void check_session(const std::vector<Seen> &seen) {
+  CHECK(seen.size() == REQUEST_COUNT);
+  if (seen.size() != REQUEST_COUNT) {
+    return;
+  }
+  for (size_t i = 0; i < REQUEST_COUNT; i++) {
+    CHECK(seen[i].method == METHODS[i]);
+    CHECK(seen[i].cseq == std::to_string(i));
+  }
+  CHECK(seen[0].challenge == "Gyv9jNE+lrW1cJjHBJbIxQ");
+  CHECK(seen[1].body == ANNOUNCE_BODY);
+  CHECK(seen[1].dacp_id == "14413BE4996FEA4D");
+  CHECK(seen[1].active_remote == "2543110914");
+  CHECK(seen[2].dacp_id.empty());
+  CHECK(seen[2].transport.find("control_port=6001") != std::string::npos);
+  CHECK(seen[3].rtp_info == "seq=17349;rtptime=1646906298");
+  CHECK(seen[3].session == "1");
+  CHECK(seen[4].body == "volume: -11.123877\r\n");
+  CHECK(seen[5].rtp_info == "seq=17900;rtptime=1647100000");
+}
+
+void test_session() {
+  const std::string text = session();
+  check_session(feed(text, text.size()));
+  for (size_t chunk : {1, 2, 3, 7, 64, 1460}) {
+    check_session(feed(text, chunk));
+  }
+}
+
+RtspParseResult parse_once(const std::string &text, size_t max_size, RtspRequest &request, size_t &consumed) {
+  RtspParser parser;
+  parser.set_max_message_size(max_size);
+  return parser.parse(reinterpret_cast<const uint8_t *>(text.data()), text.size(), request, consumed);
+}
+
+void test_content_length_limits() {
+  RtspRequest request;
+  size_t consumed = 0;
+  // Fits exactly.
+  const std::string fits = "SET_PARAMETER * RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 4\r\n\r\nabcd";
+  CHECK(parse_once(fits, fits.size(), request, consumed) == RtspParseResult::OK);
+  CHECK(consumed == fits.size());
+  // One byte more than the buffer can ever hold.
+  const std::string over = "SET_PARAMETER * RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 5\r\n\r\nabcd";
+  CHECK(parse_once(over, over.size(), request, consumed) == RtspParseResult::TOO_LARGE);
+  // Would wrap header_len + Content-Length on a 32-bit size_t.
+  const std::string wrap = "ANNOUNCE * RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 4294967295\r\n\r\n";
+  CHECK(parse_once(wrap, 4096, request, consumed) == RtspParseResult::TOO_LARGE);
+  // Out of uint32_t range, or not a number at all: the message boundary is unknown.
+  const std::string huge = "ANNOUNCE * RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 4294967296\r\n\r\n";
+  CHECK(parse_once(huge, 4096, request, consumed) == RtspParseResult::TOO_LARGE);
+  const std::string junk = "ANNOUNCE * RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 12x\r\n\r\n";
+  CHECK(parse_once(junk, 4096, request, consumed) == RtspParseResult::TOO_LARGE);
+  // A request line without a method is dropped up to its terminator.
+  const std::string malformed = "\r\nCSeq: 1\r\n\r\nOPTIONS * RTSP/1.0\r\n\r\n";
+  CHECK(parse_once(malformed, 4096, request, consumed) == RtspParseResult::MALFORMED);
+  CHECK(consumed == malformed.find("OPTIONS"));
+}
+
+void test_helpers() {
+  uint32_t value = 0;
+  CHECK(parse_uint("4294967295", value) && value == 4294967295u);
+  CHECK(!parse_uint("4294967296", value));
+  CHECK(!parse_uint("", value));
+  CHECK(find_parameter("seq=17349;rtptime=1646906298", "rtptime") == "1646906298");
+  CHECK(find_parameter("RTP/AVP/UDP;unicast;control_port=6001", "timing_port").empty());
+  CHECK(iequals("content-length", "Content-Length"));
+  CHECK(icontains("AppleLossless", "lossless"));
+}
+
+void test_response() {
+  RtspResponse response;
+  response.begin(200, "3");
+  response.header("Session", "1");
+  response.header("Audio-Latency", 2205u);
+  response.finish("x=1\r\n");
+  const std::string text(response.data(), response.size());
+  CHECK(text.rfind("RTSP/1.0 200 OK\r\n", 0) == 0);
+  CHECK(text.find("CSeq: 3\r\n") != std::string::npos);
+  CHECK(text.find("Audio-Latency: 2205\r\n") != std::string::npos);
+  CHECK(text.find("Content-Length: 5\r\n\r\nx=1\r\n") != std::string::npos);
+  response.begin(455, "4");
+  response.finish();
+  CHECK(std::string(response.data(), response.size()).rfind("RTSP/1.0 455 Method Not Valid in This State\r\n", 0) == 0);
+}
+
+void bench() {
+  const std::string text = session();
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(text.data());
+  const int rounds = 200000;
+  RtspParser parser;
+  RtspResponse response;
+  size_t requests = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+      RtspRequest request;
+      size_t consumed = 0;
+      if (parser.parse(data + pos, text.size() - pos, request, consumed) != RtspParseResult::OK) {
+        break;
+      }
+      response.begin(200, request.cseq);
+      response.header("Audio-Jack-Status", "connected; type=analog");
+      response.finish();
+      pos += consumed;
+      requests++;
+    }
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  CHECK(requests == rounds * REQUEST_COUNT);
+  std::printf("rtsp_parser bench: %.0f ns per request and reply, %.1f MB/s parsed\n", seconds * 1e9 / requests,
+              text.size() * static_cast<double>(rounds) / seconds / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  test_session();
+  test_content_length_limits();
+  test_helpers();
+  test_response();
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench();
+  }
+  return test::finish("rtsp_parser_test");
+}
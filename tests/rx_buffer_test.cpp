@@ -0,0 +1,235 @@
+// RxBuffer: the consume cursor, compaction when the tail runs out of room, and a long stream of
+// interleaved RTP frames arriving in arbitrary chunks, which has to come out intact however often the
+// buffer wraps back to the start of its storage. Bytes moved per packet are compared with erasing each
+// consumed frame from the front of a vector, which is what the receive path did before; `--bench` also
+// prints both and their cost per packet.
+
+#include "rx_buffer.h"
+#include "test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using esphome::airplay_bridge::RxBuffer;
+
+namespace {
+
+// Matches the receive path: reads are at least this large, into a buffer of the default size.
+const size_t RX_MIN_READ = 512;
+const size_t CAPACITY = 8192;
+// A 352-frame PCM packet interleaved on the RTSP connection: '$', channel, length, RTP header, audio.
+const size_t FRAME_LEN = 4 + 12 + 352 * 4;
+
+void append(RxBuffer &buffer, const char *text) {
+  const size_t len = strlen(text);
+  CHECK(buffer.reserve(len) >= len);
+  memcpy(buffer.write_ptr(), text, len);
+  buffer.commit(len);
+}
+
+bool holds(const RxBuffer &buffer, const char *text) {
+  return buffer.size() == strlen(text) && memcmp(buffer.data(), text, buffer.size()) == 0;
+}
+
+void test_consume_cursor() {
+  RxBuffer buffer;
+  buffer.allocate(16);
+  CHECK(buffer.empty());
+  CHECK(buffer.writable() == 16);
+  append(buffer, "abcdefgh");
+  const uint8_t *start = buffer.data();
+  buffer.consume(3);
+  // Consuming only advances the cursor; nothing is copied.
+  CHECK(buffer.data() == start + 3);
+  CHECK(holds(buffer, "defgh"));
+  CHECK(buffer.writable() == 8);
+  CHECK(buffer.bytes_moved() == 0);
+  // Consuming everything rewinds to the start of the storage, again without copying.
+  buffer.consume(5);
+  CHECK(buffer.empty());
+  CHECK(buffer.data() == start);
+  CHECK(buffer.writable() == 16);
+  CHECK(buffer.bytes_moved() == 0);
+  append(buffer, "xy");
+  buffer.clear();
+  CHECK(buffer.empty());
+  CHECK(buffer.writable() == 16);
+}
+
+void test_compaction() {
+  RxBuffer buffer;
+  buffer.allocate(16);
+  append(buffer, "0123456789ABCD");
+  buffer.consume(10);
+  CHECK(holds(buffer, "ABCD"));
+  CHECK(buffer.writable() == 2);
+  // Enough room at the tail already: nothing moves.
+  CHECK(buffer.reserve(2) == 2);
+  CHECK(buffer.bytes_moved() == 0);
+  // Not enough: the four unconsumed bytes move to the front, and only they do.
+  CHECK(buffer.reserve(8) == 12);
+  CHECK(buffer.bytes_moved() == 4);
+  CHECK(holds(buffer, "ABCD"));
+  append(buffer, "EFGHIJKLMNOP");
+  CHECK(buffer.full());
+  CHECK(holds(buffer, "ABCDEFGHIJKLMNOP"));
+  // Full with nothing consumed: there is no room to make.
+  CHECK(buffer.reserve(1) == 0);
+  CHECK(buffer.bytes_moved() == 4);
+  buffer.consume(15);
+  CHECK(buffer.reserve(16) == 15);
+  CHECK(buffer.bytes_moved() == 5);
+  CHECK(holds(buffer, "P"));
+}
+
+void make_frame(uint32_t n, uint8_t *frame) {
+  frame[0] = '$';
+  frame[1] = 0;
+  frame[2] = static_cast<uint8_t>((FRAME_LEN - 4) >> 8);
+  frame[3] = static_cast<uint8_t>(FRAME_LEN - 4);
+  for (size_t i = 4; i < FRAME_LEN; i++) {
+    frame[i] = static_cast<uint8_t>(n * 31 + i);
+  }
+}
+
+// The sender's byte stream, handed out in chunks of random size the way recv() returns them. Built up
+// front, so that reading it costs no more than the copy a recv() does.
+class Stream {
+ public:
+  explicit Stream(uint32_t frames) : bytes_(static_cast<size_t>(frames) * FRAME_LEN) {
+    for (uint32_t n = 0; n < frames; n++) {
+      make_frame(n, this->bytes_.data() + static_cast<size_t>(n) * FRAME_LEN);
+    }
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> chunk(1, 4096);
+    for (size_t total = 0; total < this->bytes_.size();) {
+      this->chunks_.push_back(chunk(rng));
+      total += this->chunks_.back();
+    }
+  }
+
+  void rewind() {
+    this->offset_ = 0;
+    this->next_chunk_ = 0;
+    this->chunk_left_ = 0;
+  }
+  bool done() const { return this->offset_ == this->bytes_.size(); }
+
+  size_t read(uint8_t *out, size_t room) {
+    if (this->chunk_left_ == 0) {
+      this->chunk_left_ = this->chunks_[this->next_chunk_++];
+    }
+    // A chunk that does not fit is read in parts, like the rest of a socket's queue on the next recv().
+    const size_t len = std::min({room, this->bytes_.size() - this->offset_, this->chunk_left_});
+    this->chunk_left_ -= len;
+    memcpy(out, this->bytes_.data() + this->offset_, len);
+    this->offset_ += len;
+    return len;
+  }
+
+ protected:
+  std::vector<uint8_t> bytes_;
+  std::vector<size_t> chunks_;
+  size_t offset_{0};
+  size_t next_chunk_{0};
+  size_t chunk_left_{0};
+};
+
+// Streams everything through an RxBuffer the way the receive path does, taking out whole frames after
+// every read. Returns the number of frames that came out intact and in order when `verify` is set.
+uint32_t stream_rx_buffer(Stream &stream, RxBuffer &buffer, bool verify) {
+  uint8_t expected[FRAME_LEN];
+  uint32_t intact = 0;
+  uint32_t next = 0;
+  while (!stream.done()) {
+    if (buffer.reserve(RX_MIN_READ) == 0) {
+      return intact;
+    }
+    buffer.commit(stream.read(buffer.write_ptr(), buffer.writable()));
+    while (buffer.size() >= FRAME_LEN) {
+      if (verify) {
+        make_frame(next++, expected);
+        if (memcmp(buffer.data(), expected, FRAME_LEN) == 0) {
+          intact++;
+        }
+      }
+      buffer.consume(FRAME_LEN);
+    }
+  }
+  return intact;
+}
+
+// The same through a vector that has each consumed frame erased from its front. Returns the bytes moved.
+uint64_t stream_front_erase(Stream &stream) {
+  std::vector<uint8_t> buffer;
+  buffer.reserve(CAPACITY);
+  uint8_t chunk[CAPACITY];
+  uint64_t moved = 0;
+  while (!stream.done()) {
+    const size_t len = stream.read(chunk, CAPACITY - buffer.size());
+    buffer.insert(buffer.end(), chunk, chunk + len);
+    while (buffer.size() >= FRAME_LEN) {
+      buffer.erase(buffer.begin(), buffer.begin() + FRAME_LEN);
+      moved += buffer.size();
+    }
+  }
+  return moved;
+}
+
+void test_wraparound() {
+  const uint32_t frames = 20000;
+  Stream stream(frames);
+  RxBuffer buffer;
+  buffer.allocate(CAPACITY);
+  CHECK(stream_rx_buffer(stream, buffer, true) == frames);
+  CHECK(buffer.empty());
+  // Only a frame's unparsed tail is ever moved, so less than a frame per packet on average, and far less
+  // than erasing from the front, which moves everything behind every frame.
+  Stream same(frames);
+  const uint64_t moved = buffer.bytes_moved();
+  const uint64_t erase_moved = stream_front_erase(same);
+  CHECK(moved > 0);
+  CHECK(moved / frames < FRAME_LEN);
+  CHECK(moved * 4 < erase_moved);
+}
+
+void bench() {
+  const uint32_t frames = 20000;
+  const int rounds = 20;
+  RxBuffer buffer;
+  buffer.allocate(CAPACITY);
+  std::vector<Stream> streams(2, Stream(frames));
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    streams[0].rewind();
+    stream_rx_buffer(streams[0], buffer, false);
+  }
+  const double cursor_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  uint64_t erase_moved = 0;
+  start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    streams[1].rewind();
+    erase_moved += stream_front_erase(streams[1]);
+  }
+  const double erase_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  const double packets = static_cast<double>(frames) * rounds;
+  std::printf("rx_buffer bench: %u-byte frames through %u bytes, front erase %.0f bytes moved and %.0f ns per "
+              "packet, consume cursor %.0f bytes and %.0f ns\n",
+              static_cast<unsigned>(FRAME_LEN), static_cast<unsigned>(CAPACITY), erase_moved / packets,
+              erase_ns / packets, buffer.bytes_moved() / packets, cursor_ns / packets);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  test_consume_cursor();
+  test_compaction();
+  test_wraparound();
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench();
+  }
+  return test::finish("rx_buffer_test");
+}
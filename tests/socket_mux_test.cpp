@@ -0,0 +1,179 @@
+// SocketMux over local socket pairs: readiness after a poll, adding and removing sockets (including the
+// highest one), registration with the core, and the poll counters. `--bench` compares one poll() plus
+// ready() checks against a non-blocking recv() on every socket, which is what the loop did before.
+
+#include "socket_mux.h"
+#include "test.h"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using esphome::App;
+using esphome::airplay_bridge::SocketMux;
+
+namespace {
+
+struct Pair {
+  int local{-1};
+  int remote{-1};
+};
+
+Pair make_pair() {
+  int fds[2];
+  Pair pair;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+    pair.local = fds[0];
+    pair.remote = fds[1];
+  }
+  return pair;
+}
+
+void close_pair(const Pair &pair) {
+  close(pair.local);
+  close(pair.remote);
+}
+
+bool registered(int fd) { return std::find(App.socket_fds.begin(), App.socket_fds.end(), fd) != App.socket_fds.end(); }
+
+void drain(int fd) {
+  char sink[64];
+  while (recv(fd, sink, sizeof(sink), MSG_DONTWAIT) > 0) {
+  }
+}
+
+void test_readiness() {
+  SocketMux mux;
+  CHECK(mux.poll(0) == 0);
+  std::vector<Pair> pairs;
+  for (int i = 0; i < 4; i++) {
+    pairs.push_back(make_pair());
+    CHECK(pairs.back().local >= 0);
+    mux.add(pairs.back().local);
+  }
+  // Adding twice is harmless.
+  mux.add(pairs[0].local);
+  mux.add(-1);
+  CHECK(mux.size() == 4);
+  CHECK(App.socket_fds.size() == 4);
+
+  CHECK(mux.poll(0) == 0);
+  for (const Pair &pair : pairs) {
+    CHECK(!mux.ready(pair.local));
+  }
+  CHECK(send(pairs[1].remote, "x", 1, 0) == 1);
+  CHECK(send(pairs[3].remote, "x", 1, 0) == 1);
+  CHECK(mux.poll(0) == 2);
+  CHECK(!mux.ready(pairs[0].local));
+  CHECK(mux.ready(pairs[1].local));
+  CHECK(!mux.ready(pairs[2].local));
+  CHECK(mux.ready(pairs[3].local));
+  CHECK(!mux.ready(-1));
+  // Readiness is a snapshot: it stays until the next poll, which sees the socket drained.
+  drain(pairs[1].local);
+  CHECK(mux.ready(pairs[1].local));
+  CHECK(mux.poll(0) == 1);
+  CHECK(!mux.ready(pairs[1].local));
+
+  // Removing a ready socket forgets its readiness right away. Descriptors are handed out in order, so
+  // this is also the highest one, and the rest are still watched without it.
+  CHECK(pairs[3].local > pairs[2].remote);
+  mux.remove(pairs[3].local);
+  CHECK(!mux.ready(pairs[3].local));
+  CHECK(!registered(pairs[3].local));
+  CHECK(send(pairs[0].remote, "x", 1, 0) == 1);
+  CHECK(mux.poll(0) == 1);
+  CHECK(mux.ready(pairs[0].local));
+  CHECK(!mux.ready(pairs[3].local));
+  mux.remove(pairs[3].local);
+  CHECK(mux.size() == 3);
+
+  // A hung-up peer reads as ready, so the handler gets to see the 0-byte recv().
+  drain(pairs[0].local);
+  close(pairs[2].remote);
+  pairs[2].remote = -1;
+  CHECK(mux.poll(0) == 1);
+  CHECK(mux.ready(pairs[2].local));
+
+  // The poll with nothing registered is not counted.
+  CHECK(mux.polls() == 5);
+  CHECK(mux.ready_polls() == 4);
+
+  for (const Pair &pair : pairs) {
+    mux.remove(pair.local);
+    close_pair(pair);
+  }
+  CHECK(mux.size() == 0);
+  CHECK(App.socket_fds.empty());
+  CHECK(mux.poll(0) == 0);
+}
+
+void test_timeout() {
+  SocketMux mux;
+  const Pair pair = make_pair();
+  mux.add(pair.local);
+  const auto start = std::chrono::steady_clock::now();
+  CHECK(mux.poll(20) == 0);
+  const double waited_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  CHECK(waited_ms >= 15.0);
+  CHECK(!mux.ready(pair.local));
+  mux.remove(pair.local);
+  close_pair(pair);
+}
+
+void bench() {
+  // One control connection per target plus its UDP sockets and a couple of pending connections: about
+  // what a four-target bridge watches.
+  const int sockets = 24;
+  const int loops = 200000;
+  SocketMux mux;
+  std::vector<Pair> pairs;
+  for (int i = 0; i < sockets; i++) {
+    pairs.push_back(make_pair());
+    mux.add(pairs.back().local);
+  }
+  char sink[64];
+  auto start = std::chrono::steady_clock::now();
+  int found = 0;
+  for (int i = 0; i < loops; i++) {
+    for (const Pair &pair : pairs) {
+      if (recv(pair.local, sink, sizeof(sink), MSG_DONTWAIT) > 0 || errno != EAGAIN) {
+        found++;
+      }
+    }
+  }
+  const double recv_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loops; i++) {
+    mux.poll(0);
+    for (const Pair &pair : pairs) {
+      if (mux.ready(pair.local)) {
+        found++;
+      }
+    }
+  }
+  const double poll_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  CHECK(found == 0);
+  std::printf("socket_mux bench: %d idle sockets, %.0f ns per loop with recv() on each, %.0f ns with one poll()\n",
+              sockets, recv_ns / loops, poll_ns / loops);
+  for (const Pair &pair : pairs) {
+    mux.remove(pair.local);
+    close_pair(pair);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  test_readiness();
+  test_timeout();
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench();
+  }
+  return test::finish("socket_mux_test");
+}
@@ -0,0 +1,152 @@
+// StreamRing with a producer thread writing numbered frames as fast as it can while readers copy them out
+// the way the HTTP stream does. Every frame a reader is handed has to be whole and in order; the only
+// thing allowed to go missing is a run of frames skipped after falling behind.
+
+#include "stream_ring.h"
+#include "test.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using esphome::airplay_bridge::StreamRing;
+
+namespace {
+
+const uint32_t FRAME_BYTES = 4;
+const size_t CHUNK = 2048;
+
+// Frame n holds n in its first two bytes and its complement in the other two, so a frame mixing bytes
+// of two writes does not check out.
+void make_frame(uint32_t n, uint8_t *frame) {
+  const uint16_t value = static_cast<uint16_t>(n);
+  const uint16_t inverse = static_cast<uint16_t>(~value);
+  memcpy(frame, &value, 2);
+  memcpy(frame + 2, &inverse, 2);
+}
+
+bool read_frame(const uint8_t *frame, uint16_t &value) {
+  uint16_t inverse;
+  memcpy(&value, frame, 2);
+  memcpy(&inverse, frame + 2, 2);
+  return static_cast<uint16_t>(~value) == inverse;
+}
+
+void test_single_thread() {
+  StreamRing ring;
+  CHECK(ring.allocate(5000, false));
+  CHECK(ring.capacity() == 8192);
+  uint8_t block[1024];
+  for (uint32_t i = 0; i < sizeof(block) / FRAME_BYTES; i++) {
+    make_frame(i, block + i * FRAME_BYTES);
+  }
+  uint32_t pos = ring.head();
+  uint64_t skipped = 0;
+  uint8_t out[CHUNK];
+  CHECK(ring.copy(pos, out, sizeof(out), FRAME_BYTES, skipped) == 0);
+  ring.write(block, sizeof(block));
+  CHECK(ring.copy(pos, out, sizeof(out), FRAME_BYTES, skipped) == sizeof(block));
+  CHECK(memcmp(out, block, sizeof(block)) == 0);
+  CHECK(skipped == 0);
+  // Four more blocks are exactly max_lag(); the fifth overruns the reader, which then resumes max_lag()
+  // behind the head, on a frame.
+  pos += sizeof(block);
+  for (int i = 0; i < 4; i++) {
+    ring.write(block, sizeof(block));
+  }
+  CHECK(!ring.overrun(pos));
+  ring.write(block, sizeof(block));
+  CHECK(ring.overrun(pos));
+  const size_t copied = ring.copy(pos, out, sizeof(out), FRAME_BYTES, skipped);
+  CHECK(skipped == 5 * sizeof(block) - ring.max_lag());
+  CHECK(ring.head() - pos == ring.max_lag());
+  CHECK(copied == sizeof(out));
+  CHECK(memcmp(out, block, sizeof(out) < sizeof(block) ? sizeof(out) : sizeof(block)) == 0);
+  // A write bigger than the ring keeps only its tail.
+  std::vector<uint8_t> big(3 * ring.capacity());
+  for (uint32_t i = 0; i < big.size() / FRAME_BYTES; i++) {
+    make_frame(i, &big[i * FRAME_BYTES]);
+  }
+  ring.write(big.data(), big.size());
+  pos = ring.head() - ring.max_lag();
+  CHECK(ring.copy(pos, out, sizeof(out), FRAME_BYTES, skipped) == sizeof(out));
+  CHECK(memcmp(out, &big[big.size() - ring.max_lag()], sizeof(out)) == 0);
+}
+
+struct ReaderResult {
+  uint64_t frames{0};
+  uint64_t skipped{0};
+  uint32_t torn{0};
+  uint32_t out_of_order{0};
+};
+
+// Copies frames out of `ring` until `stop`, checking each one. `pace` slows the reader down so it keeps
+// falling behind and has to skip.
+void read_loop(const StreamRing &ring, const std::atomic<bool> &stop, int pace, ReaderResult &result) {
+  uint8_t out[CHUNK];
+  uint32_t pos = ring.head();
+  bool started = false;
+  uint16_t expected = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    const uint64_t skipped_before = result.skipped;
+    const size_t len = ring.copy(pos, out, sizeof(out), FRAME_BYTES, result.skipped);
+    if (result.skipped != skipped_before) {
+      expected = static_cast<uint16_t>(expected + (result.skipped - skipped_before) / FRAME_BYTES);
+    }
+    // A reader may stop mid-frame, as a partial send() does; only whole frames are checked here.
+    const size_t frames = len / FRAME_BYTES;
+    for (size_t i = 0; i < frames; i++) {
+      uint16_t value;
+      if (!read_frame(out + i * FRAME_BYTES, value)) {
+        result.torn++;
+      } else if (started && value != expected) {
+        result.out_of_order++;
+      }
+      started = true;
+      expected = static_cast<uint16_t>(value + 1);
+    }
+    pos += static_cast<uint32_t>(frames * FRAME_BYTES);
+    result.frames += frames;
+    for (volatile int spin = 0; spin < pace; spin = spin + 1) {
+    }
+  }
+}
+
+void test_concurrent() {
+  StreamRing ring;
+  CHECK(ring.allocate(16384, false));
+  std::atomic<bool> stop{false};
+  ReaderResult fast, slow;
+  std::thread fast_reader(read_loop, std::cref(ring), std::cref(stop), 0, std::ref(fast));
+  std::thread slow_reader(read_loop, std::cref(ring), std::cref(stop), 20000, std::ref(slow));
+  // Blocks of varying size, some larger than max_lag() and some larger than the whole ring.
+  std::vector<uint8_t> block(40000);
+  uint32_t next = 0;
+  const size_t sizes[] = {1408, 4, 5632, 12000, 352, 40000, 2048};
+  for (int round = 0; round < 200000; round++) {
+    const size_t bytes = sizes[round % (sizeof(sizes) / sizeof(sizes[0]))];
+    for (size_t i = 0; i < bytes / FRAME_BYTES; i++) {
+      make_frame(next++, &block[i * FRAME_BYTES]);
+    }
+    ring.write(block.data(), bytes);
+  }
+  stop = true;
+  fast_reader.join();
+  slow_reader.join();
+  for (const ReaderResult *result : {&fast, &slow}) {
+    CHECK(result->frames > 0);
+    CHECK(result->torn == 0);
+    CHECK(result->out_of_order == 0);
+  }
+  // The slow reader must have been overrun for the test to mean anything.
+  CHECK(slow.skipped > 0);
+}
+
+}  // namespace
+
+int main() {
+  test_single_thread();
+  test_concurrent();
+  return test::finish("stream_ring_test");
+}
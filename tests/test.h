@@ -0,0 +1,33 @@
+#pragma once
+
+// Minimal check macros for the host tests. Unlike assert() they stay active under NDEBUG and report every
+// failure instead of stopping at the first one.
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace test {
+
+inline int &failures() {
+  static int count = 0;
+  return count;
+}
+
+inline int finish(const char *name) {
+  if (failures() != 0) {
+    std::printf("%s: %d check(s) failed\n", name, failures());
+    return EXIT_FAILURE;
+  }
+  std::printf("%s: ok\n", name);
+  return EXIT_SUCCESS;
+}
+
+}  // namespace test
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      test::failures()++; \
+    } \
+  } while (0)